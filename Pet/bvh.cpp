@@ -0,0 +1,662 @@
+#include "bvh.h"
+
+#include "threads.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <random>
+
+enum class Containment
+{
+    Outside,
+    Intersect,
+    Inside
+};
+
+static Containment Classify(const glm::vec3 &min, const glm::vec3 &max, const Frustum &frustum)
+{
+    auto center = (min + max) * 0.5f;
+    auto extent = (max - min) * 0.5f;
+    auto inside = true;
+
+    for (const auto &plane : frustum.planes)
+    {
+        auto normal = glm::vec3(plane);
+        auto distance = glm::dot(normal, center) + plane.w;
+        auto radius = glm::dot(glm::abs(normal), extent);
+
+        if (distance + radius < 0.f)
+            return Containment::Outside;
+
+        if (distance - radius < 0.f)
+            inside = false;
+    }
+
+    return inside ? Containment::Inside : Containment::Intersect;
+}
+
+static bool IntersectSlab(const Ray &ray, const glm::vec3 &invDir, const glm::vec3 &min, const glm::vec3 &max,
+                          float maxDistance, float &distance)
+{
+    auto t0 = (min - ray.origin) * invDir;
+    auto t1 = (max - ray.origin) * invDir;
+    auto tMin = glm::min(t0, t1);
+    auto tMax = glm::max(t0, t1);
+
+    auto enter = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.f));
+    auto exit = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, maxDistance));
+
+    distance = enter;
+
+    return enter <= exit;
+}
+
+#pragma region Bounds
+
+void Aabb::Grow(const glm::vec3 &point)
+{
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void Aabb::Grow(const Aabb &other)
+{
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+glm::vec3 Aabb::Center() const
+{
+    return (min + max) * 0.5f;
+}
+
+float Aabb::Area() const
+{
+    auto size = max - min;
+    return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// Gribb-Hartmann extraction, glm is column major and depth is [0, 1]
+Frustum Frustum::FromMatrix(const glm::mat4 &viewProj)
+{
+    auto row = [&](int i) { return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]); };
+
+    Frustum frustum;
+    frustum.planes[0] = row(3) + row(0); // left
+    frustum.planes[1] = row(3) - row(0); // right
+    frustum.planes[2] = row(3) + row(1); // bottom
+    frustum.planes[3] = row(3) - row(1); // top
+    frustum.planes[4] = row(2);          // near
+    frustum.planes[5] = row(3) - row(2); // far
+
+    for (auto &plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+
+    return frustum;
+}
+
+#pragma endregion
+
+#pragma region Build
+
+void Bvh::Build(const list<Aabb> &bounds)
+{
+    auto count = static_cast<u32>(bounds.size());
+
+    nodes.clear();
+    parents.clear();
+    objects.resize(count);
+    leaves.assign(count, None);
+
+    for (auto *soa : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ})
+        soa->resize(count);
+
+    if (count == 0)
+        return;
+
+    auto centers = list<glm::vec3>(count);
+
+    for (u32 i = 0; i < count; i++)
+    {
+        objects[i] = i;
+        centers[i] = bounds[i].Center();
+        StoreSlot(i, bounds[i]);
+    }
+
+    nodes.reserve(2 * static_cast<size_t>(count));
+    parents.reserve(2 * static_cast<size_t>(count));
+
+    nodes.push_back({glm::vec3(0.f), 0, glm::vec3(0.f), count});
+    parents.push_back(None);
+
+    FitNode(0);
+    Subdivide(0, centers);
+
+    for (u32 node = 0; node < nodes.size(); node++)
+        for (u32 slot = nodes[node].first; nodes[node].count > 0 && slot < nodes[node].first + nodes[node].count; slot++)
+            leaves[objects[slot]] = node;
+}
+
+void Bvh::Subdivide(u32 root, list<glm::vec3> &centers)
+{
+    auto swap = [&](u32 a, u32 b) {
+        std::swap(objects[a], objects[b]);
+        std::swap(centers[a], centers[b]);
+
+        for (auto *soa : {&minX, &minY, &minZ, &maxX, &maxY, &maxZ})
+            std::swap((*soa)[a], (*soa)[b]);
+    };
+
+    auto stack = list<u32>{root};
+
+    while (!stack.empty())
+    {
+        auto index = stack.back();
+        stack.pop_back();
+
+        auto node = nodes[index];
+
+        if (node.count <= MaxLeafSize)
+            continue;
+
+        // Bin the centroids along each axis and sweep for the cheapest split
+
+        Aabb centroidBounds;
+
+        for (u32 slot = node.first; slot < node.first + node.count; slot++)
+            centroidBounds.Grow(centers[slot]);
+
+        auto bestCost = limits<float>::max();
+        auto bestAxis = -1;
+        auto bestSplit = 0.f;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            auto lo = centroidBounds.min[axis];
+            auto hi = centroidBounds.max[axis];
+
+            if (hi - lo <= 1e-6f)
+                continue;
+
+            struct Bin
+            {
+                Aabb bounds;
+                u32 count = 0;
+            };
+
+            arr<Bin, BinCount> bins{};
+            auto scale = BinCount / (hi - lo);
+
+            for (u32 slot = node.first; slot < node.first + node.count; slot++)
+            {
+                auto bin = std::min(BinCount - 1, static_cast<u32>((centers[slot][axis] - lo) * scale));
+                bins[bin].count++;
+                bins[bin].bounds.Grow(LoadSlot(slot));
+            }
+
+            arr<float, BinCount - 1> leftArea{}, rightArea{};
+            arr<u32, BinCount - 1> leftCount{}, rightCount{};
+            Aabb leftBox, rightBox;
+            u32 leftSum = 0, rightSum = 0;
+
+            for (u32 i = 0; i < BinCount - 1; i++)
+            {
+                leftSum += bins[i].count;
+                leftCount[i] = leftSum;
+                leftBox.Grow(bins[i].bounds);
+                leftArea[i] = leftSum > 0 ? leftBox.Area() : 0.f;
+
+                rightSum += bins[BinCount - 1 - i].count;
+                rightCount[BinCount - 2 - i] = rightSum;
+                rightBox.Grow(bins[BinCount - 1 - i].bounds);
+                rightArea[BinCount - 2 - i] = rightSum > 0 ? rightBox.Area() : 0.f;
+            }
+
+            for (u32 i = 0; i < BinCount - 1; i++)
+            {
+                auto cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = lo + (i + 1) / scale;
+                }
+            }
+        }
+
+        auto leafCost = node.count * Aabb{node.min, node.max}.Area();
+
+        if (bestAxis < 0 || bestCost >= leafCost)
+            continue;
+
+        // Partition in place, a subtree always owns a contiguous slot range
+
+        i64 i = node.first;
+        i64 j = static_cast<i64>(node.first) + node.count - 1;
+
+        while (i <= j)
+        {
+            if (centers[i][bestAxis] < bestSplit)
+                i++;
+            else
+                swap(static_cast<u32>(i), static_cast<u32>(j--));
+        }
+
+        auto leftCount = static_cast<u32>(i - node.first);
+
+        if (leftCount == 0 || leftCount == node.count)
+            continue;
+
+        auto left = static_cast<u32>(nodes.size());
+
+        nodes.push_back({glm::vec3(0.f), node.first, glm::vec3(0.f), leftCount});
+        nodes.push_back({glm::vec3(0.f), node.first + leftCount, glm::vec3(0.f), node.count - leftCount});
+        parents.push_back(index);
+        parents.push_back(index);
+
+        nodes[index].first = left;
+        nodes[index].count = 0;
+
+        FitNode(left);
+        FitNode(left + 1);
+
+        stack.push_back(left);
+        stack.push_back(left + 1);
+    }
+}
+
+// Only objects whose bounds changed touch the tree, each one walks up from
+// its leaf until an ancestor comes out unchanged
+void Bvh::Refit(const list<Aabb> &bounds)
+{
+    if (bounds.size() != objects.size())
+    {
+        Build(bounds);
+        return;
+    }
+
+    list<u32> dirty;
+
+    for (u32 slot = 0; slot < objects.size(); slot++)
+    {
+        const auto &box = bounds[objects[slot]];
+
+        if (box.min.x != minX[slot] || box.min.y != minY[slot] || box.min.z != minZ[slot] ||
+            box.max.x != maxX[slot] || box.max.y != maxY[slot] || box.max.z != maxZ[slot])
+        {
+            StoreSlot(slot, box);
+            dirty.push_back(leaves[objects[slot]]);
+        }
+    }
+
+    for (auto node : dirty)
+    {
+        while (node != None)
+        {
+            auto before = nodes[node];
+            FitNode(node);
+
+            if (before.min == nodes[node].min && before.max == nodes[node].max)
+                break;
+
+            node = parents[node];
+        }
+    }
+}
+
+void Bvh::FitNode(u32 index)
+{
+    auto &node = nodes[index];
+
+    if (node.count == 0)
+    {
+        const auto &left = nodes[node.first];
+        const auto &right = nodes[node.first + 1];
+        node.min = glm::min(left.min, right.min);
+        node.max = glm::max(left.max, right.max);
+        return;
+    }
+
+    Aabb box;
+
+    for (u32 slot = node.first; slot < node.first + node.count; slot++)
+        box.Grow(LoadSlot(slot));
+
+    node.min = box.min;
+    node.max = box.max;
+}
+
+void Bvh::StoreSlot(u32 slot, const Aabb &bounds)
+{
+    minX[slot] = bounds.min.x;
+    minY[slot] = bounds.min.y;
+    minZ[slot] = bounds.min.z;
+    maxX[slot] = bounds.max.x;
+    maxY[slot] = bounds.max.y;
+    maxZ[slot] = bounds.max.z;
+}
+
+Aabb Bvh::LoadSlot(u32 slot) const
+{
+    return {{minX[slot], minY[slot], minZ[slot]}, {maxX[slot], maxY[slot], maxZ[slot]}};
+}
+
+u32 Bvh::GetObjectCount() const
+{
+    return static_cast<u32>(objects.size());
+}
+
+#pragma endregion
+
+#pragma region Queries
+
+void Bvh::QueryFrustum(const Frustum &frustum, list<u32> &visible) const
+{
+    visible.clear();
+
+    if (!nodes.empty())
+        QueryNode(0, frustum, visible);
+}
+
+// Expands the top of the tree into a few subtrees per worker, each worker
+// gathers its own list and they are concatenated in tree order
+void Bvh::QueryFrustum(const Frustum &frustum, list<u32> &visible, Threads &threads) const
+{
+    auto workers = static_cast<u32>(std::max(1, threads.GetThreadNum()));
+
+    if (objects.size() < ParallelThreshold || workers == 1)
+    {
+        QueryFrustum(frustum, visible);
+        return;
+    }
+
+    auto roots = list<u32>{0};
+
+    while (roots.size() < workers * 4)
+    {
+        list<u32> next;
+
+        for (auto root : roots)
+        {
+            if (nodes[root].count > 0)
+            {
+                next.push_back(root);
+                continue;
+            }
+
+            next.push_back(nodes[root].first);
+            next.push_back(nodes[root].first + 1);
+        }
+
+        if (next.size() == roots.size())
+            break;
+
+        roots.swap(next);
+    }
+
+    auto partial = list<list<u32>>(roots.size());
+
+    threads.ParallelFor(static_cast<u32>(roots.size()),
+                        [&](u32 i) { QueryNode(roots[i], frustum, partial[i]); });
+
+    size_t total = 0;
+
+    for (const auto &part : partial)
+        total += part.size();
+
+    visible.clear();
+    visible.reserve(total);
+
+    for (const auto &part : partial)
+        visible.insert(visible.end(), part.begin(), part.end());
+}
+
+void Bvh::QueryNode(u32 root, const Frustum &frustum, list<u32> &visible) const
+{
+    list<u32> stack;
+    stack.reserve(64);
+    stack.push_back(root);
+
+    while (!stack.empty())
+    {
+        auto index = stack.back();
+        stack.pop_back();
+
+        const auto &node = nodes[index];
+        auto containment = Classify(node.min, node.max, frustum);
+
+        if (containment == Containment::Outside)
+            continue;
+
+        if (containment == Containment::Inside)
+        {
+            // Whole subtree visible, its slots are contiguous
+
+            auto lo = index;
+            auto hi = index;
+
+            while (nodes[lo].count == 0)
+                lo = nodes[lo].first;
+            while (nodes[hi].count == 0)
+                hi = nodes[hi].first + 1;
+
+            visible.insert(visible.end(), objects.begin() + nodes[lo].first,
+                           objects.begin() + nodes[hi].first + nodes[hi].count);
+            continue;
+        }
+
+        if (node.count > 0)
+        {
+            QueryLeaf(node, frustum, visible);
+            continue;
+        }
+
+        stack.push_back(node.first + 1);
+        stack.push_back(node.first);
+    }
+}
+
+// Branch free per object, leaves hold at most four objects to fill a lane set
+void Bvh::QueryLeaf(const BvhNode &leaf, const Frustum &frustum, list<u32> &visible) const
+{
+    arr<bool, MaxLeafSize> inside{};
+    auto end = std::min(leaf.count, MaxLeafSize);
+
+    for (u32 i = 0; i < end; i++)
+    {
+        auto slot = leaf.first + i;
+        auto result = true;
+
+        for (const auto &plane : frustum.planes)
+        {
+            auto x = plane.x >= 0.f ? maxX[slot] : minX[slot];
+            auto y = plane.y >= 0.f ? maxY[slot] : minY[slot];
+            auto z = plane.z >= 0.f ? maxZ[slot] : minZ[slot];
+            result &= plane.x * x + plane.y * y + plane.z * z + plane.w >= 0.f;
+        }
+
+        inside[i] = result;
+    }
+
+    for (u32 i = 0; i < end; i++)
+        if (inside[i])
+            visible.push_back(objects[leaf.first + i]);
+
+    // Leaves that could not be split (coincident centroids) keep the rest here
+
+    for (u32 slot = leaf.first + end; slot < leaf.first + leaf.count; slot++)
+        if (Classify(LoadSlot(slot).min, LoadSlot(slot).max, frustum) != Containment::Outside)
+            visible.push_back(objects[slot]);
+}
+
+opt<RayHit> Bvh::QueryRay(const Ray &ray) const
+{
+    if (nodes.empty())
+        return std::nullopt;
+
+    auto invDir = glm::vec3(1.f) / ray.direction;
+    auto closest = ray.maxDistance;
+    opt<RayHit> hit;
+
+    list<u32> stack;
+    stack.reserve(64);
+    stack.push_back(0);
+
+    while (!stack.empty())
+    {
+        auto index = stack.back();
+        stack.pop_back();
+
+        const auto &node = nodes[index];
+        float distance;
+
+        if (!IntersectSlab(ray, invDir, node.min, node.max, closest, distance))
+            continue;
+
+        if (node.count > 0)
+        {
+            for (u32 slot = node.first; slot < node.first + node.count; slot++)
+            {
+                auto box = LoadSlot(slot);
+
+                if (IntersectSlab(ray, invDir, box.min, box.max, closest, distance))
+                {
+                    closest = distance;
+                    hit = RayHit{objects[slot], distance};
+                }
+            }
+
+            continue;
+        }
+
+        // Visit the nearer child first so the farther one is more likely culled
+
+        float leftDistance, rightDistance;
+        const auto &left = nodes[node.first];
+        const auto &right = nodes[node.first + 1];
+        auto hitLeft = IntersectSlab(ray, invDir, left.min, left.max, closest, leftDistance);
+        auto hitRight = IntersectSlab(ray, invDir, right.min, right.max, closest, rightDistance);
+
+        if (hitLeft && hitRight)
+        {
+            auto nearFirst = leftDistance <= rightDistance;
+            stack.push_back(nearFirst ? node.first + 1 : node.first);
+            stack.push_back(nearFirst ? node.first : node.first + 1);
+        }
+        else if (hitLeft)
+        {
+            stack.push_back(node.first);
+        }
+        else if (hitRight)
+        {
+            stack.push_back(node.first + 1);
+        }
+    }
+
+    return hit;
+}
+
+void Bvh::QueryRays(const list<Ray> &rays, list<opt<RayHit>> &hits, Threads &threads) const
+{
+    hits.resize(rays.size());
+
+    auto workers = static_cast<u32>(std::max(1, threads.GetThreadNum()));
+    auto chunk = (rays.size() + workers - 1) / workers;
+
+    threads.ParallelFor(workers, [&](u32 worker) {
+        auto first = std::min(rays.size(), worker * chunk);
+        auto last = std::min(rays.size(), first + chunk);
+
+        for (auto i = first; i < last; i++)
+            hits[i] = QueryRay(rays[i]);
+    });
+}
+
+#pragma endregion
+
+#pragma region Benchmark
+
+void Bvh::Benchmark(Threads &threads)
+{
+    auto rng = std::mt19937(1234);
+    auto position = std::uniform_real_distribution<float>(-1000.f, 1000.f);
+    auto extent = std::uniform_real_distribution<float>(0.5f, 5.f);
+    auto jitter = std::uniform_real_distribution<float>(-2.f, 2.f);
+
+    auto view = glm::lookAt(glm::vec3(0.f, 0.f, -1200.f), glm::vec3(0.f), glm::vec3(0.f, 1.f, 0.f));
+    auto proj = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 1500.f);
+    auto frustum = Frustum::FromMatrix(proj * view);
+
+    std::cout << std::endl << "BVH benchmark [" << threads.GetThreadNum() << " threads] :" << std::endl;
+
+    for (u32 count : {10000u, 100000u, 1000000u})
+    {
+        auto bounds = list<Aabb>(count);
+
+        for (auto &box : bounds)
+        {
+            auto center = glm::vec3(position(rng), position(rng), position(rng));
+            auto half = glm::vec3(extent(rng), extent(rng), extent(rng));
+            box = {center - half, center + half};
+        }
+
+        Bvh bvh;
+
+        auto start = clk::now();
+        bvh.Build(bounds);
+        auto buildMs = ElapsedMs(start);
+
+        // One in ten objects moves
+
+        for (u32 i = 0; i < count; i += 10)
+        {
+            auto offset = glm::vec3(jitter(rng), jitter(rng), jitter(rng));
+            bounds[i].min += offset;
+            bounds[i].max += offset;
+        }
+
+        start = clk::now();
+        bvh.Refit(bounds);
+        auto refitMs = ElapsedMs(start);
+
+        list<u32> visible;
+
+        start = clk::now();
+        bvh.QueryFrustum(frustum, visible);
+        auto serialMs = ElapsedMs(start);
+
+        start = clk::now();
+        bvh.QueryFrustum(frustum, visible, threads);
+        auto parallelMs = ElapsedMs(start);
+
+        u32 bruteVisible = 0;
+
+        start = clk::now();
+        for (const auto &box : bounds)
+            bruteVisible += Classify(box.min, box.max, frustum) != Containment::Outside;
+        auto bruteMs = ElapsedMs(start);
+
+        auto rays = list<Ray>(10000);
+
+        for (auto &ray : rays)
+        {
+            ray.origin = glm::vec3(position(rng), position(rng), -1200.f);
+            ray.direction = glm::normalize(glm::vec3(jitter(rng), jitter(rng), 10.f));
+        }
+
+        list<opt<RayHit>> hits;
+
+        start = clk::now();
+        bvh.QueryRays(rays, hits, threads);
+        auto rayMs = ElapsedMs(start);
+
+        std::cout << "    " << count << " objects:" << std::endl;
+        std::cout << "        build " << buildMs << " ms, refit (10% moved) " << refitMs << " ms" << std::endl;
+        std::cout << "        frustum " << serialMs << " ms serial, " << parallelMs << " ms parallel, " << bruteMs
+                  << " ms brute force (" << visible.size() << "/" << bruteVisible << " visible)" << std::endl;
+        std::cout << "        10000 rays " << rayMs << " ms" << std::endl;
+    }
+}
+
+#pragma endregion
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "core.h"
+
+class Threads;
+
+struct Aabb
+{
+    glm::vec3 min = glm::vec3(limits<float>::max());
+    glm::vec3 max = glm::vec3(-limits<float>::max());
+
+    void Grow(const glm::vec3 &point);
+    void Grow(const Aabb &other);
+    glm::vec3 Center() const;
+    float Area() const;
+};
+
+struct Frustum
+{
+    arr<glm::vec4, 6> planes{}; // xyz normal, w distance, pointing inwards
+
+    static Frustum FromMatrix(const glm::mat4 &viewProj);
+};
+
+struct Ray
+{
+    glm::vec3 origin = glm::vec3(0.f);
+    glm::vec3 direction = glm::vec3(0.f, 0.f, 1.f);
+    float maxDistance = limits<float>::max();
+};
+
+struct RayHit
+{
+    u32 object = 0;
+    float distance = 0.f;
+};
+
+// 32 bytes, two nodes per cache line
+struct BvhNode
+{
+    glm::vec3 min;
+    u32 first; // leaf: first slot in leaf order, inner: left child (right is left + 1)
+    glm::vec3 max;
+    u32 count; // objects in the leaf, 0 for inner nodes
+};
+
+// Bounding volume hierarchy over object bounds, built with the binned surface
+// area heuristic. Objects keep the ids they were built with, moving them only
+// needs a refit. Leaf contents are mirrored as SoA so leaf ranges are tested
+// in tight loops the compiler can vectorize.
+class Bvh
+{
+  public:
+    void Build(const list<Aabb> &bounds);
+    void Refit(const list<Aabb> &bounds);
+
+    u32 GetObjectCount() const;
+
+    void QueryFrustum(const Frustum &frustum, list<u32> &visible) const;
+    void QueryFrustum(const Frustum &frustum, list<u32> &visible, Threads &threads) const;
+    opt<RayHit> QueryRay(const Ray &ray) const;
+    void QueryRays(const list<Ray> &rays, list<opt<RayHit>> &hits, Threads &threads) const;
+
+    static void Benchmark(Threads &threads);
+
+  private:
+    static constexpr u32 BinCount = 16;
+    static constexpr u32 MaxLeafSize = 4;
+    static constexpr u32 ParallelThreshold = 4096;
+    static constexpr u32 None = 0xFFFFFFFF;
+
+    list<BvhNode> nodes;
+    list<u32> parents;
+    list<u32> objects; // object id per leaf slot
+    list<u32> leaves;  // leaf node per object id
+
+    list<float> minX, minY, minZ, maxX, maxY, maxZ; // per leaf slot
+
+    void Subdivide(u32 node, list<glm::vec3> &centers);
+    void FitNode(u32 node);
+    void StoreSlot(u32 slot, const Aabb &bounds);
+    Aabb LoadSlot(u32 slot) const;
+
+    void QueryNode(u32 root, const Frustum &frustum, list<u32> &visible) const;
+    void QueryLeaf(const BvhNode &leaf, const Frustum &frustum, list<u32> &visible) const;
+};
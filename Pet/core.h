@@ -1,9 +1,12 @@
 #pragma once
 
-#define VK_USE_PLATFORM_WIN32_KHR
-
+#define NOMINMAX
 #define GLFW_INCLUDE_VULKAN
+
+#ifdef _WIN32
+#define VK_USE_PLATFORM_WIN32_KHR
 #define GLFW_EXPOSE_NATIVE_WIN32
+#endif
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -13,6 +16,7 @@
 
 #include <glm/glm.hpp>
 
+#include <cctype>
 #include <fstream>
 #include <functional>
 #include <iostream>
@@ -20,6 +24,7 @@
 #include <stdint.h>
 #include <string.h>
 
+#include <algorithm>
 #include <array>
 #include <vector>
 
@@ -29,9 +34,12 @@
 #include <map>
 #include <unordered_map>
 
+#include <chrono>
 #include <limits>
 
+#include <atomic>
 #include <condition_variable>
+#include <exception>
 #include <mutex>
 #include <queue>
 #include <thread>
@@ -48,6 +56,7 @@ using u32 = std::uint32_t;
 using u64 = std::uint64_t;
 using job = std::function<void()>;
 using str = std::string;
+using clk = std::chrono::steady_clock;
 
 template <typename... Ts> using opt = std::optional<Ts...>;
 template <typename Ts, size_t Ta> using arr = std::array<Ts, Ta>;
@@ -61,6 +70,11 @@ template <typename... Ts> using map = std::unordered_multimap<Ts...>;
 template <typename... Ts> using del = std::function<Ts...>;
 template <typename... Ts> using limits = std::numeric_limits<Ts...>;
 
+inline double ElapsedMs(const clk::time_point &since)
+{
+    return std::chrono::duration<double, std::milli>(clk::now() - since).count();
+}
+
 #ifdef _DEBUG
 static bool IsDebug = true;
 #else
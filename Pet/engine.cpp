@@ -1,8 +1,10 @@
 #include "engine.h"
 
+#include "bvh.h"
 #include "input.h"
 #include "logic.h"
 #include "render.h"
+#include "taskgraph.h"
 #include "threads.h"
 
 App *App::instance = nullptr;
@@ -12,8 +14,11 @@ App &App::Instance()
     return *instance;
 }
 
-App::App()
+App::App(int argc, char **argv)
 {
+    for (int i = 1; i < argc; i++)
+        args.push_back(argv[i]);
+
     LOG("\nInstance already exists \"%i\"", 3, "!", 29.f);
 
     if (instance)
@@ -24,11 +29,137 @@ App::App()
 
 void App::Init()
 {
+    startTime = clk::now();
+
     threads.Init();
 
-    render.Init();
-    input.Init();
-    logic.Init();
+    // Live input can be recorded together with the seed and replayed later in
+    // its place, so perf runs see the same frames every time
+    if (auto path = GetArg("--replay"))
+    {
+        seed = input.StartReplay(*path);
+    }
+    else
+    {
+        auto fixedSeed = GetArg("--seed");
+        seed = fixedSeed ? static_cast<u32>(std::stoul(*fixedSeed))
+                         : static_cast<u32>(clk::now().time_since_epoch().count());
+
+        if (auto path = GetArg("--record"))
+            input.StartRecording(*path, seed);
+    }
+
+    render.SetOffscreen(HasArg("--offscreen"));
+
+    if (auto count = GetArg("--frames-in-flight"))
+        render.SetFramesInFlight(static_cast<u32>(std::stoul(*count)));
+
+    // Storage of the mesh vertices: float, half or snorm
+    if (auto packing = GetArg("--vertex-packing"))
+    {
+        if (*packing == "half")
+            render.SetVertexPacking(VertexPacking::Half);
+        else if (*packing == "snorm")
+            render.SetVertexPacking(VertexPacking::Snorm);
+    }
+
+    // Startup runs as a dependency graph, the renderer brings most of it
+    TaskGraph startup;
+    auto renderReady = render.Init(startup);
+
+    startup.Add("Input", [this]() { input.Init(); }, {renderReady}, true);
+    startup.Add("Logic", [this]() { logic.Init(); }, {renderReady});
+    startup.Run(threads);
+    startup.PrintTimeline("Startup");
+
+    // Poll to present time of the consumed input, once per second
+    input.SetLatencyReport(HasArg("--input-latency"));
+
+    // GPU frame time in ms the scene resolution adapts to
+    if (auto budget = GetArg("--dynamic-resolution"))
+        render.SetDynamicResolution(std::stod(*budget));
+
+    if (HasArg("--bench-record"))
+    {
+        render.BenchmarkRecording();
+        Quit();
+    }
+
+    if (HasArg("--bench-resize"))
+    {
+        render.BenchmarkResize();
+        Quit();
+    }
+
+    if (HasArg("--bench-overdraw"))
+    {
+        render.BenchmarkOverdraw();
+        Quit();
+    }
+
+    if (HasArg("--bench-vertex-packing"))
+    {
+        render.BenchmarkVertexPacking();
+        Quit();
+    }
+
+    if (HasArg("--bench-lod"))
+    {
+        render.BenchmarkLod();
+        Quit();
+    }
+
+    if (HasArg("--bench-pipelines"))
+    {
+        render.BenchmarkPipelineVariants();
+        Quit();
+    }
+
+    if (HasArg("--bench-sprites"))
+    {
+        render.BenchmarkSprites();
+        Quit();
+    }
+
+    if (HasArg("--bench-particles"))
+    {
+        render.BenchmarkParticles();
+        Quit();
+    }
+
+    if (HasArg("--bench-bvh"))
+    {
+        Bvh::Benchmark(threads);
+        Quit();
+    }
+
+    // GPU particles out of an emitter at the origin, capacity as the value
+    if (auto count = GetArg("--particles"))
+    {
+        ParticleEmitter emitter;
+        emitter.rate = static_cast<float>(std::stoul(*count)) / emitter.lifetime;
+
+        render.SetParticleCapacity(static_cast<u32>(std::stoul(*count)));
+        render.SetParticleEmitter(emitter);
+    }
+
+    // Writes every n-th frame as a numbered PPM into an existing directory
+    if (auto dir = GetArg("--capture"))
+    {
+        auto interval = static_cast<u32>(std::stoul(GetArg("--capture-interval").value_or("1")));
+
+        render.StartCapture(
+            [dir = *dir](const Image &image, u64 frame) {
+                ImageIO::WritePPM(dir + "/frame_" + std::to_string(frame) + ".ppm", image);
+            },
+            interval);
+    }
+
+    if (render.IsOffscreen())
+    {
+        RunOffscreen();
+        Quit();
+    }
 
     Run();
 }
@@ -49,9 +180,22 @@ void App::Run()
 
         // Travel();
 
+        auto frameStart = clk::now();
+
         input.Run();
+
+        // A replay ends with its last recorded frame
+        if (quitRequested)
+            break;
+
         logic.Run();
         render.Run();
+        input.OnPresent();
+
+        if (input.IsReplaying())
+            replayProfile.push_back({ElapsedMs(frameStart), render.GetStats().gpuFrameMs});
+
+        ReportFirstFrame();
 
         // dt = Stasis::GetDelta();
         // fxCount += dt;
@@ -71,6 +215,7 @@ void App::Run()
 
     // Audio::Exit();
 
+    ReportReplay();
     App::Exit();
 }
 
@@ -86,3 +231,156 @@ void App::Quit()
 {
     quitRequested = true;
 }
+
+// Time to first frame, counted from App::Init up to the first frame submitted
+void App::ReportFirstFrame()
+{
+    if (firstFrameSeen || render.GetFrameNumber() == 0)
+        return;
+
+    firstFrameSeen = true;
+
+    std::cout << "First frame submitted " << ElapsedMs(startTime) << " ms after startup" << std::endl;
+}
+
+int App::GetExitCode() const
+{
+    return exitCode;
+}
+
+u32 App::GetSeed() const
+{
+    return seed;
+}
+
+// Frame times of a replayed session, comparable between builds since every
+// build sees the same input on the same frames.
+//   --frame-profile path  one "frame,cpu ms,gpu ms" line per frame
+void App::ReportReplay()
+{
+    if (replayProfile.empty())
+        return;
+
+    list<double> cpuMs;
+    double gpuMs = 0.;
+
+    for (const auto &sample : replayProfile)
+    {
+        cpuMs.push_back(sample.cpuMs);
+        gpuMs += sample.gpuMs / static_cast<double>(replayProfile.size());
+    }
+
+    std::sort(cpuMs.begin(), cpuMs.end());
+
+    auto percentile = [&cpuMs](double p) { return cpuMs[static_cast<size_t>(p * (cpuMs.size() - 1))]; };
+
+    std::cout << std::endl
+              << "Replay [" << replayProfile.size() << " frames, seed " << seed << "] : " << percentile(0.5)
+              << " ms cpu median, " << percentile(0.99) << " ms cpu p99, " << gpuMs << " ms gpu mean" << std::endl;
+
+    if (auto path = GetArg("--frame-profile"))
+    {
+        std::ofstream file(*path);
+
+        if (!file)
+            throw std::runtime_error("\nFailed to write frame profile!");
+
+        file << "frame,cpu ms,gpu ms" << std::endl;
+
+        for (size_t i = 0; i < replayProfile.size(); i++)
+            file << i << "," << replayProfile[i].cpuMs << "," << replayProfile[i].gpuMs << std::endl;
+
+        std::cout << "    frame profile written to " << *path << std::endl;
+    }
+}
+
+// Renders a fixed number of frames without a window, then writes the result as
+// a golden image or checks it against one. Needs no display, so it also runs on
+// software implementations such as lavapipe.
+//   --frames n          frames rendered before the capture (3)
+//   --write-golden path store the capture
+//   --golden path       compare the capture, fails past the tolerance
+//   --tolerance n       per channel difference allowed (2)
+//   --max-gpu-ms ms     fails when the last frame took longer on the GPU
+void App::RunOffscreen()
+{
+    auto frameCount = std::max(1ul, std::stoul(GetArg("--frames").value_or("3")));
+    auto start = clk::now();
+
+    for (u32 i = 0; i < frameCount; i++)
+    {
+        logic.Run();
+        render.Run();
+
+        ReportFirstFrame();
+    }
+
+    auto cpuMs = ElapsedMs(start) / frameCount;
+    auto image = render.CaptureOffscreen();
+    const auto &stats = render.GetStats();
+
+    std::cout << std::endl
+              << "Offscreen [" << image.width << "x" << image.height << ", " << frameCount << " frames] : " << cpuMs
+              << " ms cpu, " << stats.gpuFrameMs << " ms gpu per frame" << std::endl;
+
+    if (auto path = GetArg("--write-golden"))
+    {
+        if (!ImageIO::WritePPM(*path, image))
+            throw std::runtime_error("\nFailed to write golden image!");
+
+        std::cout << "    golden written to " << *path << std::endl;
+    }
+
+    if (auto path = GetArg("--golden"))
+    {
+        Image golden;
+
+        if (!ImageIO::ReadPPM(*path, golden))
+            throw std::runtime_error("\nFailed to read golden image!");
+
+        auto tolerance = static_cast<u32>(std::stoul(GetArg("--tolerance").value_or("2")));
+        auto diff = CompareImages(image, golden, tolerance);
+        auto passed = diff.sizeMatches && diff.failedPixels == 0;
+
+        if (diff.sizeMatches)
+            std::cout << "    golden " << (passed ? "passed" : "FAILED") << ": " << diff.failedPixels
+                      << " pixels beyond " << tolerance << ", max delta " << diff.maxDelta << ", mean delta "
+                      << diff.meanDelta << std::endl;
+        else
+            std::cout << "    golden FAILED: size " << golden.width << "x" << golden.height << std::endl;
+
+        // Keep what was rendered next to the golden for inspection
+        if (!passed)
+        {
+            ImageIO::WritePPM(*path + ".actual.ppm", image);
+            exitCode = EXIT_FAILURE;
+        }
+    }
+
+    if (auto budget = GetArg("--max-gpu-ms"))
+    {
+        if (stats.gpuFrameMs > std::stod(*budget))
+        {
+            std::cout << "    gpu budget FAILED: " << stats.gpuFrameMs << " > " << *budget << " ms" << std::endl;
+            exitCode = EXIT_FAILURE;
+        }
+    }
+}
+
+bool App::HasArg(const str &name) const
+{
+    for (const auto &arg : args)
+        if (arg == name)
+            return true;
+
+    return false;
+}
+
+opt<str> App::GetArg(const str &name) const
+{
+    for (size_t i = 0; i + 1 < args.size(); i++)
+        if (args[i] == name)
+            return args[i + 1];
+
+    return std::nullopt;
+}
@@ -5,6 +5,12 @@
 #include "render.h"
 #include "threads.h"
 
+struct FrameSample
+{
+    double cpuMs = 0.; // whole loop iteration
+    double gpuMs = 0.; // last completed frame, a few frames behind
+};
+
 class App
 {
     // Static
@@ -18,13 +24,18 @@ class App
     // Instance
 
   public:
-    App();
+    App(int argc = 0, char **argv = nullptr);
 
     void Init();
     void Run();
     void Exit();
 
     void Quit();
+    int GetExitCode() const;
+    u32 GetSeed() const; // recorded with the input, fixed for replays
+
+    bool HasArg(const str &name) const;
+    opt<str> GetArg(const str &name) const;
 
     Input input;
     Logic logic;
@@ -33,4 +44,14 @@ class App
 
   private:
     bool quitRequested = false;
+    int exitCode = EXIT_SUCCESS;
+    list<str> args;
+    clk::time_point startTime;  // App::Init entered
+    bool firstFrameSeen = false;
+    u32 seed = 0;
+    list<FrameSample> replayProfile;
+
+    void RunOffscreen();
+    void ReportFirstFrame();
+    void ReportReplay();
 };
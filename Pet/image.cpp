@@ -0,0 +1,130 @@
+#include "image.h"
+
+Image::Image(u32 width, u32 height, u32 rgba) : width(width), height(height)
+{
+    pixels.resize(static_cast<size_t>(width) * height * 4);
+
+    for (size_t i = 0; i < pixels.size(); i += 4)
+    {
+        pixels[i + 0] = static_cast<u8>(rgba >> 24);
+        pixels[i + 1] = static_cast<u8>(rgba >> 16);
+        pixels[i + 2] = static_cast<u8>(rgba >> 8);
+        pixels[i + 3] = static_cast<u8>(rgba);
+    }
+}
+
+ImageDiff CompareImages(const Image &image, const Image &reference, u32 tolerance)
+{
+    ImageDiff diff;
+    diff.sizeMatches = image.width == reference.width && image.height == reference.height;
+
+    if (!diff.sizeMatches)
+        return diff;
+
+    u64 total = 0;
+
+    for (size_t i = 0; i < image.pixels.size(); i += 4)
+    {
+        u32 pixelDelta = 0;
+
+        for (size_t c = 0; c < 3; c++)
+        {
+            auto delta = static_cast<u32>(std::abs(image.pixels[i + c] - reference.pixels[i + c]));
+            pixelDelta = std::max(pixelDelta, delta);
+            total += delta;
+        }
+
+        diff.maxDelta = std::max(diff.maxDelta, pixelDelta);
+        diff.failedPixels += pixelDelta > tolerance;
+    }
+
+    auto channels = static_cast<double>(image.width) * image.height * 3;
+    diff.meanDelta = channels > 0 ? total / channels : 0.;
+
+    return diff;
+}
+
+namespace ImageIO
+{
+
+static void SkipPPMSeparators(std::ifstream &file)
+{
+    while (file.good())
+    {
+        auto c = file.peek();
+
+        if (c == '#')
+            while (file.good() && file.get() != '\n')
+                ;
+        else if (isspace(c))
+            file.get();
+        else
+            break;
+    }
+}
+
+// Binary (P6) 8 bit PPM, alpha is set to opaque
+bool ReadPPM(const str &path, Image &image)
+{
+    auto file = std::ifstream(path, std::ios::binary);
+
+    if (!file.is_open())
+        return false;
+
+    str magic;
+    u32 width = 0, height = 0, maxValue = 0;
+
+    file >> magic;
+    SkipPPMSeparators(file);
+    file >> width;
+    SkipPPMSeparators(file);
+    file >> height;
+    SkipPPMSeparators(file);
+    file >> maxValue;
+    file.get();
+
+    if (magic != "P6" || width == 0 || height == 0 || maxValue != 255)
+        return false;
+
+    auto rgb = list<u8>(static_cast<size_t>(width) * height * 3);
+    file.read(reinterpret_cast<char *>(rgb.data()), rgb.size());
+
+    if (!file)
+        return false;
+
+    image = Image(width, height);
+
+    for (size_t i = 0, j = 0; i < rgb.size(); i += 3, j += 4)
+    {
+        image.pixels[j + 0] = rgb[i + 0];
+        image.pixels[j + 1] = rgb[i + 1];
+        image.pixels[j + 2] = rgb[i + 2];
+    }
+
+    return true;
+}
+
+bool WritePPM(const str &path, const Image &image)
+{
+    auto file = std::ofstream(path, std::ios::out | std::ios::trunc | std::ios::binary);
+
+    if (!file.is_open())
+        return false;
+
+    file << "P6\n" << image.width << " " << image.height << "\n255\n";
+
+    auto rgb = list<u8>(static_cast<size_t>(image.width) * image.height * 3);
+
+    for (size_t i = 0, j = 0; i < rgb.size(); i += 3, j += 4)
+    {
+        rgb[i + 0] = image.pixels[j + 0];
+        rgb[i + 1] = image.pixels[j + 1];
+        rgb[i + 2] = image.pixels[j + 2];
+    }
+
+    file.write(reinterpret_cast<const char *>(rgb.data()), rgb.size());
+
+    return file.good();
+}
+
+} // namespace ImageIO
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "core.h"
+
+// Tightly packed RGBA8 pixels, top row first
+struct Image
+{
+    u32 width = 0;
+    u32 height = 0;
+    list<u8> pixels;
+
+    Image() = default;
+    Image(u32 width, u32 height, u32 rgba = 0xFFFFFFFF);
+};
+
+struct ImageDiff
+{
+    bool sizeMatches = false;
+    u32 maxDelta = 0;     // largest channel difference
+    u64 failedPixels = 0; // pixels with a channel beyond the tolerance
+    double meanDelta = 0.;
+};
+
+// Color channels only, PPM files carry no alpha
+ImageDiff CompareImages(const Image &image, const Image &reference, u32 tolerance);
+
+namespace ImageIO
+{
+
+bool ReadPPM(const str &path, Image &image);
+bool WritePPM(const str &path, const Image &image);
+
+} // namespace ImageIO
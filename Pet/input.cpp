@@ -6,23 +6,262 @@
 
 void Input::Init()
 {
+    start = clk::now();
+
+    auto *window = App::Instance().render.GetWindow();
+
+    // Replays ignore live input
+    if (!window || replaying)
+        return;
+
+    glfwSetKeyCallback(window, &Input::OnKey);
+    glfwSetMouseButtonCallback(window, &Input::OnMouseButton);
+    glfwSetCursorPosCallback(window, &Input::OnCursorMove);
+    glfwSetScrollCallback(window, &Input::OnScroll);
 }
 
+// Events arrive through the callbacks while polling. The window keeps being
+// polled during replays so it stays responsive.
 void Input::Run()
 {
     glfwPollEvents();
 
-    auto *window = App::Instance().render.GetWindow();
+    if (replaying)
+        ReplayFrame();
+    else if (recording.is_open())
+        RecordFrame();
+}
+
+void Input::Exit()
+{
+    if (recording.is_open())
+    {
+        std::cout << "Input recording [" << recordedFrames << " frames] : " << recording.tellp() << " bytes"
+                  << std::endl;
+        recording.close();
+    }
+}
+
+u64 Input::Now() const
+{
+    return replaying ? replayTime : Clock();
+}
+
+u64 Input::Clock() const
+{
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::microseconds>(clk::now() - start).count());
+}
+
+void Input::StartRecording(const str &path, u32 seed)
+{
+    recording.open(path, std::ios::binary | std::ios::trunc);
+
+    if (!recording)
+        throw std::runtime_error("\nFailed to open input recording \"" + path + "\"!");
+
+    InputRecordingHeader header;
+    header.seed = seed;
+    recording.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+u32 Input::StartReplay(const str &path)
+{
+    replay.open(path, std::ios::binary);
+
+    InputRecordingHeader header;
+    InputRecordingHeader expected;
+    replay.read(reinterpret_cast<char *>(&header), sizeof(header));
+
+    if (!replay || header.magic != expected.magic || header.version != expected.version ||
+        header.eventSize != expected.eventSize)
+        throw std::runtime_error("\nFailed to read input recording \"" + path + "\"!");
+
+    replaying = true;
+
+    return header.seed;
+}
+
+bool Input::IsReplaying() const
+{
+    return replaying;
+}
+
+// Everything the callbacks delivered is stamped at or before the frame time,
+// which is what the fixed steps and the particles then run against
+void Input::RecordFrame()
+{
+    auto time = Clock();
+    auto delta = static_cast<u32>(std::min<u64>(time - recordedTime, limits<u32>::max()));
+    auto count = static_cast<u32>(recordedEvents.size());
+
+    recording.write(reinterpret_cast<const char *>(&delta), sizeof(delta));
+    recording.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    recording.write(reinterpret_cast<const char *>(recordedEvents.data()), count * sizeof(InputEvent));
+
+    recordedEvents.clear();
+    recordedFrames++;
+    recordedTime = time;
+}
+
+// Ends the session once the recording runs out
+void Input::ReplayFrame()
+{
+    u32 delta = 0;
+    u32 count = 0;
+
+    replay.read(reinterpret_cast<char *>(&delta), sizeof(delta));
+    replay.read(reinterpret_cast<char *>(&count), sizeof(count));
+
+    list<InputEvent> events(count);
+    replay.read(reinterpret_cast<char *>(events.data()), count * sizeof(InputEvent));
+
+    if (!replay)
+    {
+        std::cout << "Input replay finished [" << replayFrames << " frames]" << std::endl;
+        App::Instance().Quit();
+        return;
+    }
+
+    replayTime += delta;
+    replayFrames++;
+
+    for (const auto &event : events)
+        Push(event);
+}
+
+bool Input::Pop(u64 until, InputEvent &event)
+{
+    auto *next = queue.Peek();
+
+    if (!next || next->time > until)
+        return false;
+
+    event = *next;
+    queue.Pop();
+
+    if (pendingCount == 0)
+        pendingOldest = event.time;
 
-    if (!window)
+    pendingCount++;
+    pendingTimeSum += event.time;
+
+    return true;
+}
+
+// The present call returning stands in for the frame reaching the screen,
+// the compositor and scanout come on top
+void Input::OnPresent()
+{
+    // Recorded timestamps have nothing to do with this run's presents
+    if (replaying)
         return;
 
-    if (GLFW_PRESS != glfwGetKey(window, GLFW_KEY_ESCAPE))
+    auto now = Now();
+
+    if (pendingCount > 0)
+    {
+        windowSumMs += static_cast<double>(pendingCount * now - pendingTimeSum) / 1000.;
+        windowMaxMs = std::max(windowMaxMs, static_cast<double>(now - pendingOldest) / 1000.);
+        windowCount += pendingCount;
+        stats.presented += pendingCount;
+
+        pendingCount = 0;
+        pendingTimeSum = 0;
+    }
+
+    if (now - windowStart < ReportIntervalUs)
         return;
 
-    App::Instance().Quit();
+    if (windowCount > 0)
+    {
+        stats.pollToPresentMs = windowSumMs / static_cast<double>(windowCount);
+        stats.maxPollToPresentMs = windowMaxMs;
+
+        if (latencyReport)
+            std::cout << "Input poll to present [" << windowCount << " events, " << stats.dropped << " dropped] : "
+                      << stats.pollToPresentMs << " ms mean, " << stats.maxPollToPresentMs << " ms max" << std::endl;
+    }
+
+    windowStart = now;
+    windowCount = 0;
+    windowSumMs = 0.;
+    windowMaxMs = 0.;
 }
 
-void Input::Exit()
+void Input::SetLatencyReport(bool enabled)
 {
+    latencyReport = enabled;
+}
+
+const InputStats &Input::GetStats() const
+{
+    return stats;
+}
+
+void Input::Push(const InputEvent &event)
+{
+    if (!queue.Push(event))
+    {
+        stats.dropped++;
+        return;
+    }
+
+    stats.events++;
+
+    if (recording.is_open())
+        recordedEvents.push_back(event);
+}
+
+void Input::OnKey(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+    auto &input = App::Instance().input;
+
+    InputEvent event;
+    event.time = input.Clock();
+    event.type = InputEventType::Key;
+    event.action = static_cast<u8>(action);
+    event.mods = static_cast<u16>(mods);
+    event.code = key;
+
+    input.Push(event);
+}
+
+void Input::OnMouseButton(GLFWwindow *window, int button, int action, int mods)
+{
+    auto &input = App::Instance().input;
+
+    InputEvent event;
+    event.time = input.Clock();
+    event.type = InputEventType::MouseButton;
+    event.action = static_cast<u8>(action);
+    event.mods = static_cast<u16>(mods);
+    event.code = button;
+
+    input.Push(event);
+}
+
+void Input::OnCursorMove(GLFWwindow *window, double x, double y)
+{
+    auto &input = App::Instance().input;
+
+    InputEvent event;
+    event.time = input.Clock();
+    event.type = InputEventType::CursorMove;
+    event.x = static_cast<float>(x);
+    event.y = static_cast<float>(y);
+
+    input.Push(event);
+}
+
+void Input::OnScroll(GLFWwindow *window, double x, double y)
+{
+    auto &input = App::Instance().input;
+
+    InputEvent event;
+    event.time = input.Clock();
+    event.type = InputEventType::Scroll;
+    event.x = static_cast<float>(x);
+    event.y = static_cast<float>(y);
+
+    input.Push(event);
 }
@@ -1,9 +1,115 @@
 #pragma once
 
+#include "core.h"
+#include "spscqueue.h"
+
+enum class InputEventType : u8
+{
+    Key,
+    MouseButton,
+    CursorMove,
+    Scroll,
+};
+
+// One GLFW callback, stamped when glfwPollEvents delivered it rather than when
+// the OS saw it, so the events of one frame carry nearly the same time
+struct InputEvent
+{
+    u64 time = 0; // microseconds since Input::Init
+    InputEventType type = InputEventType::Key;
+    u8 action = 0; // GLFW_RELEASE, GLFW_PRESS or GLFW_REPEAT
+    u16 mods = 0;
+    i32 code = 0;  // key or mouse button
+    float x = 0.f; // cursor position or scroll offset
+    float y = 0.f;
+};
+
+// Start of an input recording. Frames follow, each a u32 microsecond delta
+// from the previous frame time and a u32 event count, then the events as
+// stored in memory. One entry per frame, so a replay runs exactly the
+// recorded frames. Only replayed by the build that wrote it.
+struct InputRecordingHeader
+{
+    arr<char, 4> magic = {'P', 'I', 'N', 'R'};
+    u32 version = 2;
+    u32 seed = 0; // App::GetSeed of the recorded session
+    u32 eventSize = sizeof(InputEvent);
+};
+
+struct InputStats
+{
+    u64 events = 0;           // queued so far
+    u64 dropped = 0;          // lost to a full queue
+    u64 presented = 0;        // consumed and presented so far
+    double pollToPresentMs = 0.;    // mean poll to present time of the last report window
+    double maxPollToPresentMs = 0.; // worst of the last report window
+};
+
+// GLFW callbacks produce timestamped events into a lock-free queue, Logic
+// consumes them per fixed step by timestamp. Callbacks only fire inside
+// glfwPollEvents on the main thread, so the time an event waited before the
+// poll is not measured. The queue leaves the consumer free to run anywhere.
 class Input
 {
   public:
     void Init();
     void Run();
     void Exit();
+
+    // Microseconds since Init, the clock of the timestamps. Replays return the
+    // recorded time of the current frame instead.
+    u64 Now() const;
+
+    // Before Init. Writes every frame's time and events next to the seed.
+    void StartRecording(const str &path, u32 seed);
+
+    // Before Init. Frames come from the file in place of GLFW, the session
+    // ends with it. Returns the recorded seed.
+    u32 StartReplay(const str &path);
+    bool IsReplaying() const;
+
+    // Consumer side, the next event stamped at or before until
+    bool Pop(u64 until, InputEvent &event);
+
+    // Closes the poll to present time of the events consumed since the last present
+    void OnPresent();
+    void SetLatencyReport(bool enabled); // prints the poll to present time once per second
+    const InputStats &GetStats() const;
+
+  private:
+    static constexpr u32 QueueSize = 4096;
+    static constexpr u64 ReportIntervalUs = 1000000;
+
+    SpscQueue<InputEvent, QueueSize> queue;
+    clk::time_point start = clk::now();
+    InputStats stats;
+    bool latencyReport = false;
+
+    u64 pendingCount = 0; // consumed, waiting for the present
+    u64 pendingTimeSum = 0;
+    u64 pendingOldest = 0;
+    u64 windowStart = 0;
+    u64 windowCount = 0;
+    double windowSumMs = 0.;
+    double windowMaxMs = 0.;
+
+    std::ofstream recording;
+    list<InputEvent> recordedEvents; // delivered since the last recorded frame
+    u64 recordedTime = 0;
+    u64 recordedFrames = 0;
+
+    std::ifstream replay;
+    bool replaying = false;
+    u64 replayTime = 0; // recorded time of the current frame
+    u64 replayFrames = 0;
+
+    u64 Clock() const;
+    void Push(const InputEvent &event);
+    void RecordFrame();
+    void ReplayFrame();
+
+    static void OnKey(GLFWwindow *window, int key, int scancode, int action, int mods);
+    static void OnMouseButton(GLFWwindow *window, int button, int action, int mods);
+    static void OnCursorMove(GLFWwindow *window, double x, double y);
+    static void OnScroll(GLFWwindow *window, double x, double y);
 };
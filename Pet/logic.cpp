@@ -1,13 +1,58 @@
 #include "logic.h"
 
+#include "engine.h"
+#include "input.h"
+
+static u64 simulatedUs = 0; // end of the last fixed step, on the input clock
+static arr<bool, GLFW_KEY_LAST + 1> keysDown{};
+
 void Logic::Init()
 {
 }
 
+// Catches up in fixed steps to the input clock, each step sees exactly the
+// events stamped before its end. Events are stamped when the frame polls, so
+// a press and release between two frames arrive in the same step.
 void Logic::Run()
 {
+    auto now = App::Instance().input.Now();
+
+    if (now > simulatedUs + FixedStepUs * MaxSteps)
+        simulatedUs = now - FixedStepUs * MaxSteps;
+
+    while (simulatedUs + FixedStepUs <= now)
+    {
+        simulatedUs += FixedStepUs;
+        Step(simulatedUs);
+    }
 }
 
 void Logic::Exit()
 {
 }
+
+bool Logic::IsKeyDown(int key)
+{
+    return key >= 0 && key <= GLFW_KEY_LAST && keysDown[key];
+}
+
+void Logic::Step(u64 end)
+{
+    auto &input = App::Instance().input;
+
+    InputEvent event;
+
+    while (input.Pop(end, event))
+        Handle(event);
+}
+
+void Logic::Handle(const InputEvent &event)
+{
+    if (event.type != InputEventType::Key || event.code < 0 || event.code > GLFW_KEY_LAST)
+        return;
+
+    keysDown[event.code] = event.action != GLFW_RELEASE;
+
+    if (event.code == GLFW_KEY_ESCAPE && event.action == GLFW_PRESS)
+        App::Instance().Quit();
+}
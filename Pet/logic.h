@@ -1,9 +1,22 @@
 #pragma once
 
+#include "core.h"
+
+struct InputEvent;
+
 class Logic
 {
   public:
+    static constexpr u64 FixedStepUs = 1000000 / 120;
+    static constexpr u32 MaxSteps = 8; // per Run, time past it is dropped after a stall
+
     static void Init();
     static void Run();
     static void Exit();
+
+    static bool IsKeyDown(int key);
+
+  private:
+    static void Step(u64 end);
+    static void Handle(const InputEvent &event);
 };
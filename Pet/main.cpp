@@ -3,9 +3,9 @@
 #include <exception>
 #include <iostream>
 
-int main()
+int main(int argc, char **argv)
 {
-    auto engine = App();
+    auto engine = App(argc, argv);
 
     try
     {
@@ -17,5 +17,5 @@ int main()
         return EXIT_FAILURE;
     }
 
-    return EXIT_SUCCESS;
+    return engine.GetExitCode();
 }
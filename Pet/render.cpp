@@ -1,105 +1,397 @@
 #include "render.h"
 
 #include "engine.h"
+#include "simplify.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <filesystem>
 
 bool QueueFamilyIndices::IsComplete() const
 {
     return graphicsFamily.has_value() && presentFamily.has_value();
 }
 
-void Render::Init()
+void UniformRing::Begin(u32 frame)
 {
-    window = InitializeGLFW();
+    base = frame * regionSize;
+    head = 0;
+}
 
-    PopulateVkAppInfo(vkAppInfo);
+VkDeviceSize UniformRing::Allocate(VkDeviceSize size, VkDeviceSize align)
+{
+    auto cur = head.load();
+    VkDeviceSize offset;
 
-    // Validate extensions
+    do
+        offset = (cur + align - 1) / align * align;
+    while (!head.compare_exchange_weak(cur, offset + size));
 
-    auto requiredExtensions = GetRequiredExtensions();
-    auto availableExtensions = GetAvailableExtensions();
+    if (offset + size > regionSize)
+        throw std::runtime_error("\nUniform ring region exhausted!");
 
-    if (!ValidateExtensions(requiredExtensions, availableExtensions))
-        throw std::runtime_error("\nExtension validation failed!");
+    return offset;
+}
 
-    std::cout << std::endl;
+template <typename Layout> static VertexInput MakeVertexInput()
+{
+    VertexInput input;
+    input.binding = Layout::binding;
+    input.attributes.assign(Layout::attributes.begin(), Layout::attributes.end());
+    input.pack = [](const Vertex &vertex, u8 *out) {
+        return Layout::Pack({glm::vec4(vertex.pos, 0.f, 1.f), glm::vec4(vertex.color, 1.f), glm::vec4(vertex.uv, 0.f, 0.f)},
+                            out);
+    };
+
+    return input;
+}
 
-    // Validate layers
+VertexInput VertexInput::Of(VertexPacking packing)
+{
+    if (packing == VertexPacking::Half)
+        return MakeVertexInput<VertexLayouts::Half>();
+    if (packing == VertexPacking::Snorm)
+        return MakeVertexInput<VertexLayouts::Snorm>();
 
-    auto &requiredLayers = vkValidationLayers;
-    auto availableLayers = GetAvailableLayers();
+    return MakeVertexInput<VertexLayouts::Float>();
+}
 
-    if (!ValidateLayers(requiredLayers, availableLayers))
-        throw std::runtime_error("\nLayer validation failed!");
+Vertex *SpriteRing::Vertices(u32 sprite) const
+{
+    return reinterpret_cast<Vertex *>(mapped + region * VertexRegionSize) + sprite * 4;
+}
 
-    std::cout << std::endl;
+u32 *SpriteRing::Indices(u32 frame) const
+{
+    return reinterpret_cast<u32 *>(mapped + indexBase + frame * IndexRegionSize);
+}
 
-    //
+VkDeviceSize SpriteRing::CommandOffset(u32 frame) const
+{
+    return commandBase + frame * CommandRegionSize;
+}
 
-    PopulateVkMessengerInfo(vkMessengerInfo);
+VkDeviceSize SpriteRing::CountOffset(u32 frame) const
+{
+    return CommandOffset(frame) + MaxRuns * sizeof(VkDrawIndexedIndirectCommand);
+}
 
-    // Vulkan initialization
+// Shaders and the mesh LOD chain load while the instance and device come up,
+// pipelines build while the buffers upload. Whatever records into vkCmdPool
+// stays on one chain, the pool and the graphics queue are not thread safe, and
+// GLFW window and swapchain calls stay on the main thread.
+u32 Render::Init(TaskGraph &startup)
+{
+    if (!offscreen && glfwInit() == 0)
+        throw std::runtime_error("\nGLFW Panicked!");
 
-    PopulateVkInstanceInfo(vkInstanceInfo, requiredExtensions);
-    GetVkInstance(vkInstance);
+    PopulateVkAppInfo(vkAppInfo);
 
-    AttachDebugMessenger();
-    GetSurface(vkSurface);
+    auto windowTask = startup.Add(
+        "Window", [this]() { window = offscreen ? nullptr : InitializeGLFW(); }, {}, true);
 
-    GetMostSuitableDevice(vkPhyDevice);
-    GetAvailableQueuesFamilies(vkPhyDeviceIndices, vkPhyDevice);
-    GetLogicalDevice(vkLogDevice);
-    GetGraphicsQueue(vkGraphicsQueue);
-    GetSwapChain(&vkCurSwapChain, nullptr);
-    GetImageViews(vkImageViews);
-    GetRenderPass(vkRenderPass);
-    GetPipeline(vkPipe, vkPipeLayout);
-    GetFramesBuffer(vkFramesBuffer);
-    GetCommandPool(vkCmdPool);
-    GetVertexBuffer(vkVertexBuffer, vkVertexMemory);
-    PopulateFrames(frames);
+    // Entries are created up front so the loads only ever write their own
+
+    const arr<std::pair<str, shaderc_shader_kind>, 3> shaders = {{{"shaders/shader.vert", shaderc_glsl_vertex_shader},
+                                                                   {"shaders/shader.frag", shaderc_glsl_fragment_shader},
+                                                                   {"shaders/cull.comp", shaderc_glsl_compute_shader}}};
+    list<u32> shaderTasks;
+
+    for (const auto &[path, kind] : shaders)
+    {
+        shaderCode[path];
+        shaderTasks.push_back(startup.Add("Shader " + path, [this, path = path, kind = kind]() {
+            shaderCode.find(path)->second = GenerateShader(path, kind);
+        }));
+    }
+
+    // The table and buffers pick the mesh up once the device exists
+    auto meshTask = startup.Add("Mesh LODs", [this]() { AddMesh(vertices, indices); });
+
+    auto instanceTask = startup.Add("Instance", [this]() {
+        // Validate extensions
+
+        auto requiredExtensions = GetRequiredExtensions();
+        auto availableExtensions = GetAvailableExtensions();
+
+        if (!ValidateExtensions(requiredExtensions, availableExtensions))
+            throw std::runtime_error("\nExtension validation failed!");
+
+        std::cout << std::endl;
+
+        // Validate layers
+
+        auto &requiredLayers = vkValidationLayers;
+        auto availableLayers = GetAvailableLayers();
+
+        if (!ValidateLayers(requiredLayers, availableLayers))
+            throw std::runtime_error("\nLayer validation failed!");
+
+        std::cout << std::endl;
+
+        //
+
+        PopulateVkMessengerInfo(vkMessengerInfo);
+
+        // Vulkan initialization
+
+        PopulateVkInstanceInfo(vkInstanceInfo, requiredExtensions);
+        GetVkInstance(vkInstance);
+
+        AttachDebugMessenger();
+    });
+
+    auto deviceTask = startup.Add(
+        "Device",
+        [this]() {
+            if (!offscreen)
+                GetSurface(vkSurface);
+
+            GetMostSuitableDevice(vkPhyDevice);
+            GetAvailableQueuesFamilies(vkPhyDeviceIndices, vkPhyDevice);
+            GetLogicalDevice(vkLogDevice);
+            GetGraphicsQueue(vkGraphicsQueue);
+            GetFamilyQueue(vkPhyDeviceIndices.transferFamily, vkPhyDeviceIndices.transferQueue, vkTransferQueue);
+            GetFamilyQueue(vkPhyDeviceIndices.computeFamily, 0, vkComputeQueue);
+        },
+        {instanceTask, windowTask});
+
+    auto swapChainTask = startup.Add(
+        "Swap chain",
+        [this]() {
+            if (offscreen)
+                GetOffscreenTarget(offscreenTarget);
+            else
+                GetSwapChain(&vkCurSwapChain, nullptr);
+
+            GetImageViews(vkImageViews);
+            depth.format = FindDepthFormat();
+            GetRenderPass(vkRenderPass, VK_ATTACHMENT_LOAD_OP_CLEAR);
+            GetRenderPass(vkRenderPassAfterPrepass, VK_ATTACHMENT_LOAD_OP_LOAD);
+            GetPrepassRenderPass(vkPrepassRenderPass);
+        },
+        {deviceTask}, true);
+
+    auto layoutTask = startup.Add(
+        "Descriptor layouts",
+        [this]() {
+            GetDescriptorSetLayout(vkDescriptorLayout);
+            GetBindlessSetLayout(vkBindlessLayout);
+        },
+        {deviceTask});
+
+    // Graphics and compute pipelines are all created through the cache
+    auto cacheTask = startup.Add("Pipeline cache", [this]() { GetPipelineCache(pipelineCache); }, {deviceTask});
+
+    auto pipelineTask = startup.Add(
+        "Pipelines",
+        [this]() {
+            GetPipelineLayout(vkPipeLayout);
+            GetPipeline(vkPipe, vkPipeEqual, vkPrepassPipe, vkSpritePipe);
+        },
+        {swapChainTask, layoutTask, cacheTask, shaderTasks[0], shaderTasks[1]});
+
+    auto cullingTask = startup.Add("Culling pipeline", [this]() { GetCullingPipeline(culling); },
+                                   {deviceTask, cacheTask, shaderTasks[2]});
+
+    auto bufferTask = startup.Add(
+        "Buffers and targets",
+        [this]() {
+            GetCommandPool(vkCmdPool);
+            GetFamilyPool(vkPhyDeviceIndices.transferFamily, vkTransferPool);
+            GetFamilyPool(vkPhyDeviceIndices.computeFamily, vkComputePool);
+            GetTimeline(uploadTimeline.semaphore);
+            GetTimeline(computeTimeline.semaphore);
+            GetTimeline(readbackTimeline.semaphore);
+            GetDepthTarget(depth);
+            GetSceneTarget(scene);
+            GetMeshBuffer(vkMeshBuffer, vkMeshMemory);
+            GetVertexBuffer(vkVertexBuffer, vkVertexMemory);
+            GetIndexBuffer(vkIndexBuffer, vkIndexMemory);
+            GetInstanceBuffer(vkInstanceBuffer, vkInstanceMemory);
+            GetUniformRing(uniforms);
+            GetSpriteRing(sprites);
+        },
+        {swapChainTask, meshTask});
+
+    // Frames may fan out recording on the pool, so the rest waits on the main thread
+    return startup.Add(
+        "Descriptors and frames",
+        [this]() {
+            GetDescriptorSet(vkDescriptorPool, vkDescriptorSet);
+            GetTextureSampler(vkSampler);
+            GetMaterialBuffer(vkMaterialBuffer, vkMaterialMemory);
+            GetBindlessSet(vkBindlessPool, vkBindlessSet);
+            GetCullingBuffers(culling);
+            GetCullingSets(culling);
+            GetAsyncCulling(culling);
+            GetGpuProfiler(profiler);
+            PopulateFrames(frames);
+            GetWorkerPools(frames);
+
+            // Slot 0 of both tables is the untextured white fallback
+            CreateMaterial(glm::vec4(1.f), LoadTexture(Image(1, 1)));
+
+            PopulateDrawList(drawList);
+        },
+        {layoutTask, pipelineTask, cullingTask, bufferTask}, true);
 }
 
 void Render::Run()
 {
-    vkWaitForFences(vkLogDevice, 1, &frames.fences[frames.current], VK_TRUE, UINT64_MAX);
+    // Nothing to render into while minimized, block briefly instead of spinning
+    // but let the rest of the frame keep running
+
+    if (!offscreen && (windowSize.x == 0 || windowSize.y == 0))
+    {
+        sprites.head = 0;
+        glfwWaitEventsTimeout(0.05);
+        return;
+    }
+
+    // The frame that last used this slot must be done before it is reused
+
+    auto waitStart = clk::now();
 
-    u32 idx;
-    auto result = vkAcquireNextImageKHR(vkLogDevice, vkCurSwapChain, UINT64_MAX, frames.imgSemaphores[frames.current],
-                                        VK_NULL_HANDLE, &idx);
+    if (frameNumber >= frames.size)
+        WaitForFrame(frameNumber + 1 - frames.size);
 
-    if (result == VK_ERROR_OUT_OF_DATE_KHR)
+    GetCompletedFrame();
+
+    stats.frameWaitMs = ElapsedMs(waitStart);
+
+    DestroyRetired();
+    ReadGpuTimings(frames.current);
+    UpdateRenderScale();
+    CollectCaptures();
+    CollectPipelines();
+
+    if (swapChainStale)
     {
         RecreateSwapChain();
-        return;
+
+        if (swapChainStale)
+            return;
     }
 
-    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
-        throw std::runtime_error("\nFailed to acquire swap chain image!");
+    // The offscreen target is a single image that never has to be acquired
 
-    vkResetFences(vkLogDevice, 1, &frames.fences[frames.current]);
+    u32 idx = 0;
 
-    vkResetCommandBuffer(frames.cmdBuffers[frames.current], 0);
-    RecordCommandBuffer(frames.cmdBuffers[frames.current], idx);
+    if (!offscreen)
+    {
+        auto result = vkAcquireNextImageKHR(vkLogDevice, vkCurSwapChain, UINT64_MAX,
+                                            frames.imgSemaphores[frames.current], VK_NULL_HANDLE, &idx);
 
-    VkSubmitInfo submitInfo;
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        if (result == VK_ERROR_OUT_OF_DATE_KHR)
+        {
+            RecreateSwapChain();
+            return;
+        }
 
-    VkSemaphore waitSemaphores[] = {frames.imgSemaphores[frames.current]};
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
+            throw std::runtime_error("\nFailed to acquire swap chain image!");
+    }
 
-    VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
-    submitInfo.pWaitSemaphores = waitSemaphores;
-    submitInfo.pWaitDstStageMask = waitStages;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &frames.cmdBuffers[frames.current];
+    // Only once the frame is certain to be submitted, sprites of a frame that
+    // returned early stay in the ring for the next one
+    FlushSprites(frames.current);
+    CullDrawList();
+    UpdateUniforms(frames.current);
 
-    VkSemaphore signalSemaphores[] = {frames.rndSemaphores[frames.current]};
-    submitInfo.signalSemaphoreCount = 1;
-    submitInfo.pSignalSemaphores = signalSemaphores;
+    auto &cmdBuffer = frames.cmdBuffers[frames.current][idx];
+    auto &cmdVersion = frames.cmdVersions[frames.current][idx];
+
+    stats.reusedCommands = cmdVersion == stateVersion;
+
+    if (!stats.reusedCommands)
+    {
+        vkResetCommandBuffer(cmdBuffer, 0);
+        RecordCommandBuffer(cmdBuffer, idx);
+        cmdVersion = stateVersion;
+    }
+    else
+    {
+        stats.cpuRecordMs = 0.;
+    }
+
+    // The frame waits for the acquired image, for uploads handed over by the
+    // transfer queue and for culling on the compute queue
+
+    list<VkSemaphore> waitSemaphores;
+    list<VkPipelineStageFlags> waitStages;
+    list<u64> waitValues;
+    list<VkCommandBuffer> submitBuffers;
+
+    if (!offscreen)
+    {
+        waitSemaphores.push_back(frames.imgSemaphores[frames.current]);
+        waitStages.push_back(VK_PIPELINE_STAGE_TRANSFER_BIT);
+        waitValues.push_back(0);
+    }
+
+    if (auto acquires = RecordUploadAcquires())
+    {
+        waitSemaphores.push_back(uploadTimeline.semaphore);
+        waitStages.push_back(VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+        waitValues.push_back(uploadTimeline.value);
+        submitBuffers.push_back(acquires);
+    }
+
+    if (SubmitAsyncCulling(frames.current))
+    {
+        waitSemaphores.push_back(computeTimeline.semaphore);
+        waitStages.push_back(VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+        waitValues.push_back(computeTimeline.value);
+    }
+
+    submitBuffers.push_back(cmdBuffer);
+
+    // A capture copy rides along with the frame and completes with it
 
-    if (vkQueueSubmit(vkGraphicsQueue, 1, &submitInfo, frames.fences[frames.current]) != VK_SUCCESS)
+    if (auto copy = RecordCapture(idx))
+        submitBuffers.push_back(copy);
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = static_cast<u32>(waitSemaphores.size());
+    submitInfo.pWaitSemaphores = waitSemaphores.data();
+    submitInfo.pWaitDstStageMask = waitStages.data();
+    submitInfo.commandBufferCount = static_cast<u32>(submitBuffers.size());
+    submitInfo.pCommandBuffers = submitBuffers.data();
+
+    // Presenting still needs a binary semaphore, the timeline value is ignored for it
+
+    VkSemaphore signalSemaphores[] = {frames.rndSemaphores[frames.current], frames.timeline};
+    u64 signalValues[] = {0, frameNumber + 1};
+    u32 firstSignal = offscreen ? 1 : 0;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.waitSemaphoreValueCount = static_cast<u32>(waitValues.size());
+    timelineInfo.pWaitSemaphoreValues = waitValues.data();
+    timelineInfo.signalSemaphoreValueCount = 2 - firstSignal;
+    timelineInfo.pSignalSemaphoreValues = signalValues + firstSignal;
+
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.signalSemaphoreCount = 2 - firstSignal;
+    submitInfo.pSignalSemaphores = signalSemaphores + firstSignal;
+
+    if (vkQueueSubmit(vkGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
         throw std::runtime_error("\nFailed to submit draw command buffer!");
 
+    profiler.submitted[frames.current] = true;
+    frameNumber++;
+
+    // The region just flushed is in flight now, the next frame fills another
+    sprites.region = (sprites.region + 1) % sprites.vertexRegions;
+
+    if (offscreen)
+    {
+        frames.current = (frames.current + 1) % frames.size;
+        return;
+    }
+
     VkPresentInfoKHR presentInfo;
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
     presentInfo.waitSemaphoreCount = 1;
@@ -111,7 +403,7 @@ void Render::Run()
     presentInfo.pImageIndices = &idx;
     presentInfo.pResults = nullptr; // Optional
 
-    result = vkQueuePresentKHR(vkGraphicsQueue, &presentInfo);
+    auto result = vkQueuePresentKHR(vkGraphicsQueue, &presentInfo);
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || frameBufferResized)
     {
@@ -140,31 +432,117 @@ void Render::VkCleanup()
 
     vkDeviceWaitIdle(vkLogDevice);
 
+    // Idle covers everything, including what was retired after the next frame
+    completedFrames = limits<u64>::max();
+    DestroyRetired();
+    StopCapture();
+
     for (const auto &imageView : vkImageViews)
         vkDestroyImageView(vkLogDevice, imageView, nullptr);
-    for (const auto &frameBuffer : vkFramesBuffer)
-        vkDestroyFramebuffer(vkLogDevice, frameBuffer, nullptr);
     vkDestroySwapchainKHR(vkLogDevice, vkCurSwapChain, nullptr);
+    ReleaseSceneTarget(scene);
+    ReleaseDepthTarget(depth);
+
+    vkDestroyImage(vkLogDevice, offscreenTarget.image, nullptr);
+    vkFreeMemory(vkLogDevice, offscreenTarget.memory, nullptr);
+    vkDestroyBuffer(vkLogDevice, offscreenTarget.readback, nullptr);
+    vkFreeMemory(vkLogDevice, offscreenTarget.readbackMemory, nullptr);
 
     vkDestroyBuffer(vkLogDevice, vkVertexBuffer, nullptr);
     vkFreeMemory(vkLogDevice, vkVertexMemory, nullptr);
+    vkDestroyBuffer(vkLogDevice, vkIndexBuffer, nullptr);
+    vkFreeMemory(vkLogDevice, vkIndexMemory, nullptr);
+    vkDestroyBuffer(vkLogDevice, vkMeshBuffer, nullptr);
+    vkUnmapMemory(vkLogDevice, vkMeshMemory);
+    vkFreeMemory(vkLogDevice, vkMeshMemory, nullptr);
+    vkUnmapMemory(vkLogDevice, vkInstanceMemory);
+    vkDestroyBuffer(vkLogDevice, vkInstanceBuffer, nullptr);
+    vkFreeMemory(vkLogDevice, vkInstanceMemory, nullptr);
+
+    for (size_t i = 0; i < culling.commandBuffers.size(); i++)
+    {
+        vkDestroyBuffer(vkLogDevice, culling.commandBuffers[i], nullptr);
+        vkFreeMemory(vkLogDevice, culling.commandMemories[i], nullptr);
+        vkDestroyBuffer(vkLogDevice, culling.countBuffers[i], nullptr);
+        vkFreeMemory(vkLogDevice, culling.countMemories[i], nullptr);
+    }
+
+    vkDestroyBuffer(vkLogDevice, culling.lodBuffer, nullptr);
+    vkFreeMemory(vkLogDevice, culling.lodMemory, nullptr);
+    vkDestroyDescriptorPool(vkLogDevice, culling.pool, nullptr);
+    vkDestroyPipeline(vkLogDevice, culling.pipe, nullptr);
+    vkDestroyPipelineLayout(vkLogDevice, culling.pipeLayout, nullptr);
+    vkDestroyDescriptorSetLayout(vkLogDevice, culling.layout, nullptr);
+
+    if (particles.capacity > 0)
+        ReleaseParticleBuffers(particles);
+
+    for (const auto &pipe : particles.stages)
+        vkDestroyPipeline(vkLogDevice, pipe, nullptr);
+    vkDestroyPipelineLayout(vkLogDevice, particles.pipeLayout, nullptr);
+    vkDestroyDescriptorSetLayout(vkLogDevice, particles.layout, nullptr);
+
+    for (const auto &pool : profiler.pools)
+        vkDestroyQueryPool(vkLogDevice, pool, nullptr);
+    for (const auto &pool : profiler.statisticsPools)
+        vkDestroyQueryPool(vkLogDevice, pool, nullptr);
+
+
+    vkUnmapMemory(vkLogDevice, uniforms.memory);
+    vkDestroyBuffer(vkLogDevice, uniforms.buffer, nullptr);
+    vkFreeMemory(vkLogDevice, uniforms.memory, nullptr);
+    vkUnmapMemory(vkLogDevice, sprites.memory);
+    vkDestroyBuffer(vkLogDevice, sprites.buffer, nullptr);
+    vkFreeMemory(vkLogDevice, sprites.memory, nullptr);
+    vkDestroyDescriptorPool(vkLogDevice, vkDescriptorPool, nullptr);
+
+    for (const auto &texture : textures)
+    {
+        vkDestroyImageView(vkLogDevice, texture.view, nullptr);
+        vkDestroyImage(vkLogDevice, texture.image, nullptr);
+        vkFreeMemory(vkLogDevice, texture.memory, nullptr);
+    }
+
+    vkUnmapMemory(vkLogDevice, vkMaterialMemory);
+    vkDestroyBuffer(vkLogDevice, vkMaterialBuffer, nullptr);
+    vkFreeMemory(vkLogDevice, vkMaterialMemory, nullptr);
+    vkDestroySampler(vkLogDevice, vkSampler, nullptr);
+    vkDestroyDescriptorPool(vkLogDevice, vkBindlessPool, nullptr);
 
     for (size_t i = 0; i < frames.size; i++)
     {
         vkDestroySemaphore(vkLogDevice, frames.rndSemaphores[i], nullptr);
         vkDestroySemaphore(vkLogDevice, frames.imgSemaphores[i], nullptr);
-        vkDestroyFence(vkLogDevice, frames.fences[i], nullptr);
+
+        for (const auto &pool : frames.workerPools[i])
+            vkDestroyCommandPool(vkLogDevice, pool, nullptr);
     }
 
+    vkDestroySemaphore(vkLogDevice, frames.timeline, nullptr);
+
     vkDestroyCommandPool(vkLogDevice, vkCmdPool, nullptr);
-    vkDestroyPipeline(vkLogDevice, vkPipe, nullptr);
+    vkDestroyCommandPool(vkLogDevice, vkTransferPool, nullptr);
+    vkDestroyCommandPool(vkLogDevice, vkComputePool, nullptr);
+    vkDestroySemaphore(vkLogDevice, uploadTimeline.semaphore, nullptr);
+    vkDestroySemaphore(vkLogDevice, computeTimeline.semaphore, nullptr);
+    vkDestroySemaphore(vkLogDevice, readbackTimeline.semaphore, nullptr);
+    ReleasePipelineCache(pipelineCache);
+
+    for (const auto &[code, module] : shaderModules)
+        vkDestroyShaderModule(vkLogDevice, module, nullptr);
     vkDestroyPipelineLayout(vkLogDevice, vkPipeLayout, nullptr);
+    vkDestroyDescriptorSetLayout(vkLogDevice, vkDescriptorLayout, nullptr);
+    vkDestroyDescriptorSetLayout(vkLogDevice, vkBindlessLayout, nullptr);
     vkDestroyRenderPass(vkLogDevice, vkRenderPass, nullptr);
+    vkDestroyRenderPass(vkLogDevice, vkRenderPassAfterPrepass, nullptr);
+    vkDestroyRenderPass(vkLogDevice, vkPrepassRenderPass, nullptr);
     vkDestroyDevice(vkLogDevice, nullptr);
     vkDestroySurfaceKHR(vkInstance, vkSurface, nullptr);
     vkDestroyInstance(vkInstance, nullptr);
 
-    glfwDestroyWindow(window);
+    if (window)
+        glfwDestroyWindow(window);
+
     glfwTerminate();
 }
 
@@ -172,11 +550,9 @@ void Render::VkCleanupSwapChain()
 {
 }
 
+// glfwInit already ran in Init
 GLFWwindow *Render::InitializeGLFW()
 {
-    if (glfwInit() == 0)
-        throw std::runtime_error("\nGLFW Panicked!");
-
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
     // glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
 
@@ -199,7 +575,7 @@ void Render::PopulateVkAppInfo(VkApplicationInfo &info)
     info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     info.pEngineName = "PetEngine";
     info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    info.apiVersion = VK_API_VERSION_1_0;
+    info.apiVersion = VK_API_VERSION_1_2; // descriptor indexing and indirect count are core
 }
 
 void Render::PopulateVkInstanceInfo(VkInstanceCreateInfo &info, const list<const char *> &requiredExtensions)
@@ -263,10 +639,14 @@ void Render::AttachDebugMessenger()
 
 list<const char *> Render::GetRequiredExtensions()
 {
-    u32 count;
+    auto extensions = list<const char *>();
 
-    auto **raw = glfwGetRequiredInstanceExtensions(&count);
-    auto extensions = list<const char *>(raw, raw + count);
+    if (!offscreen)
+    {
+        u32 count;
+        auto **raw = glfwGetRequiredInstanceExtensions(&count);
+        extensions.assign(raw, raw + count);
+    }
 
     if (IsDebug)
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -378,24 +758,31 @@ void Render::GetMostSuitableDevice(VkPhysicalDevice &device)
         throw std::runtime_error("\nFailed to find GPUs with Vulkan support!");
 
     odic<u32, VkPhysicalDevice> candidates;
+    str rejections;
 
     for (const auto &dev : devices)
-        candidates.insert({RateDevice(dev), dev});
+    {
+        str rejection;
+        candidates.insert({RateDevice(dev, rejection), dev});
+
+        if (!rejection.empty())
+            rejections += "\n    " + rejection;
+    }
 
     if (candidates.rbegin()->first > 0)
         device = candidates.rbegin()->second;
     else
-        throw std::runtime_error("\nFailed to find a suitable GPU!");
+        throw std::runtime_error("\nFailed to find a suitable GPU!" + rejections);
 }
 
-u32 Render::RateDevice(const VkPhysicalDevice &device)
+// Zero for a device that cannot run the renderer, rejection then names it and
+// the first requirement it misses. Software devices such as lavapipe qualify.
+u32 Render::RateDevice(const VkPhysicalDevice &device, str &rejection)
 {
     u32 score = 0;
 
     VkPhysicalDeviceProperties deviceProperties;
     vkGetPhysicalDeviceProperties(device, &deviceProperties);
-    VkPhysicalDeviceFeatures deviceFeatures;
-    vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
 
     // Rating
 
@@ -404,13 +791,25 @@ u32 Render::RateDevice(const VkPhysicalDevice &device)
     if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
         score += 1000;
 
-    if (!deviceFeatures.geometryShader)
-        score = 0;
+    str missing;
+
+    if (deviceProperties.apiVersion < VK_API_VERSION_1_2)
+        missing = "Vulkan 1.2";
+    else if (!RateAvailableQueueFamilies(device))
+        missing = "a graphics queue";
+    else if (!RateExtensionSupport(device))
+        missing = "the device extensions";
+    else if (!offscreen && !RateSwapChainDetails(device))
+        missing = "swapchain formats and present modes";
+    else if (!RateFeatureSupport(device))
+        missing = "the descriptor indexing, indirect draw or timeline semaphore features";
 
-    if (!RateAvailableQueueFamilies(device) || !RateExtensionSupport(device) || !RateSwapChainDetails(device))
-        score = 0;
+    if (missing.empty())
+        return score;
 
-    return score;
+    rejection = str(deviceProperties.deviceName) + " lacks " + missing;
+
+    return 0;
 }
 
 bool Render::RateAvailableQueueFamilies(const VkPhysicalDevice &device)
@@ -444,7 +843,11 @@ void Render::GetAvailableQueuesFamilies(QueueFamilyIndices &indices, const VkPhy
         if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
             flag = flag | 0b01;
 
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, vkSurface, &presentSupport);
+        // Nothing is presented offscreen, any graphics queue will do
+        if (offscreen)
+            presentSupport = VK_TRUE;
+        else
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, vkSurface, &presentSupport);
 
         if (presentSupport)
             flag = flag | 0b10;
@@ -464,6 +867,36 @@ void Render::GetAvailableQueuesFamilies(QueueFamilyIndices &indices, const VkPhy
 
     if (!indices.IsComplete())
         throw std::runtime_error("\nFailed to find a suitable queue!");
+
+    // Families without graphics let uploads and culling overlap rendering.
+    // Transfer prefers a family that can do nothing else.
+
+    for (u32 i = 0; i < queueFamilies.size(); i++)
+    {
+        auto flags = queueFamilies[i].queueFlags;
+
+        if (flags & VK_QUEUE_GRAPHICS_BIT)
+            continue;
+
+        if (flags & VK_QUEUE_COMPUTE_BIT && !indices.computeFamily.has_value())
+            indices.computeFamily = i;
+
+        if (flags & VK_QUEUE_TRANSFER_BIT && (!indices.transferFamily.has_value() || !(flags & VK_QUEUE_COMPUTE_BIT)))
+            indices.transferFamily = i;
+    }
+
+    // Uploads and culling submit separately, so they never share a queue. A
+    // family with a single queue leaves uploads to graphics instead.
+
+    indices.transferQueue = 0;
+
+    if (indices.transferFamily.has_value() && indices.transferFamily == indices.computeFamily)
+    {
+        if (queueFamilies[indices.transferFamily.value()].queueCount > 1)
+            indices.transferQueue = 1;
+        else
+            indices.transferFamily.reset();
+    }
 }
 
 bool Render::RateExtensionSupport(const VkPhysicalDevice &device)
@@ -474,7 +907,8 @@ bool Render::RateExtensionSupport(const VkPhysicalDevice &device)
     list<VkExtensionProperties> availableExtensions(count);
     vkEnumerateDeviceExtensionProperties(device, nullptr, &count, availableExtensions.data());
 
-    oset<str> requiredExtensions(vkDeviceExtensions.begin(), vkDeviceExtensions.end());
+    auto deviceExtensions = GetDeviceExtensions();
+    oset<str> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 
     for (const auto &extension : availableExtensions)
         requiredExtensions.erase(extension.extensionName);
@@ -488,43 +922,99 @@ bool Render::RateSwapChainDetails(const VkPhysicalDevice &device)
     return !details.formats.empty() && !details.presentModes.empty();
 }
 
+bool Render::RateFeatureSupport(const VkPhysicalDevice &device)
+{
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    VkPhysicalDeviceFeatures2 features{};
+    features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features.pNext = &features12;
+
+    vkGetPhysicalDeviceFeatures2(device, &features);
+
+    // Bindless descriptor indexing (VK_EXT_descriptor_indexing) and GPU driven
+    // draws, culling writes one command per instance starting at its own id
+
+    return features12.runtimeDescriptorArray && features12.descriptorBindingPartiallyBound &&
+           features12.descriptorBindingSampledImageUpdateAfterBind &&
+           features12.descriptorBindingUpdateUnusedWhilePending &&
+           features12.shaderSampledImageArrayNonUniformIndexing && features12.drawIndirectCount &&
+           features12.timelineSemaphore && features.features.shaderSampledImageArrayDynamicIndexing &&
+           features.features.multiDrawIndirect && features.features.drawIndirectFirstInstance;
+}
+
 #pragma endregion
 
 #pragma region Logical Device Validation
 
 void Render::GetLogicalDevice(VkDevice &device)
 {
-    float queuePriority = 1.0f;
+    arr<float, 2> queuePriorities = {1.0f, 1.0f};
 
     // Queue info
 
     auto queueInfos = list<VkDeviceQueueCreateInfo>();
     auto uniqueQueueFamilies = oset<uint32_t>();
 
-    if(vkPhyDeviceIndices.graphicsFamily.has_value())
-		uniqueQueueFamilies.insert(vkPhyDeviceIndices.graphicsFamily.value());
-	if (vkPhyDeviceIndices.presentFamily.has_value())
-		uniqueQueueFamilies.insert(vkPhyDeviceIndices.presentFamily.value());
+    if (vkPhyDeviceIndices.graphicsFamily.has_value())
+        uniqueQueueFamilies.insert(vkPhyDeviceIndices.graphicsFamily.value());
+    if (vkPhyDeviceIndices.presentFamily.has_value())
+        uniqueQueueFamilies.insert(vkPhyDeviceIndices.presentFamily.value());
+    if (vkPhyDeviceIndices.transferFamily.has_value())
+        uniqueQueueFamilies.insert(vkPhyDeviceIndices.transferFamily.value());
+    if (vkPhyDeviceIndices.computeFamily.has_value())
+        uniqueQueueFamilies.insert(vkPhyDeviceIndices.computeFamily.value());
 
     for (auto const &queueFamily : uniqueQueueFamilies)
     {
         VkDeviceQueueCreateInfo queueInfo{};
         queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queueInfo.queueFamilyIndex = queueFamily;
-        queueInfo.queueCount = 1;
-        queueInfo.pQueuePriorities = &queuePriority;
+        queueInfo.queueCount =
+            queueFamily == vkPhyDeviceIndices.transferFamily ? vkPhyDeviceIndices.transferQueue + 1 : 1;
+        queueInfo.pQueuePriorities = queuePriorities.data();
         queueInfos.push_back(queueInfo);
     }
 
+    // Features
+
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.runtimeDescriptorArray = VK_TRUE;
+    features12.descriptorBindingPartiallyBound = VK_TRUE;
+    features12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+    features12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    features12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+    features12.drawIndirectCount = VK_TRUE;
+    features12.timelineSemaphore = VK_TRUE;
+
+    // Fragment counts are only gathered where statistics queries can stay
+    // active across the secondaries
+
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(vkPhyDevice, &supportedFeatures);
+
+    VkPhysicalDeviceFeatures deviceFeatures{};
+    deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+    deviceFeatures.multiDrawIndirect = VK_TRUE;
+    deviceFeatures.drawIndirectFirstInstance = VK_TRUE; // culled instance ids and sprite materials
+    deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+    deviceFeatures.inheritedQueries = supportedFeatures.inheritedQueries;
+
     // Create logical device
 
     VkDeviceCreateInfo deviceInfo{};
 
     deviceInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceInfo.pNext = &features12;
+    deviceInfo.pEnabledFeatures = &deviceFeatures;
     deviceInfo.queueCreateInfoCount = static_cast<u32>(queueInfos.size());
     deviceInfo.pQueueCreateInfos = queueInfos.data();
-    deviceInfo.enabledExtensionCount = static_cast<u32>(vkDeviceExtensions.size());
-    deviceInfo.ppEnabledExtensionNames = vkDeviceExtensions.data();
+    auto deviceExtensions = GetDeviceExtensions();
+
+    deviceInfo.enabledExtensionCount = static_cast<u32>(deviceExtensions.size());
+    deviceInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
     if (IsDebug)
     {
@@ -546,6 +1036,14 @@ void Render::GetGraphicsQueue(VkQueue &queue)
     vkGetDeviceQueue(vkLogDevice, presentFamily, 0, &queue);
 }
 
+void Render::GetFamilyQueue(const opt<u32> &family, u32 index, VkQueue &queue)
+{
+    if (family.has_value())
+        vkGetDeviceQueue(vkLogDevice, family.value(), index, &queue);
+    else
+        queue = vkGraphicsQueue;
+}
+
 SwapChainSupportDetails Render::GetSwapChainSupportDetails(const VkPhysicalDevice &device)
 {
     SwapChainSupportDetails details;
@@ -620,7 +1118,17 @@ void Render::GetSwapChain(VkSwapchainKHR *cur, VkSwapchainKHR *old)
     createInfo.imageExtent = extent;
     vkSwapChainExtent = extent;
     createInfo.imageArrayLayers = 1;
-    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    // The scene is blitted in, nothing renders to the images directly
+    createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+    if (!(swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT))
+        throw std::runtime_error("\nSwap chain images do not support transfer writes!");
+
+    // Captures copy straight out of the swapchain images
+    vkSwapChainReadable = (swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+
+    if (vkSwapChainReadable)
+        createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
     u32 queueFamilyIndices[2] = {vkPhyDeviceIndices.graphicsFamily.value(), vkPhyDeviceIndices.presentFamily.value()};
 
@@ -651,27 +1159,109 @@ void Render::GetSwapChain(VkSwapchainKHR *cur, VkSwapchainKHR *old)
     vkGetSwapchainImagesKHR(vkLogDevice, *cur, &imageCount, vkSwapChainImages.data());
 }
 
+list<const char *> Render::GetDeviceExtensions() const
+{
+    return offscreen ? list<const char *>() : vkDeviceExtensions;
+}
+
+// Stands in for the swapchain, the rest of the setup sees a single image
+void Render::GetOffscreenTarget(OffscreenTarget &target)
+{
+    vkSwapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+    vkSwapChainExtent = {static_cast<u32>(windowSize.x), static_cast<u32>(windowSize.y)};
+
+    CreateImage(vkSwapChainExtent.width, vkSwapChainExtent.height, vkSwapChainImageFormat,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                target.image, target.memory);
+
+    VkDeviceSize size = static_cast<VkDeviceSize>(vkSwapChainExtent.width) * vkSwapChainExtent.height * 4;
+    CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, target.readback,
+                 target.readbackMemory);
+
+    vkSwapChainImages = {target.image};
+    vkSwapChainReadable = true;
+}
+
+// Frames already submitted keep running against the old swapchain. It is
+// handed to the new one, then retired together with its views, the targets
+// sized after it and the primaries recorded against them.
 void Render::RecreateSwapChain()
 {
-    while (windowSize.x == 0 || windowSize.y == 0)
-    {
-        glfwGetFramebufferSize(window, &windowSize.x, &windowSize.y);
-        glfwWaitEvents();
-    }
+    auto start = clk::now();
+
+    glfwGetFramebufferSize(window, &windowSize.x, &windowSize.y);
+
+    swapChainStale = windowSize.x == 0 || windowSize.y == 0;
+
+    if (swapChainStale)
+        return;
 
     vkOldSwapChain = vkCurSwapChain;
 
     GetSwapChain(&vkCurSwapChain, &vkOldSwapChain);
-    vkDeviceWaitIdle(vkLogDevice);
 
-    for (const auto &imageView : vkImageViews)
-        vkDestroyImageView(vkLogDevice, imageView, nullptr);
-    for (const auto &frameBuffer : vkFramesBuffer)
-        vkDestroyFramebuffer(vkLogDevice, frameBuffer, nullptr);
-    vkDestroySwapchainKHR(vkLogDevice, vkOldSwapChain, nullptr);
+    Retire([this, swapChain = vkOldSwapChain, imageViews = vkImageViews, sceneTarget = scene,
+            depthTarget = depth]() mutable {
+        for (const auto &imageView : imageViews)
+            vkDestroyImageView(vkLogDevice, imageView, nullptr);
+        ReleaseSceneTarget(sceneTarget);
+        ReleaseDepthTarget(depthTarget);
+        vkDestroySwapchainKHR(vkLogDevice, swapChain, nullptr);
+    });
+
+    for (auto &buffers : frames.cmdBuffers)
+    {
+        Retire([this, buffers]() {
+            vkFreeCommandBuffers(vkLogDevice, vkCmdPool, static_cast<u32>(buffers.size()), buffers.data());
+        });
+        buffers.clear();
+    }
+
+    vkOldSwapChain = VK_NULL_HANDLE;
+
+    // Capture slots still copying or encoding keep their extent, each grows
+    // for the new one when RecordCapture next claims it
 
     GetImageViews(vkImageViews);
-    GetFramesBuffer(vkFramesBuffer);
+    GetDepthTarget(depth);
+    GetSceneTarget(scene);
+    GetFrameCommandBuffers(frames);
+
+    MarkDirty();
+
+    stats.swapChainRecreations++;
+    stats.recreateMs = ElapsedMs(start);
+}
+
+// Used by the frames submitted so far
+void Render::Retire(const del<void()> &destroy)
+{
+    RetireAfter(frameNumber, destroy);
+}
+
+// Work submitted between frames is covered by the next frame, since a frame
+// signals only after every earlier submission on the queue has completed
+void Render::RetireAfter(u64 frame, const del<void()> &destroy)
+{
+    auto at = std::find_if(retired.begin(), retired.end(),
+                           [frame](const RetiredObject &object) { return object.frame > frame; });
+
+    retired.insert(at, {frame, destroy});
+    stats.retiredObjects = static_cast<u32>(retired.size());
+}
+
+// Retirements are kept in frame order, so the front is always the oldest
+void Render::DestroyRetired()
+{
+    auto done = std::find_if(retired.begin(), retired.end(),
+                             [this](const RetiredObject &object) { return object.frame > completedFrames; });
+
+    for (auto it = retired.begin(); it != done; ++it)
+        it->destroy();
+
+    retired.erase(retired.begin(), done);
+    stats.retiredObjects = static_cast<u32>(retired.size());
 }
 
 #pragma endregion
@@ -704,11 +1294,88 @@ void Render::GetImageViews(list<VkImageView> &views)
     }
 }
 
+VkImageView Render::CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect)
+{
+    VkImageViewCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    createInfo.image = image;
+    createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    createInfo.format = format;
+    createInfo.subresourceRange.aspectMask = aspect;
+    createInfo.subresourceRange.baseMipLevel = 0;
+    createInfo.subresourceRange.levelCount = 1;
+    createInfo.subresourceRange.baseArrayLayer = 0;
+    createInfo.subresourceRange.layerCount = 1;
+
+    VkImageView view;
+
+    if (vkCreateImageView(vkLogDevice, &createInfo, nullptr, &view) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create image view!");
+
+    return view;
+}
+
+// Plain depth first, the stencil formats only as fallbacks
+VkFormat Render::FindDepthFormat()
+{
+    for (auto format : {VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT})
+    {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(vkPhyDevice, format, &properties);
+
+        if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+            return format;
+    }
+
+    throw std::runtime_error("\nFailed to find a depth format!");
+}
+
+// Created with the swapchain extent, as large as the scene at its largest scale
+void Render::GetDepthTarget(DepthTarget &target)
+{
+    target.aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+
+    if (target.format != VK_FORMAT_D32_SFLOAT)
+        target.aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+
+    CreateImage(vkSwapChainExtent.width, vkSwapChainExtent.height, target.format,
+                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, target.image, target.memory);
+
+    target.view = CreateImageView(target.image, target.format, target.aspect);
+
+    VkFramebufferCreateInfo prepassInfo{};
+    prepassInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    prepassInfo.renderPass = vkPrepassRenderPass;
+    prepassInfo.attachmentCount = 1;
+    prepassInfo.pAttachments = &target.view;
+    prepassInfo.width = vkSwapChainExtent.width;
+    prepassInfo.height = vkSwapChainExtent.height;
+    prepassInfo.layers = 1;
+
+    if (vkCreateFramebuffer(vkLogDevice, &prepassInfo, nullptr, &target.prepassFramebuffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create depth prepass frameBuffer!");
+}
+
+void Render::ReleaseDepthTarget(DepthTarget &target)
+{
+    vkDestroyFramebuffer(vkLogDevice, target.prepassFramebuffer, nullptr);
+    vkDestroyImageView(vkLogDevice, target.view, nullptr);
+    vkDestroyImage(vkLogDevice, target.image, nullptr);
+    vkFreeMemory(vkLogDevice, target.memory, nullptr);
+
+    target.prepassFramebuffer = VK_NULL_HANDLE;
+    target.view = VK_NULL_HANDLE;
+    target.image = VK_NULL_HANDLE;
+    target.memory = VK_NULL_HANDLE;
+}
+
 #pragma endregion
 
 #pragma region Pipeline
 
-void Render::GetRenderPass(VkRenderPass &pass)
+// Depth is only loaded after the prepass. Both variants stay compatible, so
+// pipelines and secondaries made for one work with the other.
+void Render::GetRenderPass(VkRenderPass &pass, VkAttachmentLoadOp depthLoadOp)
 {
     VkAttachmentDescription colorAttachment;
     colorAttachment.format = vkSwapChainImageFormat;
@@ -717,412 +1384,4112 @@ void Render::GetRenderPass(VkRenderPass &pass)
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Transitions in and out of the pass are emitted by the render graph
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format = depth.format;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = depthLoadOp;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
     VkAttachmentReference colorAttachmentRef;
     colorAttachmentRef.attachment = 0;
     colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
-    VkSubpassDescription subpass;
+    VkAttachmentReference depthAttachmentRef;
+    depthAttachmentRef.attachment = 1;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
     subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subpass.colorAttachmentCount = 1;
     subpass.pColorAttachments = &colorAttachmentRef;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-    VkSubpassDependency dependency;
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    VkAttachmentDescription attachments[] = {colorAttachment, depthAttachment};
 
-    VkRenderPassCreateInfo renderPassInfo;
+    VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo.attachmentCount = 1;
-    renderPassInfo.pAttachments = &colorAttachment;
+    renderPassInfo.attachmentCount = 2;
+    renderPassInfo.pAttachments = attachments;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = 0;
+    renderPassInfo.pDependencies = nullptr;
 
     if (vkCreateRenderPass(vkLogDevice, &renderPassInfo, nullptr, &pass) != VK_SUCCESS)
         throw std::runtime_error("\nFailed to create render pass!");
 }
 
-void Render::GetPipeline(VkPipeline &pipe, VkPipelineLayout &layout)
+// Depth only, the main pass loads what it leaves behind
+void Render::GetPrepassRenderPass(VkRenderPass &pass)
 {
-    auto *fragPath = "shaders/shader.frag";
-    auto *vertPath = "shaders/shader.vert";
-
-    // Compile or read shaders
-
-    auto fragShader = GenerateShader(fragPath, shaderc_glsl_fragment_shader);
-    auto vertShader = GenerateShader(vertPath, shaderc_glsl_vertex_shader);
+    VkAttachmentDescription depthAttachment{};
+    depthAttachment.format = depth.format;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentRef;
+    depthAttachmentRef.attachment = 0;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-    // Pack shaders in shader modules
+    VkRenderPassCreateInfo renderPassInfo{};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &depthAttachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
 
-    auto fragShaderModule = GetShaderModule(fragShader);
-    auto vertShaderModule = GetShaderModule(vertShader);
+    if (vkCreateRenderPass(vkLogDevice, &renderPassInfo, nullptr, &pass) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create depth prepass render pass!");
+}
 
-    // Pack shader modules in shader stages
+void Render::GetDescriptorSetLayout(VkDescriptorSetLayout &layout)
+{
+    arr<VkDescriptorSetLayoutBinding, 3> bindings{};
+
+    // Camera, one per frame
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    bindings[0].descriptorCount = 1;
+    bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    // Objects, indexed with DrawConstants::objectIndex
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    // GPU driven instances, indexed with gl_InstanceIndex
+    bindings[2].binding = 2;
+    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[2].descriptorCount = 1;
+    bindings[2].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<u32>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(vkLogDevice, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create descriptor set layout!");
+}
 
-    VkPipelineShaderStageCreateInfo vertShaderStageInfo;
-    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertShaderStageInfo.module = vertShaderModule;
-    vertShaderStageInfo.pName = "main";
+// Every texture and material lives in one set that is bound once, draws only
+// push the material index. Unused slots are left unwritten (partially bound)
+// and new ones can be written while the set is in use (update after bind).
+void Render::GetBindlessSetLayout(VkDescriptorSetLayout &layout)
+{
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties{};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
 
-    VkPipelineShaderStageCreateInfo fragShaderStageInfo;
-    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragShaderStageInfo.module = fragShaderModule;
-    fragShaderStageInfo.pName = "main";
+    VkPhysicalDeviceProperties2 properties{};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &indexingProperties;
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+    vkGetPhysicalDeviceProperties2(vkPhyDevice, &properties);
 
-    // Create pipeline layout
+    maxTextures = std::min(maxTextures, indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages);
 
-    list<VkDynamicState> dynStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+    arr<VkDescriptorSetLayoutBinding, 3> bindings{};
 
-    VkPipelineDynamicStateCreateInfo dynamicState;
-    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamicState.dynamicStateCount = static_cast<u32>(dynStates.size());
-    dynamicState.pDynamicStates = dynStates.data();
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[0].descriptorCount = maxTextures;
+    bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-    auto bindingDescription = Vertex::GetBindingDescription();
-    auto attributeDescriptions = Vertex::GetAttributeDescriptions();
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    bindings[1].descriptorCount = 1;
+    bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-    VkPipelineVertexInputStateCreateInfo vertexInputInfo;
-    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription; // Optional
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<u32>(attributeDescriptions.size());
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data(); // Optional
+    bindings[2].binding = 2;
+    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[2].descriptorCount = 1;
+    bindings[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-    VkPipelineInputAssemblyStateCreateInfo inputAssembly;
-    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    inputAssembly.primitiveRestartEnable = VK_FALSE;
+    arr<VkDescriptorBindingFlagsEXT, 3> bindingFlags{};
+    bindingFlags[0] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+                      VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
 
-    VkViewport viewport;
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = static_cast<float>(vkSwapChainExtent.width);
-    viewport.height = static_cast<float>(vkSwapChainExtent.height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo{};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    flagsInfo.bindingCount = static_cast<u32>(bindingFlags.size());
+    flagsInfo.pBindingFlags = bindingFlags.data();
 
-    VkRect2D scissor;
-    scissor.offset = {0, 0};
-    scissor.extent = vkSwapChainExtent;
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &flagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    layoutInfo.bindingCount = static_cast<u32>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
 
-    VkPipelineViewportStateCreateInfo viewportState;
-    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportState.viewportCount = 1;
-    viewportState.pViewports = &viewport;
-    viewportState.scissorCount = 1;
-    viewportState.pScissors = &scissor;
+    if (vkCreateDescriptorSetLayout(vkLogDevice, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create bindless descriptor set layout!");
+}
 
-    VkPipelineRasterizationStateCreateInfo rasterizer;
-    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizer.depthClampEnable = VK_FALSE;
-    rasterizer.rasterizerDiscardEnable = VK_FALSE;
-    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizer.lineWidth = 1.0f;
-    rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
-    rasterizer.depthBiasConstantFactor = 0.0f; // Optional
-    rasterizer.depthBiasClamp = 0.0f;          // Optional
-    rasterizer.depthBiasSlopeFactor = 0.0f;    // Optional
+bool PipelineKey::operator==(const PipelineKey &other) const
+{
+    return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader && layout == other.layout &&
+           vertexBuffer == other.vertexBuffer && vertexLayout == other.vertexLayout && blend == other.blend && depthCompare == other.depthCompare &&
+           depthWrite == other.depthWrite && cullMode == other.cullMode && topology == other.topology &&
+           renderPass == other.renderPass && features == other.features;
+}
 
-    VkPipelineMultisampleStateCreateInfo multisampling;
-    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampling.sampleShadingEnable = VK_FALSE;
-    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-    multisampling.minSampleShading = 1.0f;          // Optional
-    multisampling.pSampleMask = nullptr;            // Optional
-    multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-    multisampling.alphaToOneEnable = VK_FALSE;      // Optional
+size_t PipelineKeyHash::operator()(const PipelineKey &key) const
+{
+    auto hash = std::hash<str>()(key.vertexShader);
+
+    auto combine = [&hash](size_t value) { hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2); };
+
+    combine(std::hash<str>()(key.fragmentShader));
+    combine(std::hash<VkPipelineLayout>()(key.layout));
+    combine(static_cast<size_t>(key.vertexBuffer));
+    combine(static_cast<size_t>(key.vertexLayout));
+    combine(static_cast<size_t>(key.blend));
+    combine(static_cast<size_t>(key.depthCompare));
+    combine(static_cast<size_t>(key.depthWrite));
+    combine(static_cast<size_t>(key.cullMode));
+    combine(static_cast<size_t>(key.topology));
+    combine(std::hash<VkRenderPass>()(key.renderPass));
+    combine(static_cast<size_t>(key.features));
+
+    return hash;
+}
 
-    VkPipelineColorBlendAttachmentState colorBlendAttachment;
-    colorBlendAttachment.colorWriteMask =
-        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;  // Optional
-    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;             // Optional
-    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;  // Optional
-    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;             // Optional
-
-    VkPipelineColorBlendStateCreateInfo colorBlending;
-    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlending.logicOpEnable = VK_FALSE;
-    colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
-    colorBlending.attachmentCount = 1;
-    colorBlending.pAttachments = &colorBlendAttachment;
-    colorBlending.blendConstants[0] = 0.0f; // Optional
-    colorBlending.blendConstants[1] = 0.0f; // Optional
-    colorBlending.blendConstants[2] = 0.0f; // Optional
-    colorBlending.blendConstants[3] = 0.0f; // Optional
+void Render::GetPipelineLayout(VkPipelineLayout &layout)
+{
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(DrawConstants);
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo;
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 0;            // Optional
-    pipelineLayoutInfo.pSetLayouts = nullptr;         // Optional
-    pipelineLayoutInfo.pushConstantRangeCount = 0;    // Optional
-    pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+    VkDescriptorSetLayout setLayouts[] = {vkDescriptorLayout, vkBindlessLayout};
+
+    pipelineLayoutInfo.setLayoutCount = 2;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     if (vkCreatePipelineLayout(vkLogDevice, &pipelineLayoutInfo, nullptr, &layout) != VK_SUCCESS)
         throw std::runtime_error("\nFailed to create pipeline layout!");
+}
 
-    // Create pipeline
+void Render::GetPipelineCache(PipelineCache &cache)
+{
+    VkPipelineCacheCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
 
-    VkGraphicsPipelineCreateInfo pipelineInfo;
+    if (vkCreatePipelineCache(vkLogDevice, &info, nullptr, &cache.vkCache) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create pipeline cache!");
+
+    cache.compiler = std::thread(&Render::CompilePipelines, this);
+}
+
+// Waits for the variants still compiling, then destroys every cached pipeline
+void Render::ReleasePipelineCache(PipelineCache &cache)
+{
+    {
+        std::unique_lock<std::mutex> lock(cache.mutex);
+        cache.shutdown = true;
+    }
+
+    cache.cond.notify_one();
+
+    if (cache.compiler.joinable())
+        cache.compiler.join();
+
+    CollectPipelines();
+
+    for (const auto &entry : cache.entries)
+        vkDestroyPipeline(vkLogDevice, entry.pipe, nullptr);
+
+    vkDestroyPipelineCache(vkLogDevice, cache.vkCache, nullptr);
+
+    cache.entries.clear();
+    cache.lookup.clear();
+}
+
+// The equal variant and the depth only prepass share the vertex shader, whose
+// position is invariant so both passes produce the exact same depths. Meshes
+// are stored packed, every format reads as floats in the shader.
+void Render::GetPipeline(VkPipeline &pipe, VkPipeline &equalPipe, VkPipeline &prepassPipe, VkPipeline &spritePipe)
+{
+    auto key = GetPipelineKey();
+
+    pipe = GetCachedPipeline(key);
+
+    // After the prepass only the nearest fragment of each pixel passes
+
+    auto equalKey = key;
+    equalKey.depthWrite = false;
+    equalKey.depthCompare = VK_COMPARE_OP_EQUAL;
+
+    equalPipe = GetCachedPipeline(equalKey);
+
+    // The prepass runs no fragment shader and writes no color
+
+    auto prepassKey = key;
+    prepassKey.fragmentShader.clear();
+    prepassKey.renderPass = vkPrepassRenderPass;
+
+    prepassPipe = GetCachedPipeline(prepassKey);
+
+    // Sprites blend over the scene in their sorted order, either face may be
+    // visible once rotated or mirrored. Their vertices are written as is.
+
+    auto spriteKey = key;
+    spriteKey.vertexLayout = VertexPacking::Float;
+    spriteKey.blend = PipelineBlend::Alpha;
+    spriteKey.depthWrite = false;
+    spriteKey.cullMode = VK_CULL_MODE_NONE;
+
+    spritePipe = GetCachedPipeline(spriteKey);
+
+    MarkDirty();
+}
+
+// Opaque mesh pipeline of the current vertex packing, the base of the variants
+PipelineKey Render::GetPipelineKey() const
+{
+    PipelineKey key;
+    key.vertexLayout = vertexPacking;
+    key.renderPass = vkRenderPass;
+
+    return key;
+}
+
+// Builds on the calling thread when the key is new, for pipelines a frame
+// cannot go without
+VkPipeline Render::GetCachedPipeline(const PipelineKey &key)
+{
+    auto it = pipelineCache.lookup.find(key);
+
+    if (it != pipelineCache.lookup.end())
+    {
+        // Still compiling, only that job is waited for and its result taken over
+        if (!pipelineCache.entries[it->second].pipe)
+        {
+            WaitForPipeline(it->second);
+            CollectPipelines();
+        }
+
+        return pipelineCache.entries[it->second].pipe;
+    }
+
+    auto vertModule = GetCachedShaderModule(key.vertexShader, shaderc_glsl_vertex_shader);
+    auto fragModule = key.fragmentShader.empty() ? VK_NULL_HANDLE
+                                                 : GetCachedShaderModule(key.fragmentShader, shaderc_glsl_fragment_shader);
+
+    auto start = clk::now();
+
+    PipelineEntry entry;
+    entry.key = key;
+    entry.pipe = BuildPipeline(key, vertModule, fragModule);
+    entry.buildMs = ElapsedMs(start);
+
+    pipelineCache.lookup[key] = static_cast<u32>(pipelineCache.entries.size());
+    pipelineCache.entries.push_back(entry);
+    stats.pipelines = static_cast<u32>(pipelineCache.entries.size());
+
+    return entry.pipe;
+}
+
+// Entry of the pipeline built from key. A new key compiles on the compile
+// thread while draws of the entry keep using fallback, CollectPipelines
+// switches them over between frames so a new variant never stalls one.
+u32 Render::RequestPipeline(const PipelineKey &key, VkPipeline fallback)
+{
+    auto it = pipelineCache.lookup.find(key);
+
+    if (it != pipelineCache.lookup.end())
+        return it->second;
+
+    auto id = static_cast<u32>(pipelineCache.entries.size());
+
+    PipelineEntry entry;
+    entry.key = key;
+    entry.fallback = fallback;
+
+    pipelineCache.lookup[key] = id;
+    pipelineCache.entries.push_back(entry);
+
+    // Modules are looked up here, the job only uses them
+
+    auto vertModule = GetCachedShaderModule(key.vertexShader, shaderc_glsl_vertex_shader);
+    auto fragModule = key.fragmentShader.empty() ? VK_NULL_HANDLE
+                                                 : GetCachedShaderModule(key.fragmentShader, shaderc_glsl_fragment_shader);
+
+    pipelineCache.compiling++;
+
+    {
+        std::unique_lock<std::mutex> lock(pipelineCache.mutex);
+        pipelineCache.jobs.push({id, key, vertModule, fragModule});
+    }
+
+    pipelineCache.cond.notify_one();
+
+    stats.pipelines = static_cast<u32>(pipelineCache.entries.size());
+    stats.pipelinesCompiling = pipelineCache.compiling;
+
+    return id;
+}
+
+// The draw asks for the variant and shows with the fallback until it is built
+void Render::SetDrawPipeline(DrawCall &draw, const PipelineKey &key)
+{
+    draw.pipelineEntry = RequestPipeline(key, vkPipe);
+
+    const auto &entry = pipelineCache.entries[draw.pipelineEntry];
+    draw.pipeline = entry.pipe ? entry.pipe : entry.fallback;
+
+    MarkDirty();
+}
+
+// Compile thread, builds the requested variants in order until the cache is
+// released. Jobs still queued then are finished first.
+void Render::CompilePipelines()
+{
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+#endif
+
+    while (true)
+    {
+        PipelineJob job;
+
+        {
+            std::unique_lock<std::mutex> lock(pipelineCache.mutex);
+
+            pipelineCache.cond.wait(lock, [&]() { return !pipelineCache.jobs.empty() || pipelineCache.shutdown; });
+
+            if (pipelineCache.jobs.empty())
+                return;
+
+            job = pipelineCache.jobs.front();
+            pipelineCache.jobs.pop();
+        }
+
+        PipelineEntry built;
+        auto start = clk::now();
+
+        std::exception_ptr error;
+
+        try
+        {
+            built.pipe = BuildPipeline(job.key, job.vertModule, job.fragModule);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        built.buildMs = ElapsedMs(start);
+
+        {
+            std::unique_lock<std::mutex> lock(pipelineCache.mutex);
+            pipelineCache.finished.emplace_back(job.id, built);
+
+            if (error && !pipelineCache.error)
+                pipelineCache.error = error;
+        }
+
+        pipelineCache.compiling--;
+        pipelineCache.built.notify_all();
+    }
+}
+
+// Blocks until the compile thread has handed over entry id, the jobs queued
+// ahead of it are built first
+void Render::WaitForPipeline(u32 id)
+{
+    std::unique_lock<std::mutex> lock(pipelineCache.mutex);
+
+    pipelineCache.built.wait(lock, [&]() {
+        return std::any_of(pipelineCache.finished.begin(), pipelineCache.finished.end(),
+                           [id](const auto &finished) { return finished.first == id; });
+    });
+}
+
+// By the variant the draw asked for, even while it still shows with the fallback
+bool Render::IsBlendedDraw(const DrawCall &draw) const
+{
+    if (draw.pipelineEntry == NoPipelineEntry)
+        return false;
+
+    return pipelineCache.entries[draw.pipelineEntry].key.blend != PipelineBlend::Opaque;
+}
+
+// Draws on the base pipeline are swapped for the equal variant, so they always
+// need their depth. Other variants only when their depth is final, blended,
+// alpha tested or non writing ones keep their own depth test in the main pass.
+bool Render::IsPrepassDraw(const DrawCall &draw) const
+{
+    if (draw.pipeline == vkPipe)
+        return true;
+
+    if (draw.pipelineEntry == NoPipelineEntry)
+        return false;
+
+    const auto &key = pipelineCache.entries[draw.pipelineEntry].key;
+
+    return key.blend == PipelineBlend::Opaque && key.depthWrite && (key.features & ShaderFeature::AlphaTest) == 0 &&
+           (key.depthCompare == VK_COMPARE_OP_LESS || key.depthCompare == VK_COMPARE_OP_LESS_OR_EQUAL);
+}
+
+// Takes over the variants the compile thread finished and moves their draws
+// from the fallback onto them. The first build that failed is rethrown here,
+// on the thread that asked for it.
+void Render::CollectPipelines()
+{
+    list<std::pair<u32, PipelineEntry>> finished;
+    std::exception_ptr error;
+
+    {
+        std::unique_lock<std::mutex> lock(pipelineCache.mutex);
+        finished.swap(pipelineCache.finished);
+        std::swap(error, pipelineCache.error);
+    }
+
+    stats.pipelinesCompiling = pipelineCache.compiling;
+
+    if (finished.empty())
+        return;
+
+    for (const auto &[id, built] : finished)
+    {
+        auto &entry = pipelineCache.entries[id];
+        entry.pipe = built.pipe;
+        entry.buildMs = built.buildMs;
+    }
+
+    for (auto &draw : drawList)
+        if (draw.pipelineEntry != NoPipelineEntry)
+            if (auto pipe = pipelineCache.entries[draw.pipelineEntry].pipe)
+                draw.pipeline = pipe;
+
+    MarkDirty();
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Viewport and scissor are dynamic, everything else comes from the key
+VkPipeline Render::BuildPipeline(const PipelineKey &key, VkShaderModule vertModule, VkShaderModule fragModule)
+{
+    // One VkBool32 per feature, stages ignore the constant ids they do not declare
+
+    arr<VkBool32, ShaderFeature::Count> featureValues{};
+    arr<VkSpecializationMapEntry, ShaderFeature::Count> featureEntries{};
+
+    for (u32 i = 0; i < ShaderFeature::Count; i++)
+    {
+        featureValues[i] = (key.features >> i) & 1 ? VK_TRUE : VK_FALSE;
+        featureEntries[i] = {i, static_cast<u32>(i * sizeof(VkBool32)), sizeof(VkBool32)};
+    }
+
+    VkSpecializationInfo specialization{};
+    specialization.mapEntryCount = ShaderFeature::Count;
+    specialization.pMapEntries = featureEntries.data();
+    specialization.dataSize = sizeof(featureValues);
+    specialization.pData = featureValues.data();
+
+    // Pack shader modules in shader stages
+
+    VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
+    vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    vertShaderStageInfo.module = vertModule;
+    vertShaderStageInfo.pName = "main";
+    vertShaderStageInfo.pSpecializationInfo = &specialization;
+
+    VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
+    fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fragShaderStageInfo.module = fragModule;
+    fragShaderStageInfo.pName = "main";
+    fragShaderStageInfo.pSpecializationInfo = &specialization;
+
+    VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+
+    list<VkDynamicState> dynStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+
+    VkPipelineDynamicStateCreateInfo dynamicState{};
+    dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicState.dynamicStateCount = static_cast<u32>(dynStates.size());
+    dynamicState.pDynamicStates = dynStates.data();
+
+    auto vertexInput = VertexInput::Of(key.vertexLayout);
+
+    VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+    vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    if (key.vertexBuffer)
+    {
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.pVertexBindingDescriptions = &vertexInput.binding;
+        vertexInputInfo.vertexAttributeDescriptionCount = static_cast<u32>(vertexInput.attributes.size());
+        vertexInputInfo.pVertexAttributeDescriptions = vertexInput.attributes.data();
+    }
+
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+    inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    inputAssembly.topology = key.topology;
+    inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    VkPipelineViewportStateCreateInfo viewportState{};
+    viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportState.viewportCount = 1;
+    viewportState.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.depthClampEnable = VK_FALSE;
+    rasterizer.rasterizerDiscardEnable = VK_FALSE;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.lineWidth = 1.0f;
+    rasterizer.cullMode = key.cullMode;
+    rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    rasterizer.depthBiasEnable = VK_FALSE;
+
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.sampleShadingEnable = VK_FALSE;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    multisampling.minSampleShading = 1.0f;
+
+    // Less or equal keeps coplanar draws in submission order, as without depth
+
+    VkPipelineDepthStencilStateCreateInfo depthStencil{};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = key.depthWrite ? VK_TRUE : VK_FALSE;
+    depthStencil.depthCompareOp = key.depthCompare;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
+    VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+    colorBlendAttachment.colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    colorBlendAttachment.blendEnable = VK_FALSE;
+    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    if (key.blend == PipelineBlend::Alpha)
+    {
+        colorBlendAttachment.blendEnable = VK_TRUE;
+        colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    }
+
+    // Depth only passes have no color attachment
+
+    VkPipelineColorBlendStateCreateInfo colorBlending{};
+    colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    colorBlending.logicOpEnable = VK_FALSE;
+    colorBlending.logicOp = VK_LOGIC_OP_COPY;
+    colorBlending.attachmentCount = fragModule ? 1 : 0;
+    colorBlending.pAttachments = &colorBlendAttachment;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
+    pipelineInfo.stageCount = fragModule ? 2 : 1;
     pipelineInfo.pStages = shaderStages;
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssembly;
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = nullptr; // Optional
+    pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDynamicState = &dynamicState;
-    pipelineInfo.layout = layout;
-    pipelineInfo.renderPass = vkRenderPass;
+    pipelineInfo.layout = key.layout ? key.layout : vkPipeLayout;
+    pipelineInfo.renderPass = key.renderPass;
     pipelineInfo.subpass = 0;
-    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
-    pipelineInfo.basePipelineIndex = -1;              // Optional
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineInfo.basePipelineIndex = -1;
+
+    VkPipeline pipe;
 
-    if (vkCreateGraphicsPipelines(vkLogDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipe) != VK_SUCCESS)
+    if (vkCreateGraphicsPipelines(vkLogDevice, pipelineCache.vkCache, 1, &pipelineInfo, nullptr, &pipe) != VK_SUCCESS)
         throw std::runtime_error("\nFailed to create graphics pipeline!");
 
-    vkDestroyShaderModule(vkLogDevice, fragShaderModule, nullptr);
-    vkDestroyShaderModule(vkLogDevice, vertShaderModule, nullptr);
-}
+    return pipe;
+}
+
+// SPIR-V missing or older than its source is compiled from the GLSL and
+// written back, so a checkout without the .spv files still starts. Release
+// always compiles.
+list<char> Render::GenerateShader(const str &path, shaderc_shader_kind kind)
+{
+    auto binaryPath = path + ".spv";
+
+#ifdef _DEBUG
+
+    std::error_code binaryError;
+    std::error_code sourceError;
+    auto binaryTime = std::filesystem::last_write_time(binaryPath, binaryError);
+    auto sourceTime = std::filesystem::last_write_time(path, sourceError);
+
+    if (!binaryError && (sourceError || binaryTime >= sourceTime))
+    {
+        // Get the file text
+
+        auto file = std::ifstream(binaryPath, std::ios::ate | std::ios::binary);
+
+        if (!file.is_open())
+            throw std::runtime_error("\nFailed to open shader \"" + binaryPath + "\"!");
+
+        auto fileSize = static_cast<i64>(file.tellg());
+        auto fileBuffer = list<char>(fileSize);
+        file.seekg(0);
+        file.read(fileBuffer.data(), fileSize);
+        file.close();
+
+        // Return the compiled shader
+
+        return fileBuffer;
+    }
+
+#endif
+
+    // Get the file text, binary so the size matches what is read
+
+    auto file = std::ifstream(path, std::ios::ate | std::ios::binary);
+
+    if (!file.is_open())
+        throw std::runtime_error("\nFailed to open shader \"" + path + "\"!");
+
+    auto fileSize = static_cast<u64>(file.tellg());
+    auto fileBuffer = str(fileSize, '\0');
+    file.seekg(0);
+    file.read(fileBuffer.data(), static_cast<i64>(fileSize));
+    file.close();
+
+    // Compile shader
+
+    auto compiler = shaderc::Compiler();
+    auto options = shaderc::CompileOptions();
+    options.SetOptimizationLevel(shaderc_optimization_level_size);
+
+    auto result = compiler.CompileGlslToSpv(fileBuffer, kind, path.c_str(), options);
+
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+        throw std::runtime_error("\nFailed to compile shader \"" + path + "\"!\n" + result.GetErrorMessage());
+
+    // The result is in words, copied as bytes
+
+    auto compiledShader = list<char>(reinterpret_cast<const char *>(result.cbegin()),
+                                     reinterpret_cast<const char *>(result.cend()));
+
+    // Write compiled shader to a file
+
+    auto save = std::ofstream(binaryPath, std::ios::out | std::ios::trunc | std::ios::binary);
+    save.write(compiledShader.data(), static_cast<i64>(compiledShader.size()));
+    save.close();
+
+    // Return the compiled shader
+
+    return compiledShader;
+}
+
+// Pipelines rebuilt later reuse what startup loaded. Entries are only added
+// here, so loading distinct paths in parallel is fine once they exist.
+const list<char> &Render::GetShaderCode(const str &path, shaderc_shader_kind kind)
+{
+    auto it = shaderCode.find(path);
+
+    if (it == shaderCode.end())
+        it = shaderCode.emplace(path, list<char>()).first;
+
+    if (it->second.empty())
+        it->second = GenerateShader(path, kind);
+
+    return it->second;
+}
+
+// Paths and variants whose SPIR-V is identical share one module, kept until
+// exit. Not thread safe, only one thread may be in here at a time: the main
+// thread, or the startup Pipelines task before anything else builds
+// pipelines. The compile thread gets its modules handed over.
+VkShaderModule Render::GetCachedShaderModule(const str &path, shaderc_shader_kind kind)
+{
+    const auto &code = GetShaderCode(path, kind);
+    auto [it, inserted] = shaderModules.try_emplace(str(code.begin(), code.end()), VkShaderModule{});
+
+    if (inserted)
+        it->second = GetShaderModule(code);
+
+    return it->second;
+}
+
+VkShaderModule Render::GetShaderModule(const list<char> &shader)
+{
+    VkShaderModuleCreateInfo info;
+
+    info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    info.codeSize = shader.size();
+    info.pCode = reinterpret_cast<const u32 *>(shader.data());
+
+    VkShaderModule module;
+
+    if (vkCreateShaderModule(vkLogDevice, &info, nullptr, &module) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create shader module!");
+
+    return module;
+}
+
+#pragma endregion
+
+#pragma region Buffer
+
+// Same format as the swapchain, so the final blit is a plain scale. Linear
+// filtering where the format allows it.
+void Render::GetSceneTarget(SceneTarget &target)
+{
+    CreateImage(vkSwapChainExtent.width, vkSwapChainExtent.height, vkSwapChainImageFormat,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, target.image, target.memory);
+
+    target.view = CreateImageView(target.image, vkSwapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    VkImageView attachments[] = {target.view, depth.view};
+
+    VkFramebufferCreateInfo frameBufferInfo{};
+    frameBufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    frameBufferInfo.renderPass = vkRenderPass;
+    frameBufferInfo.attachmentCount = 2;
+    frameBufferInfo.pAttachments = attachments;
+    frameBufferInfo.width = vkSwapChainExtent.width;
+    frameBufferInfo.height = vkSwapChainExtent.height;
+    frameBufferInfo.layers = 1;
+
+    if (vkCreateFramebuffer(vkLogDevice, &frameBufferInfo, nullptr, &target.framebuffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create frameBuffer!");
+
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(vkPhyDevice, vkSwapChainImageFormat, &properties);
+
+    target.filter = (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+                        ? VK_FILTER_LINEAR
+                        : VK_FILTER_NEAREST;
+
+    SetRenderScale(target.scale);
+}
+
+void Render::ReleaseSceneTarget(SceneTarget &target)
+{
+    vkDestroyFramebuffer(vkLogDevice, target.framebuffer, nullptr);
+    vkDestroyImageView(vkLogDevice, target.view, nullptr);
+    vkDestroyImage(vkLogDevice, target.image, nullptr);
+    vkFreeMemory(vkLogDevice, target.memory, nullptr);
+
+    target.framebuffer = VK_NULL_HANDLE;
+    target.view = VK_NULL_HANDLE;
+    target.image = VK_NULL_HANDLE;
+    target.memory = VK_NULL_HANDLE;
+}
+
+// The viewport is baked into the secondaries, so a new scale re-records them
+void Render::SetRenderScale(float scale)
+{
+    scene.scale = std::clamp(scale, scene.minScale, scene.maxScale);
+    scene.extent.width = std::max(1u, static_cast<u32>(static_cast<float>(vkSwapChainExtent.width) * scene.scale));
+    scene.extent.height = std::max(1u, static_cast<u32>(static_cast<float>(vkSwapChainExtent.height) * scene.scale));
+
+    stats.renderScale = scene.scale;
+
+    MarkDirty();
+}
+
+// Pixel cost goes with the area, so the scale that meets the budget is about
+// sqrt(budget / time) of the current one. It drops right away when over
+// budget but only grows one step at a time with some headroom left, and
+// waits for the timings of frames rendered at the new scale in between.
+void Render::UpdateRenderScale()
+{
+    constexpr float Step = 0.05f;
+    constexpr double Headroom = 0.8;
+
+    if (scene.budgetMs <= 0. || stats.gpuFrameMs <= 0.)
+        return;
+
+    if (scene.cooldown > 0)
+    {
+        scene.cooldown--;
+        return;
+    }
+
+    auto scale = scene.scale;
+
+    if (stats.gpuFrameMs > scene.budgetMs)
+        scale = std::floor(scene.scale * static_cast<float>(std::sqrt(scene.budgetMs / stats.gpuFrameMs)) / Step) * Step;
+    else if (stats.gpuFrameMs < scene.budgetMs * Headroom)
+        scale = scene.scale + Step;
+
+    scale = std::clamp(scale, scene.minScale, scene.maxScale);
+
+    if (std::abs(scale - scene.scale) < Step * 0.5f)
+        return;
+
+    SetRenderScale(scale);
+
+    scene.cooldown = frames.size + 4;
+    stats.scaleChanges++;
+}
+
+// Clamping would silently move vertices, a packing that cannot hold them is an error
+list<u8> Render::PackVertices(const list<Vertex> &source) const
+{
+    auto input = VertexInput::Of(vertexPacking);
+    auto packed = list<u8>(source.size() * input.binding.stride);
+
+    for (size_t i = 0; i < source.size(); i++)
+        if (!input.pack(source[i], packed.data() + i * input.binding.stride))
+            throw std::runtime_error("\nVertices do not fit the vertex packing range!");
+
+    return packed;
+}
+
+void Render::GetVertexBuffer(VkBuffer &buffer, VkDeviceMemory &memory)
+{
+    auto packed = PackVertices(meshVertices);
+    VkDeviceSize size = packed.size();
+
+    CreateBuffer(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory);
+
+    void *data;
+    vkMapMemory(vkLogDevice, memory, 0, size, 0, &data);
+    memcpy(data, packed.data(), (size_t)size);
+    vkUnmapMemory(vkLogDevice, memory);
+}
+
+void Render::GetIndexBuffer(VkBuffer &buffer, VkDeviceMemory &memory)
+{
+    VkDeviceSize size = sizeof(meshIndices[0]) * meshIndices.size();
+
+    CreateBuffer(size, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory);
+
+    void *data;
+    vkMapMemory(vkLogDevice, memory, 0, size, 0, &data);
+    memcpy(data, meshIndices.data(), (size_t)size);
+    vkUnmapMemory(vkLogDevice, memory);
+}
+
+// Mesh table the culling shader builds draw commands from
+void Render::GetMeshBuffer(VkBuffer &buffer, VkDeviceMemory &memory)
+{
+    VkDeviceSize size = sizeof(MeshData) * maxMeshes;
+
+    CreateBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory, true);
+
+    void *data;
+    vkMapMemory(vkLogDevice, memory, 0, size, 0, &data);
+    meshTable = static_cast<MeshData *>(data);
+
+    // Meshes added during startup came before the table
+    std::copy(meshes.begin(), meshes.end(), meshTable);
+}
+
+// Adds the mesh and its LOD chain to the pool contents and the mesh table,
+// uploading the vertices and indices is left to the caller. Needs no device,
+// GetMeshBuffer copies meshes added before it.
+u32 Render::AddMesh(const list<Vertex> &vertexData, const list<u32> &indexData)
+{
+    if (meshes.size() >= maxMeshes)
+        throw std::runtime_error("\nMesh table is full!");
+
+    list<glm::vec3> positions;
+
+    for (const auto &vertex : vertexData)
+        positions.push_back(glm::vec3(vertex.pos, 0.f));
+
+    auto chain = Simplify::BuildChain(positions, indexData, MaxMeshLods);
+
+    MeshData mesh;
+    mesh.vertexOffset = static_cast<i32>(meshVertices.size());
+    mesh.lodCount = static_cast<u32>(chain.size());
+
+    for (u32 i = 0; i < mesh.lodCount; i++)
+    {
+        mesh.lods[i].indexCount = static_cast<u32>(chain[i].indices.size());
+        mesh.lods[i].firstIndex = static_cast<u32>(meshIndices.size());
+        mesh.lods[i].error = chain[i].error;
+        meshIndices.insert(meshIndices.end(), chain[i].indices.begin(), chain[i].indices.end());
+    }
+
+    auto center = glm::vec3(0.f);
+    auto radius = 0.f;
+
+    for (const auto &position : positions)
+        center += position / static_cast<float>(positions.size());
+    for (const auto &position : positions)
+        radius = std::max(radius, glm::length(position - center));
+
+    mesh.sphere = glm::vec4(center, radius);
+
+    meshVertices.insert(meshVertices.end(), vertexData.begin(), vertexData.end());
+
+    auto id = static_cast<u32>(meshes.size());
+    meshes.push_back(mesh);
+
+    if (meshTable)
+        meshTable[id] = mesh;
+
+    return id;
+}
+
+// Rare, the pool buffers are rebuilt whole and the old ones retired with the
+// frames still drawing from them. Draws of the pool move over to the new ones.
+u32 Render::CreateMesh(const list<Vertex> &vertexData, const list<u32> &indexData)
+{
+    auto id = AddMesh(vertexData, indexData);
+
+    Retire([this, vertexBuffer = vkVertexBuffer, vertexMemory = vkVertexMemory, indexBuffer = vkIndexBuffer,
+            indexMemory = vkIndexMemory]() {
+        vkDestroyBuffer(vkLogDevice, vertexBuffer, nullptr);
+        vkFreeMemory(vkLogDevice, vertexMemory, nullptr);
+        vkDestroyBuffer(vkLogDevice, indexBuffer, nullptr);
+        vkFreeMemory(vkLogDevice, indexMemory, nullptr);
+    });
+
+    auto oldVertexBuffer = vkVertexBuffer;
+    auto oldIndexBuffer = vkIndexBuffer;
+
+    GetVertexBuffer(vkVertexBuffer, vkVertexMemory);
+    GetIndexBuffer(vkIndexBuffer, vkIndexMemory);
+
+    for (auto &draw : drawList)
+    {
+        if (draw.vertexBuffer == oldVertexBuffer)
+            draw.vertexBuffer = vkVertexBuffer;
+        if (draw.indexBuffer == oldIndexBuffer)
+            draw.indexBuffer = vkIndexBuffer;
+    }
+
+    MarkDirty();
+
+    return id;
+}
+
+void Render::GetInstanceBuffer(VkBuffer &buffer, VkDeviceMemory &memory)
+{
+    VkDeviceSize size = sizeof(InstanceData) * maxInstances;
+
+    CreateBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory, true);
+
+    void *data;
+    vkMapMemory(vkLogDevice, memory, 0, size, 0, &data);
+    instances = static_cast<InstanceData *>(data);
+}
+
+void Render::GetUniformRing(UniformRing &ring)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vkPhyDevice, &properties);
+
+    // Both the camera and the objects are bound at the region base
+
+    ring.alignment = std::max(properties.limits.minUniformBufferOffsetAlignment,
+                              properties.limits.minStorageBufferOffsetAlignment);
+    ring.regionSize = (uniformRegionSize + ring.alignment - 1) / ring.alignment * ring.alignment;
+
+    auto size = ring.regionSize * frames.size;
+
+    CreateBuffer(size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ring.buffer, ring.memory,
+                 true);
+
+    void *data;
+    vkMapMemory(vkLogDevice, ring.memory, 0, size, 0, &data);
+    ring.mapped = static_cast<u8 *>(data);
+}
+
+void Render::GetSpriteRing(SpriteRing &ring)
+{
+    ring.vertexRegions = frames.size + 1;
+    ring.region = 0;
+    ring.indexBase = ring.vertexRegions * SpriteRing::VertexRegionSize;
+    ring.commandBase = ring.indexBase + frames.size * SpriteRing::IndexRegionSize;
+    ring.keys.resize(SpriteRing::MaxSprites);
+
+    CreateBuffer(ring.commandBase + frames.size * SpriteRing::CommandRegionSize,
+                 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ring.buffer, ring.memory);
+
+    void *data;
+    vkMapMemory(vkLogDevice, ring.memory, 0, VK_WHOLE_SIZE, 0, &data);
+    ring.mapped = static_cast<u8 *>(data);
+}
+
+void Render::GetDescriptorSet(VkDescriptorPool &pool, VkDescriptorSet &set)
+{
+    arr<VkDescriptorPoolSize, 3> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = 1;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    poolSizes[1].descriptorCount = 1;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[2].descriptorCount = 1;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<u32>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = 1;
+
+    if (vkCreateDescriptorPool(vkLogDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create descriptor pool!");
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &vkDescriptorLayout;
+
+    if (vkAllocateDescriptorSets(vkLogDevice, &allocInfo, &set) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate descriptor set!");
+
+    // A single set serves every frame, the dynamic offsets select the region
+
+    VkDescriptorBufferInfo cameraInfo{};
+    cameraInfo.buffer = uniforms.buffer;
+    cameraInfo.offset = 0;
+    cameraInfo.range = sizeof(CameraData);
+
+    VkDescriptorBufferInfo objectsInfo{};
+    objectsInfo.buffer = uniforms.buffer;
+    objectsInfo.offset = 0;
+    objectsInfo.range = uniforms.regionSize;
+
+    VkDescriptorBufferInfo instancesInfo{};
+    instancesInfo.buffer = vkInstanceBuffer;
+    instancesInfo.offset = 0;
+    instancesInfo.range = VK_WHOLE_SIZE;
+
+    arr<VkWriteDescriptorSet, 3> writes{};
+    writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[0].dstSet = set;
+    writes[0].dstBinding = 0;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    writes[0].descriptorCount = 1;
+    writes[0].pBufferInfo = &cameraInfo;
+    writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[1].dstSet = set;
+    writes[1].dstBinding = 1;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+    writes[1].descriptorCount = 1;
+    writes[1].pBufferInfo = &objectsInfo;
+    writes[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[2].dstSet = set;
+    writes[2].dstBinding = 2;
+    writes[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[2].descriptorCount = 1;
+    writes[2].pBufferInfo = &instancesInfo;
+
+    vkUpdateDescriptorSets(vkLogDevice, static_cast<u32>(writes.size()), writes.data(), 0, nullptr);
+}
+
+void Render::GetTextureSampler(VkSampler &sampler)
+{
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = 0.0f;
+
+    if (vkCreateSampler(vkLogDevice, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create texture sampler!");
+}
+
+void Render::GetMaterialBuffer(VkBuffer &buffer, VkDeviceMemory &memory)
+{
+    VkDeviceSize size = sizeof(MaterialData) * maxMaterials;
+
+    CreateBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, memory);
+
+    void *data;
+    vkMapMemory(vkLogDevice, memory, 0, size, 0, &data);
+    materials = static_cast<MaterialData *>(data);
+}
+
+void Render::GetBindlessSet(VkDescriptorPool &pool, VkDescriptorSet &set)
+{
+    arr<VkDescriptorPoolSize, 3> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    poolSizes[0].descriptorCount = maxTextures;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+    poolSizes[1].descriptorCount = 1;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[2].descriptorCount = 1;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    poolInfo.poolSizeCount = static_cast<u32>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = 1;
+
+    if (vkCreateDescriptorPool(vkLogDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create bindless descriptor pool!");
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &vkBindlessLayout;
+
+    if (vkAllocateDescriptorSets(vkLogDevice, &allocInfo, &set) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate bindless descriptor set!");
+
+    VkDescriptorImageInfo samplerInfo{};
+    samplerInfo.sampler = vkSampler;
+
+    VkDescriptorBufferInfo materialsInfo{};
+    materialsInfo.buffer = vkMaterialBuffer;
+    materialsInfo.offset = 0;
+    materialsInfo.range = VK_WHOLE_SIZE;
+
+    arr<VkWriteDescriptorSet, 2> writes{};
+    writes[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[0].dstSet = set;
+    writes[0].dstBinding = 1;
+    writes[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    writes[0].descriptorCount = 1;
+    writes[0].pImageInfo = &samplerInfo;
+    writes[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[1].dstSet = set;
+    writes[1].dstBinding = 2;
+    writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    writes[1].descriptorCount = 1;
+    writes[1].pBufferInfo = &materialsInfo;
+
+    vkUpdateDescriptorSets(vkLogDevice, static_cast<u32>(writes.size()), writes.data(), 0, nullptr);
+}
+
+u32 Render::LoadTexture(const Image &image)
+{
+    if (textures.size() >= maxTextures)
+        throw std::runtime_error("\nBindless texture table is full!");
+
+    // Upload through a staging buffer
+
+    VkDeviceSize size = image.pixels.size();
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingMemory;
+
+    CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer,
+                 stagingMemory);
+
+    void *data;
+    vkMapMemory(vkLogDevice, stagingMemory, 0, size, 0, &data);
+    memcpy(data, image.pixels.data(), static_cast<size_t>(size));
+    vkUnmapMemory(vkLogDevice, stagingMemory);
+
+    Texture texture;
+    CreateImage(image.width, image.height, VK_FORMAT_R8G8B8A8_SRGB,
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, texture.image, texture.memory);
+
+    auto async = vkPhyDeviceIndices.transferFamily.has_value();
+    auto cmd = async ? BeginTransferCommands() : BeginSingleTimeCommands();
+
+    TransitionImageLayout(cmd, texture.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {image.width, image.height, 1};
+    vkCmdCopyBufferToImage(cmd, stagingBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    if (async)
+    {
+        // Released here, the matching acquire goes out with the next frame.
+        // Both halves carry the same layout transition.
+
+        VkImageMemoryBarrier handoff{};
+        handoff.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        handoff.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        handoff.dstAccessMask = 0;
+        handoff.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        handoff.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        handoff.srcQueueFamilyIndex = vkPhyDeviceIndices.transferFamily.value();
+        handoff.dstQueueFamilyIndex = vkPhyDeviceIndices.graphicsFamily.value();
+        handoff.image = texture.image;
+        handoff.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                             0, nullptr, 1, &handoff);
+
+        handoff.srcAccessMask = 0;
+        handoff.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        uploadAcquires.push_back(handoff);
+
+        EndTransferCommands(cmd);
+    }
+    else
+    {
+        TransitionImageLayout(cmd, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+        EndSingleTimeCommands(cmd);
+    }
+
+    RetireAfter(frameNumber + 1, [this, stagingBuffer, stagingMemory]() {
+        vkDestroyBuffer(vkLogDevice, stagingBuffer, nullptr);
+        vkFreeMemory(vkLogDevice, stagingMemory, nullptr);
+    });
+
+    texture.view = CreateImageView(texture.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
+
+    // Writing its slot is all the descriptor work a texture needs
+
+    auto slot = static_cast<u32>(textures.size());
+    textures.push_back(texture);
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageView = texture.view;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = vkBindlessSet;
+    write.dstBinding = 0;
+    write.dstArrayElement = slot;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    write.descriptorCount = 1;
+    write.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(vkLogDevice, 1, &write, 0, nullptr);
+
+    return slot;
+}
+
+u32 Render::LoadTexture(const str &path)
+{
+    Image image;
+
+    if (!ImageIO::ReadPPM(path, image))
+        throw std::runtime_error("\nFailed to read texture \"" + path + "\"!");
+
+    return LoadTexture(image);
+}
+
+// Materials are append only, a new slot is never read by in flight frames
+u32 Render::CreateMaterial(const glm::vec4 &color, u32 texture)
+{
+    if (materialCount >= maxMaterials)
+        throw std::runtime_error("\nBindless material table is full!");
+
+    MaterialData material;
+    material.color = color;
+    material.textureIndex = texture;
+
+    materials[materialCount] = material;
+
+    return materialCount++;
+}
+
+// Rewrites this frame's region. Allocation order follows the visible draws, so
+// the offsets baked in cached command buffers only move when that set does.
+void Render::UpdateUniforms(u32 frame)
+{
+    uniforms.Begin(frame);
+
+    CameraData camera;
+    camera.viewProj = cameraViewProj;
+
+    camera.frustum = Frustum::FromMatrix(cameraViewProj).planes;
+    camera.lod = glm::vec4(GetLodScale(), lodThreshold, LodHysteresis, 0.f);
+
+    cameraOffset = uniforms.Push(camera, uniforms.alignment);
+    UpdateParticles();
+
+    for (auto i : visibleDraws)
+    {
+        auto &draw = drawList[i];
+
+        ObjectData object;
+        object.model = draw.model;
+
+        auto index = static_cast<u32>(uniforms.Push(object, sizeof(ObjectData)) / sizeof(ObjectData));
+
+        if (index != draw.objectIndex)
+        {
+            draw.objectIndex = index;
+            MarkDirty();
+        }
+    }
+}
+
+#pragma endregion
+
+#pragma region Commands
+
+void Render::GetCommandPool(VkCommandPool &pool)
+{
+    VkCommandPoolCreateInfo poolInfo;
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex =
+        vkPhyDeviceIndices.graphicsFamily.has_value() ? vkPhyDeviceIndices.graphicsFamily.value() : 0;
+
+    if (vkCreateCommandPool(vkLogDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create command pool!");
+}
+
+// Left null without a dedicated family, its work then goes through vkCmdPool
+void Render::GetFamilyPool(const opt<u32> &family, VkCommandPool &pool)
+{
+    if (!family.has_value())
+        return;
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = family.value();
+
+    if (vkCreateCommandPool(vkLogDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create queue family command pool!");
+}
+
+void Render::GetTimeline(VkSemaphore &semaphore)
+{
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+
+    if (vkCreateSemaphore(vkLogDevice, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create timeline semaphore!");
+}
+
+void Render::PopulateFrames(FramesInFlight &framesInFlight)
+{
+    GetFrameCommandBuffers(framesInFlight);
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (size_t i = 0; i < framesInFlight.size; i++)
+        if (vkCreateSemaphore(vkLogDevice, &semaphoreInfo, nullptr, &framesInFlight.imgSemaphores[i]) != VK_SUCCESS ||
+            vkCreateSemaphore(vkLogDevice, &semaphoreInfo, nullptr, &framesInFlight.rndSemaphores[i]) != VK_SUCCESS)
+            throw std::runtime_error("\nFailed to create synchronization objects for a frame!");
+
+    GetTimeline(framesInFlight.timeline);
+}
+
+u64 Render::GetSubmittedFrame() const
+{
+    return frameNumber;
+}
+
+u64 Render::GetCompletedFrame()
+{
+    u64 value = 0;
+
+    if (vkGetSemaphoreCounterValue(vkLogDevice, frames.timeline, &value) == VK_SUCCESS)
+        completedFrames = std::max(completedFrames, value);
+
+    return completedFrames;
+}
+
+bool Render::IsFrameComplete(u64 frame)
+{
+    return frame <= completedFrames || frame <= GetCompletedFrame();
+}
+
+// Frames not submitted yet would never signal, waiting stops at the last one
+void Render::WaitForFrame(u64 frame)
+{
+    frame = std::min(frame, frameNumber);
+
+    if (IsFrameComplete(frame))
+        return;
+
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &frames.timeline;
+    waitInfo.pValues = &frame;
+
+    if (vkWaitSemaphores(vkLogDevice, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to wait for frame completion!");
+
+    completedFrames = std::max(completedFrames, frame);
+}
+
+// One primary per frame in flight and swapchain image, so a recording stays
+// valid for as long as the render state does and can be submitted again.
+void Render::GetFrameCommandBuffers(FramesInFlight &framesInFlight)
+{
+    auto imageCount = static_cast<u32>(vkSwapChainImages.size());
+
+    for (u32 frame = 0; frame < framesInFlight.size; frame++)
+    {
+        auto &buffers = framesInFlight.cmdBuffers[frame];
+
+        if (!buffers.empty())
+            vkFreeCommandBuffers(vkLogDevice, vkCmdPool, static_cast<u32>(buffers.size()), buffers.data());
+
+        buffers.resize(imageCount);
+        framesInFlight.cmdVersions[frame].assign(imageCount, 0);
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = vkCmdPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = imageCount;
+
+        if (vkAllocateCommandBuffers(vkLogDevice, &allocInfo, buffers.data()) != VK_SUCCESS)
+            throw std::runtime_error("\nFailed to allocate command buffers!");
+    }
+}
+
+VkCommandBuffer Render::BeginSingleTimeCommands()
+{
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = vkCmdPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer buffer;
+
+    if (vkAllocateCommandBuffers(vkLogDevice, &allocInfo, &buffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate single time command buffer!");
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(buffer, &beginInfo);
+
+    return buffer;
+}
+
+// Without waiting the buffer is released once the next frame completes, the
+// frames after it are ordered behind it on the queue. Readbacks wait for this
+// submission alone so the host can use the results right away, frames
+// already in flight keep running.
+void Render::EndSingleTimeCommands(VkCommandBuffer buffer, bool wait)
+{
+    vkEndCommandBuffer(buffer);
+
+    auto value = wait ? ++readbackTimeline.value : 0;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &value;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &buffer;
+
+    if (wait)
+    {
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &readbackTimeline.semaphore;
+    }
+
+    if (vkQueueSubmit(vkGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to submit single time command buffer!");
+
+    if (wait)
+    {
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &readbackTimeline.semaphore;
+        waitInfo.pValues = &value;
+
+        if (vkWaitSemaphores(vkLogDevice, &waitInfo, UINT64_MAX) != VK_SUCCESS)
+            throw std::runtime_error("\nFailed to wait for single time command buffer!");
+
+        vkFreeCommandBuffers(vkLogDevice, vkCmdPool, 1, &buffer);
+        return;
+    }
+
+    RetireAfter(frameNumber + 1, [this, buffer]() { vkFreeCommandBuffers(vkLogDevice, vkCmdPool, 1, &buffer); });
+}
+
+VkCommandBuffer Render::BeginTransferCommands()
+{
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = vkTransferPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer buffer;
+
+    if (vkAllocateCommandBuffers(vkLogDevice, &allocInfo, &buffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate transfer command buffer!");
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(buffer, &beginInfo);
+
+    return buffer;
+}
+
+// Never waited on by the host, the next frame waits for the upload timeline
+// and its completion also covers the upload
+void Render::EndTransferCommands(VkCommandBuffer buffer)
+{
+    vkEndCommandBuffer(buffer);
+
+    auto value = ++uploadTimeline.value;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &value;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &buffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &uploadTimeline.semaphore;
+
+    if (vkQueueSubmit(vkTransferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to submit transfer command buffer!");
+
+    RetireAfter(frameNumber + 1, [this, buffer]() { vkFreeCommandBuffers(vkLogDevice, vkTransferPool, 1, &buffer); });
+}
+
+// Acquires every texture released by the transfer queue since the last frame.
+// Submitted first in the frame, after its wait on the upload timeline.
+VkCommandBuffer Render::RecordUploadAcquires()
+{
+    if (uploadAcquires.empty())
+        return VK_NULL_HANDLE;
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = vkCmdPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer buffer;
+
+    if (vkAllocateCommandBuffers(vkLogDevice, &allocInfo, &buffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate acquire command buffer!");
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(buffer, &beginInfo);
+
+    // Same stage as the semaphore wait, so the barrier chains after it
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0,
+                         nullptr, 0, nullptr, static_cast<u32>(uploadAcquires.size()), uploadAcquires.data());
+
+    if (vkEndCommandBuffer(buffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to record acquire command buffer!");
+
+    uploadAcquires.clear();
+
+    RetireAfter(frameNumber + 1, [this, buffer]() { vkFreeCommandBuffers(vkLogDevice, vkCmdPool, 1, &buffer); });
+
+    return buffer;
+}
+
+void Render::TransitionImageLayout(VkCommandBuffer buffer, VkImage image, VkImageLayout from, VkImageLayout to)
+{
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = from;
+    barrier.newLayout = to;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+
+    VkPipelineStageFlags srcStage;
+    VkPipelineStageFlags dstStage;
+
+    if (from == VK_IMAGE_LAYOUT_UNDEFINED && to == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
+    {
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        dstStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    else if (from == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && to == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+    {
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        dstStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+    else
+    {
+        throw std::runtime_error("\nUnsupported layout transition!");
+    }
+
+    vkCmdPipelineBarrier(buffer, srcStage, dstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void Render::GetWorkerPools(FramesInFlight &framesInFlight)
+{
+    recordWorkers = static_cast<u32>(std::max(1, App::Instance().threads.GetThreadNum()));
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT; // reset as a whole, never per buffer
+    poolInfo.queueFamilyIndex =
+        vkPhyDeviceIndices.graphicsFamily.has_value() ? vkPhyDeviceIndices.graphicsFamily.value() : 0;
+
+    for (u32 frame = 0; frame < framesInFlight.size; frame++)
+    {
+        auto &pools = framesInFlight.workerPools[frame];
+        auto &buffers = framesInFlight.workerBuffers[frame];
+
+        pools.resize(recordWorkers);
+        buffers.resize(recordWorkers);
+
+        for (u32 worker = 0; worker < recordWorkers; worker++)
+        {
+            if (vkCreateCommandPool(vkLogDevice, &poolInfo, nullptr, &pools[worker]) != VK_SUCCESS)
+                throw std::runtime_error("\nFailed to create worker command pool!");
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = pools[worker];
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+
+            if (vkAllocateCommandBuffers(vkLogDevice, &allocInfo, &buffers[worker]) != VK_SUCCESS)
+                throw std::runtime_error("\nFailed to allocate worker command buffers!");
+        }
+    }
+}
+
+void Render::PopulateDrawList(list<DrawCall> &draws)
+{
+    DrawCall draw;
+    draw.pipeline = vkPipe;
+    draw.vertexBuffer = vkVertexBuffer;
+    draw.indexBuffer = vkIndexBuffer;
+    draw.indexCount = meshes[0].lods[0].indexCount;
+    draw.firstIndex = meshes[0].lods[0].firstIndex;
+    draw.vertexOffset = meshes[0].vertexOffset;
+    draw.mesh = 0;
+
+    draws.clear();
+    draws.push_back(draw);
+
+    MarkDirty();
+}
+
+// Keeps only the draws whose mesh bounds touch the frustum. The tree is rebuilt
+// when the draw list changes size and refitted otherwise, recorded commands
+// only go stale when the visible set itself changes.
+void Render::CullDrawList()
+{
+    drawBounds.resize(drawList.size());
+
+    for (size_t i = 0; i < drawList.size(); i++)
+    {
+        const auto &draw = drawList[i];
+        const auto &sphere = meshes[draw.mesh].sphere;
+
+        auto scale = std::max(glm::length(glm::vec3(draw.model[0])),
+                              std::max(glm::length(glm::vec3(draw.model[1])), glm::length(glm::vec3(draw.model[2]))));
+        auto center = glm::vec3(draw.model * glm::vec4(glm::vec3(sphere), 1.f));
+        auto radius = glm::vec3(sphere.w * scale);
+
+        drawBounds[i] = {center - radius, center + radius};
+    }
+
+    if (drawBvh.GetObjectCount() != drawBounds.size())
+        drawBvh.Build(drawBounds);
+    else
+        drawBvh.Refit(drawBounds);
+
+    auto &threads = App::Instance().threads;
+
+    list<u32> visible;
+    drawBvh.QueryFrustum(Frustum::FromMatrix(cameraViewProj), visible, threads);
+
+    // Order by state first and view depth last, the sort is stable so equal
+    // keys keep the order they were found in. Without a prepass depth goes
+    // ahead of materials, front to back order is what saves fragment work then.
+    // Blended draws follow the opaque ones of their pass, back to front
+    // whatever the sorting mode since that is what makes them blend right.
+
+    renderQueue.Clear();
+
+    auto depthFirst = depthSorting && !depthPrepass;
+
+    for (auto i : visible)
+    {
+        const auto &draw = drawList[i];
+        auto pipelineId = GetPipelineId(draw.pipeline);
+        auto blended = IsBlendedDraw(draw);
+        auto distance =
+            depthSorting || blended ? (cameraViewProj * glm::vec4(drawBounds[i].Center(), 1.f)).w : 0.f;
+
+        u64 key;
+
+        if (blended)
+            key = RenderQueue::MakeBlendKey(draw.pass, pipelineId, draw.material, draw.mesh, distance);
+        else if (depthFirst)
+            key = RenderQueue::MakeDepthKey(draw.pass, pipelineId, draw.material, draw.mesh, distance);
+        else
+            key = RenderQueue::MakeKey(draw.pass, pipelineId, draw.material, draw.mesh, distance);
+
+        renderQueue.Submit(key, i);
+    }
+
+    renderQueue.Sort(threads);
+
+    visible.clear();
+
+    for (const auto &packet : renderQueue.GetPackets())
+        visible.push_back(packet.draw);
+
+    if (visible != visibleDraws)
+    {
+        visibleDraws.swap(visible);
+        MarkDirty();
+    }
+
+    SelectDrawLods();
+}
+
+// Same choice as the culling shader makes for instances. Draws with their own
+// buffers keep the range they were given.
+void Render::SelectDrawLods()
+{
+    auto lodScale = GetLodScale();
+
+    for (auto i : visibleDraws)
+    {
+        auto &draw = drawList[i];
+
+        if (draw.indexBuffer != vkIndexBuffer)
+            continue;
+
+        const auto &mesh = meshes[draw.mesh];
+        auto scale = std::max(glm::length(glm::vec3(draw.model[0])),
+                              std::max(glm::length(glm::vec3(draw.model[1])), glm::length(glm::vec3(draw.model[2]))));
+        auto w = (cameraViewProj * glm::vec4(drawBounds[i].Center(), 1.f)).w;
+        auto lod = SelectLod(mesh, draw.lod, lodScale * scale / std::max(w, 1e-6f));
+
+        if (lod == draw.lod && draw.indexCount == mesh.lods[lod].indexCount)
+            continue;
+
+        draw.lod = lod;
+        draw.indexCount = mesh.lods[lod].indexCount;
+        draw.firstIndex = mesh.lods[lod].firstIndex;
+        MarkDirty();
+    }
+}
+
+// Finer while the current level shows more error than allowed, coarser only
+// once the next level stays well under it, so distances near a switch point
+// do not flip between two levels every frame
+u32 Render::SelectLod(const MeshData &mesh, u32 current, float pixelsPerUnit) const
+{
+    auto lod = std::min(current, mesh.lodCount - 1);
+
+    while (lod > 0 && mesh.lods[lod].error * pixelsPerUnit > lodThreshold)
+        lod--;
+
+    while (lod + 1 < mesh.lodCount && mesh.lods[lod + 1].error * pixelsPerUnit < lodThreshold * (1.f - LodHysteresis))
+        lod++;
+
+    return lod;
+}
+
+// Pixels one unit covers at w = 1. The y row of the view projection scales
+// units to clip space, and for orthographic cameras w stays 1.
+float Render::GetLodScale() const
+{
+    auto row = glm::vec3(cameraViewProj[0][1], cameraViewProj[1][1], cameraViewProj[2][1]);
+    return 0.5f * static_cast<float>(scene.extent.height) * glm::length(row);
+}
+
+u32 Render::GetPipelineId(VkPipeline pipeline)
+{
+    auto it = pipelineIds.find(pipeline);
+
+    if (it != pipelineIds.end())
+        return it->second;
+
+    auto id = static_cast<u32>(pipelineIds.size());
+    pipelineIds[pipeline] = id;
+
+    return id;
+}
+
+// The acquire semaphore waits at transfer, where the upscale first touches the
+// target. Offscreen there is no acquire and every frame in flight shares the
+// one target, so the upscale waits on the previous frame's upscale write and
+// capture copy instead. Culling only survives when the main pass consumes its
+// indirect buffers. Scene color and depth are discarded every frame, the
+// previous frame's upscale and depth tests are all they wait on.
+void Render::BuildRenderGraph(u32 idx, u32 workers)
+{
+    auto frame = frames.current;
+    auto presentLayout = offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    auto targetAccess = offscreen ? VK_ACCESS_TRANSFER_WRITE_BIT : VkAccessFlags{0};
+
+    renderGraph.Reset();
+
+    auto target = renderGraph.ImportImage(
+        "target", vkSwapChainImages[idx], VK_IMAGE_ASPECT_COLOR_BIT,
+        {VK_PIPELINE_STAGE_TRANSFER_BIT, targetAccess, VK_IMAGE_LAYOUT_UNDEFINED},
+        {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, presentLayout});
+    auto sceneColor = renderGraph.ImportImage("scene color", scene.image, VK_IMAGE_ASPECT_COLOR_BIT,
+                                              {VK_PIPELINE_STAGE_TRANSFER_BIT, 0, VK_IMAGE_LAYOUT_UNDEFINED});
+    auto depthImage = renderGraph.ImportImage(
+        "depth", depth.image, depth.aspect,
+        {VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+         VK_IMAGE_LAYOUT_UNDEFINED});
+    auto drawCommands = renderGraph.ImportBuffer("draw commands", culling.commandBuffers[frame]);
+    auto drawCount = renderGraph.ImportBuffer("draw count", culling.countBuffers[frame]);
+
+    constexpr RgAccess particleRead = {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                                       VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT};
+    constexpr RgAccess countReset = {VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                     VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT |
+                                         VK_ACCESS_SHADER_WRITE_BIT};
+
+    // Async culling is ordered by the compute timeline instead of barriers
+
+    if (!culling.async)
+        renderGraph.AddPass("culling")
+            .Use(drawCommands, RgUsage::ComputeWrite)
+            .Use(drawCount, countReset)
+            .Execute([this, frame](VkCommandBuffer buffer) {
+                auto scope = BeginGpuScope(buffer, frame, "culling");
+                RecordCulling(buffer, frame);
+                EndGpuScope(buffer, frame, scope);
+            });
+
+    RgResource particleState{};
+    RgResource particleData{};
+    RgResource aliveParticles{};
+
+    if (particles.capacity > 0)
+    {
+        particleState = renderGraph.ImportBuffer("particle state", particles.stateBuffer);
+        particleData = renderGraph.ImportBuffer("particles", particles.particleBuffer);
+        aliveParticles = renderGraph.ImportBuffer("alive particles", particles.aliveBuffer);
+
+        renderGraph.AddPass("particles")
+            .Use(particleState, RgUsage::ComputeWrite)
+            .Use(particleData, RgUsage::ComputeWrite)
+            .Use(aliveParticles, RgUsage::ComputeWrite)
+            .Execute([this, frame](VkCommandBuffer buffer) {
+                auto scope = BeginGpuScope(buffer, frame, "particles");
+                RecordParticles(buffer, frame);
+                EndGpuScope(buffer, frame, scope);
+            });
+    }
+
+    // Recorded inline, the prepass draws skip the fragment shader and are
+    // cheap next to the parallel main pass
+
+    if (depthPrepass)
+    {
+        auto &prepass = renderGraph.AddPass("depth prepass").Use(depthImage, RgUsage::DepthAttachment);
+
+        if (instanceCount > 0)
+            prepass.Use(drawCommands, RgUsage::IndirectRead).Use(drawCount, RgUsage::IndirectRead);
+
+        prepass.Execute([this, frame](VkCommandBuffer buffer) {
+            auto scope = BeginGpuScope(buffer, frame, "depth prepass");
+
+            VkRenderPassBeginInfo renderPassInfo{};
+            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            renderPassInfo.renderPass = vkPrepassRenderPass;
+            renderPassInfo.framebuffer = depth.prepassFramebuffer;
+            renderPassInfo.renderArea.offset = {0, 0};
+            renderPassInfo.renderArea.extent = scene.extent;
+
+            VkClearValue clearDepth{};
+            clearDepth.depthStencil = {1.0f, 0};
+            renderPassInfo.clearValueCount = 1;
+            renderPassInfo.pClearValues = &clearDepth;
+
+            vkCmdBeginRenderPass(buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            RecordDepthPrepass(buffer, frame);
+            vkCmdEndRenderPass(buffer);
+
+            EndGpuScope(buffer, frame, scope);
+        });
+    }
+
+    auto &mainPass = renderGraph.AddPass("main")
+                         .Use(sceneColor, RgUsage::ColorAttachment)
+                         .Use(depthImage, RgUsage::DepthAttachment);
+
+    if (instanceCount > 0)
+        mainPass.Use(drawCommands, RgUsage::IndirectRead).Use(drawCount, RgUsage::IndirectRead);
+
+    if (particles.capacity > 0)
+        mainPass.Use(particleState, particleRead).Use(particleData, particleRead).Use(aliveParticles, particleRead);
+
+    mainPass.Execute([this, frame, idx, workers](VkCommandBuffer buffer) {
+        auto scope = BeginGpuScope(buffer, frame, "main");
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = depthPrepass ? vkRenderPassAfterPrepass : vkRenderPass;
+        renderPassInfo.framebuffer = scene.framebuffer;
+        renderPassInfo.renderArea.offset = {0, 0};
+        renderPassInfo.renderArea.extent = scene.extent;
+
+        arr<VkClearValue, 2> clearValues{};
+        clearValues[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+        clearValues[1].depthStencil = {1.0f, 0};
+        renderPassInfo.clearValueCount = static_cast<u32>(clearValues.size());
+        renderPassInfo.pClearValues = clearValues.data();
+
+        vkCmdBeginRenderPass(buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        vkCmdExecuteCommands(buffer, workers, frames.workerBuffers[frame].data());
+        vkCmdEndRenderPass(buffer);
+
+        EndGpuScope(buffer, frame, scope);
+    });
+
+    // Stretches the rendered part of the scene over the whole target
+
+    renderGraph.AddPass("upscale")
+        .Use(sceneColor, RgUsage::TransferRead)
+        .Use(target, RgUsage::TransferWrite)
+        .Execute([this, frame, idx](VkCommandBuffer buffer) {
+            auto scope = BeginGpuScope(buffer, frame, "upscale");
+
+            VkImageBlit region{};
+            region.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+            region.srcOffsets[1] = {static_cast<i32>(scene.extent.width), static_cast<i32>(scene.extent.height), 1};
+            region.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+            region.dstOffsets[1] = {static_cast<i32>(vkSwapChainExtent.width),
+                                    static_cast<i32>(vkSwapChainExtent.height), 1};
+
+            vkCmdBlitImage(buffer, scene.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, vkSwapChainImages[idx],
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region, scene.filter);
+
+            EndGpuScope(buffer, frame, scope);
+        });
+
+    renderGraph.Compile();
+}
+
+void Render::RecordCommandBuffer(const VkCommandBuffer &buffer, u32 idx)
+{
+    auto start = clk::now();
+
+    // Secondaries are shared by every image of this frame slot
+
+    if (frames.workerVersions[frames.current] != stateVersion)
+    {
+        frames.workerCounts[frames.current] = RecordDrawSlices(frames.current, recordWorkers);
+        frames.workerVersions[frames.current] = stateVersion;
+    }
+
+    auto workers = frames.workerCounts[frames.current];
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = 0;                  // Optional
+    beginInfo.pInheritanceInfo = nullptr; // Optional
+
+    if (vkBeginCommandBuffer(buffer, &beginInfo) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to begin recording command buffer!");
+
+    ResetGpuScopes(buffer, frames.current);
+
+    if (profiler.statistics)
+        vkCmdBeginQuery(buffer, profiler.statisticsPools[frames.current], 0, 0);
+
+    BuildRenderGraph(idx, workers);
+    renderGraph.Execute(buffer);
+
+    if (profiler.statistics)
+        vkCmdEndQuery(buffer, profiler.statisticsPools[frames.current], 0);
+
+    stats.graph = renderGraph.GetStats();
+
+    if (vkEndCommandBuffer(buffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to record command buffer!");
+
+    stats.recordWorkers = workers;
+    stats.cpuRecordMs = ElapsedMs(start);
+}
+
+// Splits the visible draws in contiguous slices, one secondary buffer per worker.
+// Returns how many secondaries were recorded and must be executed.
+u32 Render::RecordDrawSlices(u32 frame, u32 workers)
+{
+    workers = std::clamp(workers, 1u, recordWorkers);
+    workers = static_cast<u32>(std::max<size_t>(1, std::min<size_t>(workers, visibleDraws.size())));
+
+    auto slice = (visibleDraws.size() + workers - 1) / workers;
+    auto binds = list<BindCounts>(workers);
+
+    App::Instance().threads.ParallelFor(workers, [&](u32 worker) {
+        auto first = std::min(visibleDraws.size(), worker * slice);
+        auto count = std::min(slice, visibleDraws.size() - first);
+        binds[worker] = RecordDrawSlice(frame, worker, first, count, worker + 1 == workers);
+    });
+
+    stats.binds = {};
+
+    for (const auto &counts : binds)
+        stats.binds += counts;
+
+    return workers;
+}
+
+// Sprites and particles go last so they blend over the draws of every slice
+BindCounts Render::RecordDrawSlice(u32 frame, u32 worker, size_t first, size_t count, bool last)
+{
+    const auto &buffer = frames.workerBuffers[frame][worker];
+
+    // Resetting the pool recycles the buffer memory in one go
+    vkResetCommandPool(vkLogDevice, frames.workerPools[frame][worker], 0);
+
+    VkCommandBufferInheritanceInfo inheritanceInfo{};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.renderPass = vkRenderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = VK_NULL_HANDLE; // valid for any framebuffer of the pass
+    inheritanceInfo.pipelineStatistics = profiler.statistics ? GpuProfiler::Statistics : 0;
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    if (vkBeginCommandBuffer(buffer, &beginInfo) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to begin recording secondary command buffer!");
+
+    // Dynamic state is not inherited from the primary
+
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(scene.extent.width);
+    viewport.height = static_cast<float>(scene.extent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(buffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = scene.extent;
+    vkCmdSetScissor(buffer, 0, 1, &scissor);
+
+    // Bound once, the frame region is selected through the dynamic offsets and
+    // textures and materials through push constants
+
+    auto regionBase = static_cast<u32>(frame * uniforms.regionSize);
+    u32 dynamicOffsets[] = {regionBase + static_cast<u32>(cameraOffset), regionBase};
+
+    VkDescriptorSet sets[] = {vkDescriptorSet, vkBindlessSet};
+
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vkPipeLayout, 0, 2, sets, 2, dynamicOffsets);
+
+    BindCounts binds;
+
+    VkPipeline boundPipeline{};
+    VkBuffer boundVertexBuffer{};
+    VkBuffer boundIndexBuffer{};
+
+    // Opaque draws only shade the fragments the prepass found nearest
+
+    auto opaquePipe = depthPrepass ? vkPipeEqual : vkPipe;
+
+    if (worker == 0 && instanceCount > 0)
+    {
+        RecordIndirectDraws(buffer, frame, opaquePipe);
+
+        boundPipeline = opaquePipe;
+        boundVertexBuffer = vkVertexBuffer;
+        boundIndexBuffer = vkIndexBuffer;
+        binds += {1, 1, 1, 1};
+    }
+
+    // Draws arrive sorted by state, only bind what actually changes
+
+    for (size_t i = first; i < first + count; i++)
+    {
+        const auto &draw = drawList[visibleDraws[i]];
+        auto pipeline = draw.pipeline == vkPipe ? opaquePipe : draw.pipeline;
+
+        if (pipeline != boundPipeline)
+        {
+            vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+            boundPipeline = pipeline;
+            binds.pipelines++;
+        }
+
+        if (draw.vertexBuffer != boundVertexBuffer)
+        {
+            VkBuffer vertexBuffers[] = {draw.vertexBuffer};
+            VkDeviceSize offsets[] = {0};
+            vkCmdBindVertexBuffers(buffer, 0, 1, vertexBuffers, offsets);
+            boundVertexBuffer = draw.vertexBuffer;
+            binds.vertexBuffers++;
+        }
+
+        if (draw.indexBuffer != boundIndexBuffer)
+        {
+            vkCmdBindIndexBuffer(buffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+            boundIndexBuffer = draw.indexBuffer;
+            binds.indexBuffers++;
+        }
+
+        DrawConstants constants;
+        constants.tint = draw.tint;
+        constants.objectIndex = draw.objectIndex;
+        constants.materialIndex = draw.material;
+        vkCmdPushConstants(buffer, vkPipeLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                           sizeof(DrawConstants), &constants);
+
+        vkCmdDrawIndexed(buffer, draw.indexCount, 1, draw.firstIndex, draw.vertexOffset, 0);
+        binds.draws++;
+    }
+
+    if (last && sprites.recorded)
+    {
+        RecordSprites(buffer, frame);
+        binds += {1, 1, 1, 1};
+    }
+
+    // Binds its own layout, nothing is drawn after it
+    if (last && particles.capacity > 0)
+    {
+        RecordParticleDraw(buffer, frame);
+        binds.pipelines++;
+        binds.draws++;
+    }
+
+    if (vkEndCommandBuffer(buffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to record secondary command buffer!");
+
+    return binds;
+}
+
+// The draw count and commands are data, filled by FlushSprites every frame.
+// Left out of the main pass while no sprites are drawn.
+void Render::RecordSprites(const VkCommandBuffer &buffer, u32 frame)
+{
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vkSpritePipe);
+
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(buffer, 0, 1, &sprites.buffer, offsets);
+    vkCmdBindIndexBuffer(buffer, sprites.buffer, sprites.indexBase + frame * SpriteRing::IndexRegionSize,
+                         VK_INDEX_TYPE_UINT32);
+
+    DrawConstants constants;
+    constants.objectIndex = SpriteBatched;
+    vkCmdPushConstants(buffer, vkPipeLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                       sizeof(DrawConstants), &constants);
+
+    vkCmdDrawIndexedIndirectCount(buffer, sprites.buffer, sprites.CommandOffset(frame), sprites.buffer,
+                                  sprites.CountOffset(frame), SpriteRing::MaxRuns,
+                                  sizeof(VkDrawIndexedIndirectCommand));
+}
+
+// The opaque draws of the main pass with one pipeline for all of them, only the
+// geometry buffers change between draws. Without a fragment shader nothing is
+// discarded or blended, the draws that would are left to the main pass.
+void Render::RecordDepthPrepass(const VkCommandBuffer &buffer, u32 frame)
+{
+    VkViewport viewport{};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = static_cast<float>(scene.extent.width);
+    viewport.height = static_cast<float>(scene.extent.height);
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(buffer, 0, 1, &viewport);
+
+    VkRect2D scissor{};
+    scissor.offset = {0, 0};
+    scissor.extent = scene.extent;
+    vkCmdSetScissor(buffer, 0, 1, &scissor);
+
+    auto regionBase = static_cast<u32>(frame * uniforms.regionSize);
+    u32 dynamicOffsets[] = {regionBase + static_cast<u32>(cameraOffset), regionBase};
+
+    VkDescriptorSet sets[] = {vkDescriptorSet, vkBindlessSet};
+
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vkPipeLayout, 0, 2, sets, 2, dynamicOffsets);
+
+    RecordIndirectDraws(buffer, frame, vkPrepassPipe);
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vkPrepassPipe);
+
+    VkBuffer boundVertexBuffer{};
+    VkBuffer boundIndexBuffer{};
+
+    for (auto i : visibleDraws)
+    {
+        const auto &draw = drawList[i];
+
+        if (!IsPrepassDraw(draw))
+            continue;
+
+        if (draw.vertexBuffer != boundVertexBuffer)
+        {
+            VkBuffer vertexBuffers[] = {draw.vertexBuffer};
+            VkDeviceSize offsets[] = {0};
+            vkCmdBindVertexBuffers(buffer, 0, 1, vertexBuffers, offsets);
+            boundVertexBuffer = draw.vertexBuffer;
+        }
+
+        if (draw.indexBuffer != boundIndexBuffer)
+        {
+            vkCmdBindIndexBuffer(buffer, draw.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+            boundIndexBuffer = draw.indexBuffer;
+        }
+
+        DrawConstants constants;
+        constants.tint = draw.tint;
+        constants.objectIndex = draw.objectIndex;
+        constants.materialIndex = draw.material;
+        vkCmdPushConstants(buffer, vkPipeLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                           sizeof(DrawConstants), &constants);
+
+        vkCmdDrawIndexed(buffer, draw.indexCount, 1, draw.firstIndex, draw.vertexOffset, 0);
+    }
+}
+
+void Render::BenchmarkRecording(u32 drawCount, u32 iterations)
+{
+    if (drawList.empty() || iterations == 0)
+        return;
+
+    vkDeviceWaitIdle(vkLogDevice);
+
+    auto original = drawList;
+    auto originalVisible = visibleDraws;
+    drawList = list<DrawCall>(drawCount, original[0]);
+    visibleDraws.resize(drawCount);
+
+    for (u32 i = 0; i < drawCount; i++)
+        visibleDraws[i] = i;
+
+    // Frame 0 secondaries are overwritten from here on, so every frame records
+    // again even when the benchmark does not finish
+    MarkDirty();
+
+    std::cout << std::endl
+              << "Recording benchmark [" << drawCount << " draws, " << iterations << " iterations] :" << std::endl;
+
+    double baseline = 0.;
+
+    for (u32 workers = 1;; workers = std::min(workers * 2, recordWorkers))
+    {
+        auto start = clk::now();
+
+        for (u32 i = 0; i < iterations; i++)
+            RecordDrawSlices(0, workers);
+
+        auto ms = ElapsedMs(start) / iterations;
+
+        if (workers == 1)
+            baseline = ms;
+
+        std::cout << "    workers " << workers << ": " << ms << " ms (x" << baseline / ms << "), "
+                  << stats.binds.pipelines << " pipeline / " << stats.binds.vertexBuffers << " vertex buffer binds"
+                  << std::endl;
+
+        if (workers == recordWorkers)
+            break;
+    }
+
+    drawList = original;
+    visibleDraws = originalVisible;
+}
+
+// Resizes the window every frame, so nearly every frame recreates the
+// swapchain, and reports how long frames take meanwhile
+void Render::BenchmarkResize(u32 frameCount)
+{
+    if (offscreen || frameCount == 0)
+        return;
+
+    auto base = windowSize;
+    auto recreations = stats.swapChainRecreations;
+    list<double> frameMs;
+
+    for (u32 i = 0; i < frameCount; i++)
+    {
+        auto offset = static_cast<int>(160.f * std::sin(static_cast<float>(i) * 0.1f));
+        glfwSetWindowSize(window, base.x + offset, base.y + offset / 2);
+
+        auto start = clk::now();
+
+        glfwPollEvents();
+        Run();
+
+        frameMs.push_back(ElapsedMs(start));
+    }
+
+    glfwSetWindowSize(window, base.x, base.y);
+
+    double mean = 0.;
+
+    for (auto ms : frameMs)
+        mean += ms / frameCount;
+
+    std::sort(frameMs.begin(), frameMs.end());
+
+    std::cout << std::endl
+              << "Resize benchmark [" << frameCount << " frames, "
+              << stats.swapChainRecreations - recreations << " recreations] :" << std::endl
+              << "    mean " << mean << " ms, p99 " << frameMs[frameCount * 99 / 100] << " ms, worst "
+              << frameMs.back() << " ms, last recreation " << stats.recreateMs << " ms" << std::endl;
+}
+
+// Stacks large layers along the view axis, submitted back to front, and
+// compares the fragment shader invocations of the three depth setups
+void Render::BenchmarkOverdraw(u32 layers, u32 frameCount)
+{
+    if (drawList.empty() || layers == 0 || frameCount == 0)
+        return;
+
+    if (!profiler.statistics)
+    {
+        std::cout << "Pipeline statistics are not supported, skipping the overdraw benchmark" << std::endl;
+        return;
+    }
+
+    auto original = drawList;
+    auto originalCamera = cameraViewProj;
+    auto originalInstances = instanceCount;
+    auto originalPrepass = depthPrepass;
+    auto originalSorting = depthSorting;
+
+    // Camera at the origin looking down -Z, layer i sits at distance i + 1 and
+    // is scaled with it so every layer covers about the same part of the view
+
+    auto aspect = static_cast<float>(vkSwapChainExtent.width) / static_cast<float>(vkSwapChainExtent.height);
+    SetCamera(glm::perspectiveRH_ZO(glm::radians(90.f), aspect, 0.5f, static_cast<float>(layers) + 1.f));
+
+    drawList.clear();
+
+    for (u32 i = layers; i > 0; i--)
+    {
+        auto distance = static_cast<float>(i);
+        auto draw = original[0];
+        draw.model = glm::translate(glm::mat4(1.f), glm::vec3(0.f, 0.f, -distance)) *
+                     glm::scale(glm::mat4(1.f), glm::vec3(4.f * distance * aspect, 4.f * distance, 1.f));
+        drawList.push_back(draw);
+    }
+
+    instanceCount = 0;
+    MarkDirty();
+
+    struct Mode
+    {
+        const char *name;
+        bool sorting;
+        bool prepass;
+    };
+
+    const arr<Mode, 3> modes = {{
+        {"unsorted", false, false},
+        {"front to back", true, false},
+        {"front to back + prepass", true, true},
+    }};
+
+    std::cout << std::endl
+              << "Overdraw benchmark [" << layers << " layers, " << frameCount << " frames] :" << std::endl;
+
+    double baseline = 0.;
+
+    for (const auto &mode : modes)
+    {
+        SetDepthSorting(mode.sorting);
+        SetDepthPrepass(mode.prepass);
+
+        // Statistics arrive one slot later, the first frames still report the
+        // previous mode
+
+        double invocations = 0.;
+        double gpuMs = 0.;
+
+        for (u32 i = 0; i < frameCount + frames.size; i++)
+        {
+            if (!offscreen)
+                glfwPollEvents();
+
+            Run();
+
+            if (i < frames.size)
+                continue;
+
+            invocations += static_cast<double>(stats.fragmentInvocations) / frameCount;
+            gpuMs += stats.gpuFrameMs / frameCount;
+        }
+
+        if (baseline == 0.)
+            baseline = invocations;
+
+        std::cout << "    " << mode.name << ": " << static_cast<u64>(invocations) << " fragment invocations, "
+                  << gpuMs << " ms GPU, " << 100. * (1. - invocations / std::max(baseline, 1.)) << "% saved"
+                  << std::endl;
+    }
+
+    drawList = original;
+    instanceCount = originalInstances;
+    SetCamera(originalCamera);
+    SetDepthSorting(originalSorting);
+    SetDepthPrepass(originalPrepass);
+}
+
+// Grid over [-extent, extent], clockwise quads like the triangle, uvs over [0, 1]
+static void BuildGrid(u32 size, float extent, list<Vertex> &grid, list<u32> &gridIndices)
+{
+    for (u32 y = 0; y <= size; y++)
+        for (u32 x = 0; x <= size; x++)
+        {
+            auto uv = glm::vec2(x, y) / static_cast<float>(size);
+            grid.push_back({(uv * 2.f - 1.f) * extent, glm::vec3(uv, 0.5f), uv});
+        }
+
+    for (u32 y = 0; y < size; y++)
+        for (u32 x = 0; x < size; x++)
+        {
+            auto a = y * (size + 1) + x;
+            auto d = a + size + 1;
+            gridIndices.insert(gridIndices.end(), {a, a + 1, d + 1, d + 1, d, a});
+        }
+}
+
+// Draws a dense grid several times per frame with every packing. Vertex fetch
+// dominates such a frame, so its GPU time follows the bytes per vertex.
+void Render::BenchmarkVertexPacking(u32 gridSize, u32 frameCount)
+{
+    if (drawList.empty() || gridSize == 0 || frameCount == 0)
+        return;
+
+    constexpr u32 repeats = 8;
+
+    list<Vertex> grid;
+    list<u32> gridIndices;
+    BuildGrid(gridSize, 1.f, grid, gridIndices);
+
+    VkBuffer indexBuffer;
+    VkDeviceMemory indexMemory;
+    VkDeviceSize indexSize = sizeof(u32) * gridIndices.size();
+
+    CreateBuffer(indexSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, indexBuffer, indexMemory);
+
+    void *data;
+    vkMapMemory(vkLogDevice, indexMemory, 0, indexSize, 0, &data);
+    memcpy(data, gridIndices.data(), (size_t)indexSize);
+    vkUnmapMemory(vkLogDevice, indexMemory);
+
+    auto original = drawList;
+    auto originalCamera = cameraViewProj;
+    auto originalInstances = instanceCount;
+    auto originalPacking = vertexPacking;
+    auto originalPipe = vkPipe;
+    auto originalBuffer = vkVertexBuffer;
+
+    SetCamera(glm::mat4(1.f));
+    instanceCount = 0;
+
+    struct Mode
+    {
+        const char *name;
+        VertexPacking packing;
+    };
+
+    const arr<Mode, 3> modes = {{
+        {"float", VertexPacking::Float},
+        {"half", VertexPacking::Half},
+        {"snorm", VertexPacking::Snorm},
+    }};
+
+    std::cout << std::endl
+              << "Vertex packing benchmark [" << grid.size() << " vertices x " << repeats << " draws, " << frameCount
+              << " frames] :" << std::endl;
+
+    double baselineBytes = 0.;
+
+    for (const auto &mode : modes)
+    {
+        SetVertexPacking(mode.packing);
+
+        auto packed = PackVertices(grid);
+
+        VkBuffer vertexBuffer;
+        VkDeviceMemory vertexMemory;
+
+        CreateBuffer(packed.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, vertexBuffer,
+                     vertexMemory);
+
+        vkMapMemory(vkLogDevice, vertexMemory, 0, packed.size(), 0, &data);
+        memcpy(data, packed.data(), packed.size());
+        vkUnmapMemory(vkLogDevice, vertexMemory);
+
+        drawList.clear();
+
+        for (u32 i = 0; i < repeats; i++)
+        {
+            auto draw = original[0];
+            draw.pipeline = vkPipe;
+            draw.vertexBuffer = vertexBuffer;
+            draw.indexBuffer = indexBuffer;
+            draw.indexCount = static_cast<u32>(gridIndices.size());
+            draw.firstIndex = 0;
+            draw.vertexOffset = 0;
+            draw.model = glm::mat4(1.f);
+            drawList.push_back(draw);
+        }
+
+        MarkDirty();
+
+        // Timings arrive one slot later, the first frames still report the
+        // previous packing
+
+        double gpuMs = 0.;
+
+        for (u32 i = 0; i < frameCount + frames.size; i++)
+        {
+            if (!offscreen)
+                glfwPollEvents();
+
+            Run();
+
+            if (i >= frames.size)
+                gpuMs += stats.gpuFrameMs / frameCount;
+        }
+
+        auto bytes = static_cast<double>(packed.size()) * repeats;
+
+        if (baselineBytes == 0.)
+            baselineBytes = bytes;
+
+        std::cout << "    " << mode.name << ": " << packed.size() / grid.size() << " bytes per vertex, "
+                  << bytes / (1024. * 1024.) << " MB fetched per frame, " << gpuMs << " ms GPU, "
+                  << 100. * (1. - bytes / baselineBytes) << "% less vertex bandwidth" << std::endl;
+
+        Retire([this, vertexBuffer, vertexMemory]() {
+            vkDestroyBuffer(vkLogDevice, vertexBuffer, nullptr);
+            vkFreeMemory(vkLogDevice, vertexMemory, nullptr);
+        });
+    }
+
+    Retire([this, indexBuffer, indexMemory]() {
+        vkDestroyBuffer(vkLogDevice, indexBuffer, nullptr);
+        vkFreeMemory(vkLogDevice, indexMemory, nullptr);
+    });
+
+    SetVertexPacking(originalPacking);
+
+    drawList = original;
+
+    for (auto &draw : drawList)
+    {
+        if (draw.pipeline == originalPipe)
+            draw.pipeline = vkPipe;
+        if (draw.vertexBuffer == originalBuffer)
+            draw.vertexBuffer = vkVertexBuffer;
+    }
+
+    instanceCount = originalInstances;
+    SetCamera(originalCamera);
+    MarkDirty();
+}
+
+// Scatters instances of a detailed mesh over a deep field and compares the
+// primitives drawn at full detail and at a few error thresholds
+void Render::BenchmarkLod(u32 count, u32 frameCount)
+{
+    if (count == 0 || frameCount == 0)
+        return;
+
+    if (!profiler.statistics)
+    {
+        std::cout << "Pipeline statistics are not supported, skipping the LOD benchmark" << std::endl;
+        return;
+    }
+
+    count = std::min(count, maxInstances - instanceCount);
+
+    list<Vertex> grid;
+    list<u32> gridIndices;
+    BuildGrid(64, 0.5f, grid, gridIndices);
+
+    auto mesh = CreateMesh(grid, gridIndices);
+    const auto &lods = meshes[mesh].lods;
+
+    auto originalCamera = cameraViewProj;
+    auto originalInstances = instanceCount;
+    auto originalThreshold = lodThreshold;
+    auto original = drawList;
+
+    // Camera at the origin looking down -Z over instances from 2 to 400 units away
+
+    auto aspect = static_cast<float>(vkSwapChainExtent.width) / static_cast<float>(vkSwapChainExtent.height);
+    SetCamera(glm::perspectiveRH_ZO(glm::radians(60.f), aspect, 0.5f, 500.f));
+
+    drawList.clear();
+
+    for (u32 i = 0; i < count; i++)
+    {
+        auto hash = (i + 1) * 2654435761u;
+        auto distance = 2.f + 398.f * static_cast<float>((hash >> 8) & 0xFFFF) / 65535.f;
+        auto spread = distance * 0.5f * static_cast<float>((hash >> 20) & 0x3FF) / 1023.f - distance * 0.25f;
+        auto height = distance * 0.3f * static_cast<float>(hash & 0xFF) / 255.f - distance * 0.15f;
+
+        AddInstance(mesh, 0, glm::translate(glm::mat4(1.f), glm::vec3(spread, height, -distance)));
+    }
+
+    std::cout << std::endl
+              << "LOD benchmark [" << count << " instances, " << lods[0].indexCount / 3 << " triangles at "
+              << meshes[mesh].lodCount << " levels, " << frameCount << " frames] :" << std::endl;
+
+    const arr<float, 4> thresholds = {0.f, 0.5f, 1.f, 4.f};
+    double baseline = 0.;
+
+    for (auto threshold : thresholds)
+    {
+        SetLodThreshold(threshold);
+
+        // Statistics arrive one slot later, levels settle within a frame
+
+        double primitives = 0.;
+        double gpuMs = 0.;
+
+        for (u32 i = 0; i < frameCount + frames.size; i++)
+        {
+            if (!offscreen)
+                glfwPollEvents();
+
+            Run();
+
+            if (i < frames.size)
+                continue;
+
+            primitives += static_cast<double>(stats.primitives) / frameCount;
+            gpuMs += stats.gpuFrameMs / frameCount;
+        }
+
+        if (baseline == 0.)
+            baseline = primitives;
+
+        std::cout << "    " << (threshold == 0.f ? str("full detail") : std::to_string(threshold) + " px") << ": "
+                  << static_cast<u64>(primitives) << " triangles, " << gpuMs << " ms GPU, "
+                  << 100. * (1. - primitives / std::max(baseline, 1.)) << "% fewer" << std::endl;
+    }
+
+    drawList = original;
+    instanceCount = originalInstances;
+    SetCamera(originalCamera);
+    SetLodThreshold(originalThreshold);
+    MarkDirty();
+}
+
+// Spreads the draws over every untried combination of cull mode, blend,
+// depth test and shader features and compares the frame times while the
+// variants compile on the compile thread with what building them inside one
+// frame would have cost. The variants stay cached afterwards, a second run
+// finds nothing new.
+void Render::BenchmarkPipelineVariants(u32 frameCount)
+{
+    if (drawList.empty() || frameCount == 0)
+        return;
+
+    auto original = drawList;
+    auto base = GetPipelineKey();
+
+    list<PipelineKey> keys;
+
+    for (auto cullMode : {VK_CULL_MODE_BACK_BIT, VK_CULL_MODE_NONE, VK_CULL_MODE_FRONT_BIT})
+        for (auto blend : {PipelineBlend::Opaque, PipelineBlend::Alpha})
+            for (auto depthCompare : {VK_COMPARE_OP_LESS_OR_EQUAL, VK_COMPARE_OP_ALWAYS})
+                for (auto features : {ShaderFeature::Default, ShaderFeature::Texture, ShaderFeature::VertexColor,
+                                      ShaderFeature::Default | ShaderFeature::AlphaTest})
+                {
+                    auto key = base;
+                    key.cullMode = cullMode;
+                    key.blend = blend;
+                    key.depthCompare = depthCompare;
+                    key.features = features;
+
+                    if (pipelineCache.lookup.count(key) == 0)
+                        keys.push_back(key);
+                }
+
+    if (keys.empty())
+    {
+        std::cout << "Every pipeline variant is cached already, skipping the variant benchmark" << std::endl;
+        return;
+    }
+
+    std::cout << std::endl
+              << "Pipeline variant benchmark [" << keys.size() << " variants, " << frameCount << " frames] :"
+              << std::endl;
+
+    auto runFrame = [this]() {
+        if (!offscreen)
+            glfwPollEvents();
+
+        auto start = clk::now();
+        Run();
+        return ElapsedMs(start);
+    };
+
+    double baselineMs = 0.;
+
+    for (u32 i = 0; i < frameCount + frames.size; i++)
+    {
+        auto ms = runFrame();
+
+        if (i >= frames.size)
+            baselineMs += ms / frameCount;
+    }
+
+    // The first frame requests every variant, the draws show with the
+    // fallback until their variant is picked up
+
+    auto first = pipelineCache.entries.size();
+
+    for (const auto &key : keys)
+        RequestPipeline(key, vkPipe);
+
+    for (size_t i = 0; i < drawList.size(); i++)
+        SetDrawPipeline(drawList[i], keys[i % keys.size()]);
+    auto worstMs = 0.;
+    auto readyAfter = 0u;
+
+    for (u32 i = 0; i < frameCount; i++)
+    {
+        worstMs = std::max(worstMs, runFrame());
+
+        if (readyAfter == 0 && pipelineCache.compiling == 0)
+            readyAfter = i + 1;
+    }
+
+    auto buildMs = 0.;
+
+    for (auto id = first; id < pipelineCache.entries.size(); id++)
+        buildMs += pipelineCache.entries[id].buildMs;
+
+    std::cout << "    baseline: " << baselineMs << " ms per frame" << std::endl
+              << "    lazy: worst frame " << worstMs << " ms, "
+              << (readyAfter > 0 ? "all ready after " + std::to_string(readyAfter) + " frames"
+                                 : str("still compiling"))
+              << std::endl
+              << "    synchronous: " << buildMs << " ms of pipeline builds in one frame" << std::endl
+              << "    " << pipelineCache.entries.size() << " pipelines share " << shaderModules.size()
+              << " shader modules" << std::endl;
+
+    drawList = original;
+    MarkDirty();
+}
+
+// Submits small sprites from every worker each frame, spread over a handful of
+// layers and materials, and reports where the frame time goes
+void Render::BenchmarkSprites(u32 spriteCount, u32 frameCount)
+{
+    if (frameCount == 0)
+        return;
+
+    constexpr u32 materialCount = 16;
+    constexpr u32 layerCount = 4;
+
+    auto originalCamera = cameraViewProj;
+    SetCamera(glm::mat4(1.f));
+
+    list<u32> spriteMaterials;
+
+    for (u32 i = 0; i < materialCount; i++)
+    {
+        auto hue = static_cast<float>(i) / materialCount;
+        spriteMaterials.push_back(CreateMaterial(glm::vec4(hue, 1.f - hue, 0.5f, 0.75f)));
+    }
+
+    auto &threads = App::Instance().threads;
+    auto workers = static_cast<u32>(std::max(1, threads.GetThreadNum()));
+    auto slice = (spriteCount + workers - 1) / workers;
+
+    double submitMs = 0.;
+    double flushMs = 0.;
+    double frameMs = 0.;
+    double draws = 0.;
+    u32 dropped = 0;
+
+    for (u32 i = 0; i < frameCount; i++)
+    {
+        if (!offscreen)
+            glfwPollEvents();
+
+        auto start = clk::now();
+
+        threads.ParallelFor(workers, [&](u32 worker) {
+            auto first = std::min(spriteCount, worker * slice);
+            auto last = std::min(spriteCount, first + slice);
+
+            // Cheap per sprite hash, keeps workers independent and frames moving
+            for (auto s = first; s < last; s++)
+            {
+                auto hash = (s + 1) * 2654435761u ^ (i * 40503u);
+                auto unit = [&hash]() {
+                    hash ^= hash << 13;
+                    hash ^= hash >> 17;
+                    hash ^= hash << 5;
+                    return static_cast<float>(hash & 0xFFFF) / 65535.f;
+                };
+
+                Sprite sprite;
+                sprite.position = glm::vec2(unit(), unit()) * 2.f - 1.f;
+                sprite.size = glm::vec2(0.01f + 0.02f * unit());
+                sprite.rotation = unit() * 6.2831853f;
+                sprite.material = spriteMaterials[s % materialCount];
+                sprite.layer = static_cast<u16>(s % layerCount);
+                DrawSprite(sprite);
+            }
+        });
+
+        auto submitted = ElapsedMs(start);
+
+        Run();
+
+        submitMs += submitted / frameCount;
+        frameMs += ElapsedMs(start) / frameCount;
+        flushMs += stats.spriteFlushMs / frameCount;
+        draws += static_cast<double>(stats.spriteDraws) / frameCount;
+        dropped += stats.spritesDropped;
+    }
+
+    SetCamera(originalCamera);
+
+    std::cout << std::endl
+              << "Sprite benchmark [" << spriteCount << " sprites, " << frameCount << " frames, " << workers
+              << " workers] :" << std::endl
+              << "    submit " << submitMs << " ms, flush " << flushMs << " ms, frame " << frameMs << " ms, "
+              << draws << " draws, " << dropped << " dropped" << std::endl;
+}
+
+// Emits fast enough that dead particles respawn the frame they die, so the
+// capacity stays close to fully alive. The CPU side cost is one small uniform
+// push, the GPU time of the passes is what scales.
+void Render::BenchmarkParticles(u32 count, u32 frameCount)
+{
+    if (count == 0 || frameCount == 0)
+        return;
+
+    auto originalCapacity = particles.capacity;
+    auto originalEmitter = particles.emitter;
+
+    ParticleEmitter emitter;
+    emitter.radius = 0.5f;
+    emitter.velocity = glm::vec3(0.f);
+    emitter.spread = 0.5f;
+    emitter.size = 0.002f;
+
+    std::cout << std::endl << "Particle benchmark [" << frameCount << " frames] :" << std::endl;
+
+    for (auto capacity : {count / 16, count / 4, count})
+    {
+        if (capacity == 0)
+            continue;
+
+        SetParticleCapacity(capacity);
+        emitter.rate = static_cast<float>(capacity) * 60.f;
+        SetParticleEmitter(emitter);
+
+        double particleMs = 0.;
+        double gpuMs = 0.;
+        double cpuMs = 0.;
+
+        // GPU timings arrive a slot late, the first frames fill the capacity
+
+        for (u32 i = 0; i < frameCount + frames.size; i++)
+        {
+            if (!offscreen)
+                glfwPollEvents();
+
+            auto start = clk::now();
+            Run();
+
+            if (i < frames.size)
+                continue;
+
+            cpuMs += ElapsedMs(start) / frameCount;
+            gpuMs += stats.gpuFrameMs / frameCount;
+
+            for (const auto &scope : stats.gpuScopes)
+                if (scope.name == "particles")
+                    particleMs += scope.ms / frameCount;
+        }
+
+        std::cout << "    " << capacity << " particles: " << particleMs << " ms GPU simulation, " << gpuMs
+                  << " ms GPU frame, " << cpuMs << " ms CPU frame" << std::endl;
+    }
+
+    SetParticleCapacity(originalCapacity);
+    SetParticleEmitter(originalEmitter);
+}
+
+#pragma endregion
+
+#pragma region Culling
+
+void Render::GetCullingPipeline(GpuCulling &cull)
+{
+    // Camera (frustum), instances, meshes, draw commands, draw count, LOD state
+
+    arr<VkDescriptorSetLayoutBinding, 6> bindings{};
+
+    for (u32 i = 0; i < bindings.size(); i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<u32>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(vkLogDevice, &layoutInfo, nullptr, &cull.layout) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create culling descriptor set layout!");
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(u32);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &cull.layout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(vkLogDevice, &pipelineLayoutInfo, nullptr, &cull.pipeLayout) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create culling pipeline layout!");
+
+    const auto &compShader = GetShaderCode("shaders/cull.comp", shaderc_glsl_compute_shader);
+    auto compShaderModule = GetShaderModule(compShader);
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = compShaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = cull.pipeLayout;
+
+    if (vkCreateComputePipelines(vkLogDevice, pipelineCache.vkCache, 1, &pipelineInfo, nullptr, &cull.pipe) !=
+        VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create culling pipeline!");
+
+    vkDestroyShaderModule(vkLogDevice, compShaderModule, nullptr);
+}
+
+// Outputs are per frame in flight, a frame culls while the previous one draws
+void Render::GetCullingBuffers(GpuCulling &cull)
+{
+    cull.commandBuffers.resize(frames.size);
+    cull.commandMemories.resize(frames.size);
+    cull.countBuffers.resize(frames.size);
+    cull.countMemories.resize(frames.size);
+
+    for (u32 frame = 0; frame < frames.size; frame++)
+    {
+        CreateBuffer(sizeof(VkDrawIndexedIndirectCommand) * maxInstances,
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cull.commandBuffers[frame], cull.commandMemories[frame], true);
+
+        CreateBuffer(sizeof(u32),
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                         VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cull.countBuffers[frame], cull.countMemories[frame], true);
+    }
+
+    // Shared by every frame. Frames may cull concurrently, a stale level only
+    // delays a switch by a frame. Starts at full detail.
+
+    CreateBuffer(sizeof(u32) * maxInstances, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cull.lodBuffer, cull.lodMemory, true);
+
+    auto cmd = BeginSingleTimeCommands();
+    vkCmdFillBuffer(cmd, cull.lodBuffer, 0, VK_WHOLE_SIZE, 0);
+    EndSingleTimeCommands(cmd, true);
+}
+
+void Render::GetCullingSets(GpuCulling &cull)
+{
+    arr<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = frames.size;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = frames.size * 5;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<u32>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = frames.size;
+
+    if (vkCreateDescriptorPool(vkLogDevice, &poolInfo, nullptr, &cull.pool) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create culling descriptor pool!");
+
+    auto layouts = list<VkDescriptorSetLayout>(frames.size, cull.layout);
+    cull.sets.resize(frames.size);
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = cull.pool;
+    allocInfo.descriptorSetCount = frames.size;
+    allocInfo.pSetLayouts = layouts.data();
+
+    if (vkAllocateDescriptorSets(vkLogDevice, &allocInfo, cull.sets.data()) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate culling descriptor sets!");
+
+    for (u32 frame = 0; frame < frames.size; frame++)
+    {
+        arr<VkDescriptorBufferInfo, 6> infos{};
+        infos[0] = {uniforms.buffer, 0, sizeof(CameraData)};
+        infos[1] = {vkInstanceBuffer, 0, VK_WHOLE_SIZE};
+        infos[2] = {vkMeshBuffer, 0, VK_WHOLE_SIZE};
+        infos[3] = {cull.commandBuffers[frame], 0, VK_WHOLE_SIZE};
+        infos[4] = {cull.countBuffers[frame], 0, VK_WHOLE_SIZE};
+        infos[5] = {cull.lodBuffer, 0, VK_WHOLE_SIZE};
+
+        arr<VkWriteDescriptorSet, 6> writes{};
+
+        for (u32 i = 0; i < writes.size(); i++)
+        {
+            writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[i].dstSet = cull.sets[frame];
+            writes[i].dstBinding = i;
+            writes[i].descriptorType =
+                i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[i].descriptorCount = 1;
+            writes[i].pBufferInfo = &infos[i];
+        }
+
+        vkUpdateDescriptorSets(vkLogDevice, static_cast<u32>(writes.size()), writes.data(), 0, nullptr);
+    }
+}
+
+// Recorded in the primary ahead of the render pass
+void Render::RecordCulling(const VkCommandBuffer &buffer, u32 frame)
+{
+    if (instanceCount == 0)
+        return;
+
+    vkCmdFillBuffer(buffer, culling.countBuffers[frame], 0, sizeof(u32), 0);
+
+    VkBufferMemoryBarrier resetBarrier{};
+    resetBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    resetBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    resetBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    resetBarrier.buffer = culling.countBuffers[frame];
+    resetBarrier.offset = 0;
+    resetBarrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1,
+                         &resetBarrier, 0, nullptr);
+
+    auto dynamicOffset = static_cast<u32>(frame * uniforms.regionSize + cameraOffset);
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling.pipe);
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, culling.pipeLayout, 0, 1, &culling.sets[frame], 1,
+                            &dynamicOffset);
+    vkCmdPushConstants(buffer, culling.pipeLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(u32), &instanceCount);
+    vkCmdDispatch(buffer, (instanceCount + 63) / 64, 1, 1);
+}
+
+void Render::GetAsyncCulling(GpuCulling &cull)
+{
+    cull.async = vkPhyDeviceIndices.computeFamily.has_value();
+
+    if (!cull.async)
+        return;
+
+    cull.asyncCommands.resize(frames.size);
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = vkComputePool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = frames.size;
+
+    if (vkAllocateCommandBuffers(vkLogDevice, &allocInfo, cull.asyncCommands.data()) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate culling command buffers!");
+}
+
+// Runs on the compute queue while graphics still works on earlier frames.
+// Returns whether the frame has to wait for the compute timeline.
+bool Render::SubmitAsyncCulling(u32 frame)
+{
+    if (!culling.async || instanceCount == 0)
+        return false;
+
+    auto buffer = culling.asyncCommands[frame];
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkResetCommandBuffer(buffer, 0);
+    vkBeginCommandBuffer(buffer, &beginInfo);
+    RecordCulling(buffer, frame);
+
+    if (vkEndCommandBuffer(buffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to record culling command buffer!");
+
+    auto value = ++computeTimeline.value;
+
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &value;
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &buffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &computeTimeline.semaphore;
+
+    if (vkQueueSubmit(vkComputeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to submit culling command buffer!");
+
+    return true;
+}
+
+// One call regardless of how many instances survive, the GPU reads the count
+void Render::RecordIndirectDraws(const VkCommandBuffer &buffer, u32 frame, VkPipeline pipe)
+{
+    if (instanceCount == 0)
+        return;
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipe);
+
+    VkBuffer vertexBuffers[] = {vkVertexBuffer};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(buffer, 0, 1, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(buffer, vkIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+    DrawConstants constants;
+    constants.objectIndex = GpuInstanced;
+    vkCmdPushConstants(buffer, vkPipeLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
+                       sizeof(DrawConstants), &constants);
+
+    vkCmdDrawIndexedIndirectCount(buffer, culling.commandBuffers[frame], 0, culling.countBuffers[frame], 0,
+                                  instanceCount, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+// Instances are append only, in flight frames never read past their own count
+u32 Render::AddInstance(u32 mesh, u32 material, const glm::mat4 &model)
+{
+    if (instanceCount >= maxInstances)
+        throw std::runtime_error("\nGPU instance buffer is full!");
+
+    InstanceData instance;
+    instance.model = model;
+    instance.mesh = mesh;
+    instance.material = material;
+
+    instances[instanceCount] = instance;
+
+    // The dispatch size and the draw count are recorded
+    MarkDirty();
+
+    return instanceCount++;
+}
+
+#pragma endregion
+
+#pragma region Particles
+
+// One layout for the compute passes and the draw, the stages share a module
+// and differ in the STAGE specialization constant only
+void Render::GetParticlePipelines(ParticleSystem &system)
+{
+    // Camera, params, particles, state, dead list, alive lists
+
+    arr<VkDescriptorSetLayoutBinding, 6> bindings{};
+
+    for (u32 i = 0; i < bindings.size(); i++)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = i < 2 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<u32>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(vkLogDevice, &layoutInfo, nullptr, &system.layout) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create particle descriptor set layout!");
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(u32);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &system.layout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(vkLogDevice, &pipelineLayoutInfo, nullptr, &system.pipeLayout) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create particle pipeline layout!");
+
+    auto compModule = GetCachedShaderModule("shaders/particle.comp", shaderc_glsl_compute_shader);
+
+    for (u32 stage = 0; stage < ParticleStage::Count; stage++)
+    {
+        VkSpecializationMapEntry stageEntry = {0, 0, sizeof(u32)};
+
+        VkSpecializationInfo specialization{};
+        specialization.mapEntryCount = 1;
+        specialization.pMapEntries = &stageEntry;
+        specialization.dataSize = sizeof(u32);
+        specialization.pData = &stage;
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = compModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.stage.pSpecializationInfo = &specialization;
+        pipelineInfo.layout = system.pipeLayout;
+
+        if (vkCreateComputePipelines(vkLogDevice, pipelineCache.vkCache, 1, &pipelineInfo, nullptr,
+                                     &system.stages[stage]) != VK_SUCCESS)
+            throw std::runtime_error("\nFailed to create particle pipeline!");
+    }
+
+    // Blended over the scene without writing depth, the quads come from the
+    // vertex and instance index
+
+    auto key = GetPipelineKey();
+    key.vertexShader = "shaders/particle.vert";
+    key.fragmentShader = "shaders/particle.frag";
+    key.layout = system.pipeLayout;
+    key.vertexBuffer = false;
+    key.blend = PipelineBlend::Alpha;
+    key.depthWrite = false;
+    key.cullMode = VK_CULL_MODE_NONE;
+    key.features = 0;
+
+    system.drawPipe = GetCachedPipeline(key);
+}
+
+// Every slot starts on the dead list, the reset pass fills it on the GPU. It is
+// not waited for, the first particle pass is behind it on the queue and its
+// barrier covers the writes.
+void Render::GetParticleBuffers(ParticleSystem &system)
+{
+    auto capacity = static_cast<VkDeviceSize>(system.capacity);
+
+    CreateBuffer(capacity * sizeof(glm::vec4) * 3, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, system.particleBuffer, system.particleMemory);
+    CreateBuffer(sizeof(ParticleState), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, system.stateBuffer, system.stateMemory);
+    CreateBuffer(capacity * sizeof(u32), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 system.deadBuffer, system.deadMemory);
+    CreateBuffer(capacity * sizeof(u32) * 2, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 system.aliveBuffer, system.aliveMemory);
+
+    arr<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSizes[0].descriptorCount = 2;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[1].descriptorCount = 4;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<u32>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = 1;
+
+    if (vkCreateDescriptorPool(vkLogDevice, &poolInfo, nullptr, &system.pool) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create particle descriptor pool!");
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = system.pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &system.layout;
+
+    if (vkAllocateDescriptorSets(vkLogDevice, &allocInfo, &system.set) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate particle descriptor set!");
+
+    arr<VkDescriptorBufferInfo, 6> infos{};
+    infos[0] = {uniforms.buffer, 0, sizeof(CameraData)};
+    infos[1] = {uniforms.buffer, 0, sizeof(ParticleParams)};
+    infos[2] = {system.particleBuffer, 0, VK_WHOLE_SIZE};
+    infos[3] = {system.stateBuffer, 0, VK_WHOLE_SIZE};
+    infos[4] = {system.deadBuffer, 0, VK_WHOLE_SIZE};
+    infos[5] = {system.aliveBuffer, 0, VK_WHOLE_SIZE};
+
+    arr<VkWriteDescriptorSet, 6> writes{};
+
+    for (u32 i = 0; i < writes.size(); i++)
+    {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = system.set;
+        writes[i].dstBinding = i;
+        writes[i].descriptorType = i < 2 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].descriptorCount = 1;
+        writes[i].pBufferInfo = &infos[i];
+    }
+
+    vkUpdateDescriptorSets(vkLogDevice, static_cast<u32>(writes.size()), writes.data(), 0, nullptr);
+
+    // The reset pass reads no params, any region offset will do
+    u32 dynamicOffsets[] = {0, 0};
+
+    auto cmd = BeginSingleTimeCommands();
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, system.stages[ParticleStage::Reset]);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, system.pipeLayout, 0, 1, &system.set, 2,
+                            dynamicOffsets);
+    vkCmdPushConstants(cmd, system.pipeLayout, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 0,
+                       sizeof(u32), &system.capacity);
+    vkCmdDispatch(cmd, (system.capacity + ParticleStage::GroupSize - 1) / ParticleStage::GroupSize, 1, 1);
+    EndSingleTimeCommands(cmd);
+}
+
+void Render::ReleaseParticleBuffers(ParticleSystem &system)
+{
+    vkDestroyDescriptorPool(vkLogDevice, system.pool, nullptr);
+    vkDestroyBuffer(vkLogDevice, system.particleBuffer, nullptr);
+    vkFreeMemory(vkLogDevice, system.particleMemory, nullptr);
+    vkDestroyBuffer(vkLogDevice, system.stateBuffer, nullptr);
+    vkFreeMemory(vkLogDevice, system.stateMemory, nullptr);
+    vkDestroyBuffer(vkLogDevice, system.deadBuffer, nullptr);
+    vkFreeMemory(vkLogDevice, system.deadMemory, nullptr);
+    vkDestroyBuffer(vkLogDevice, system.aliveBuffer, nullptr);
+    vkFreeMemory(vkLogDevice, system.aliveMemory, nullptr);
+}
+
+// Pushed right after the camera. Emission is whole particles per frame, the
+// fraction carries over so low rates still emit at the right pace.
+void Render::UpdateParticles()
+{
+    if (particles.capacity == 0)
+        return;
+
+    // On the input clock so replayed sessions simulate the same steps
+    auto now = App::Instance().input.Now();
+    auto dt = std::min(static_cast<float>(now - std::min(now, particles.lastUpdate)) / 1000000.f, 0.1f);
+    particles.lastUpdate = now;
+
+    const auto &emitter = particles.emitter;
+    auto emit = emitter.rate * dt + particles.emitCarry;
+    auto emitCount = std::min(static_cast<float>(particles.capacity), std::floor(emit));
+    particles.emitCarry = emit - std::floor(emit);
+
+    ParticleParams params;
+    params.position = glm::vec4(emitter.position, emitter.radius);
+    params.velocity = glm::vec4(emitter.velocity, emitter.spread);
+    params.gravity = glm::vec4(emitter.gravity, emitter.lifetime);
+    params.color = emitter.color;
+    params.dt = dt;
+    params.emitCount = static_cast<u32>(emitCount);
+    params.seed = particles.seed++;
+    params.size = emitter.size;
+
+    auto offset = uniforms.Push(params, uniforms.alignment);
+
+    // The dynamic offset is recorded
+    if (offset != particles.paramsOffset)
+    {
+        particles.paramsOffset = offset;
+        MarkDirty();
+    }
+}
+
+// Recorded in the primary ahead of the main pass. The counters never leave the
+// GPU, prepare sizes the emit and simulate dispatches and finish the draw.
+void Render::RecordParticles(const VkCommandBuffer &buffer, u32 frame)
+{
+    // The particles are shared by every frame, the last frame's passes and
+    // draw must be done with them
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(buffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                             VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    // Each pass reads what the one before wrote, some of it as dispatch sizes
+    VkMemoryBarrier passBarrier{};
+    passBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    passBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    passBarrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+    auto regionBase = static_cast<u32>(frame * uniforms.regionSize);
+    u32 dynamicOffsets[] = {regionBase + static_cast<u32>(cameraOffset),
+                            regionBase + static_cast<u32>(particles.paramsOffset)};
+
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, particles.pipeLayout, 0, 1, &particles.set, 2,
+                            dynamicOffsets);
+    vkCmdPushConstants(buffer, particles.pipeLayout, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 0,
+                       sizeof(u32), &particles.capacity);
+
+    for (auto stage : {ParticleStage::Prepare, ParticleStage::Emit, ParticleStage::Simulate, ParticleStage::Finish})
+    {
+        vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_COMPUTE, particles.stages[stage]);
+
+        if (stage == ParticleStage::Emit)
+            vkCmdDispatchIndirect(buffer, particles.stateBuffer, offsetof(ParticleState, emitArgs));
+        else if (stage == ParticleStage::Simulate)
+            vkCmdDispatchIndirect(buffer, particles.stateBuffer, offsetof(ParticleState, simulateArgs));
+        else
+            vkCmdDispatch(buffer, 1, 1, 1);
+
+        if (stage != ParticleStage::Finish)
+            vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1,
+                                 &passBarrier, 0, nullptr, 0, nullptr);
+    }
+}
+
+// One instanced draw of every alive particle, the instance count is data
+void Render::RecordParticleDraw(const VkCommandBuffer &buffer, u32 frame)
+{
+    auto regionBase = static_cast<u32>(frame * uniforms.regionSize);
+    u32 dynamicOffsets[] = {regionBase + static_cast<u32>(cameraOffset),
+                            regionBase + static_cast<u32>(particles.paramsOffset)};
+
+    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particles.drawPipe);
+    vkCmdBindDescriptorSets(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, particles.pipeLayout, 0, 1, &particles.set, 2,
+                            dynamicOffsets);
+    vkCmdPushConstants(buffer, particles.pipeLayout, VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT, 0,
+                       sizeof(u32), &particles.capacity);
+    vkCmdDrawIndirect(buffer, particles.stateBuffer, offsetof(ParticleState, drawArgs), 1,
+                      sizeof(VkDrawIndirectCommand));
+}
+
+// The old buffers stay alive until the frames simulating with them are done.
+// Every pass dispatches one dimension, the capacity stops at what it can cover.
+void Render::SetParticleCapacity(u32 count)
+{
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(vkPhyDevice, &properties);
+
+    auto maxCount = static_cast<u64>(properties.limits.maxComputeWorkGroupCount[0]) * ParticleStage::GroupSize;
+
+    if (count > maxCount)
+    {
+        LOG("Particle capacity " << count << " exceeds the device limit, clamped to " << maxCount);
+        count = static_cast<u32>(maxCount);
+    }
+
+    if (count == particles.capacity)
+        return;
+
+    if (!particles.pipeLayout)
+        GetParticlePipelines(particles);
+
+    if (particles.capacity > 0)
+    {
+        auto old = particles;
+        Retire([this, old]() mutable { ReleaseParticleBuffers(old); });
+    }
+
+    particles.capacity = count;
+    particles.emitCarry = 0.f;
+    particles.lastUpdate = App::Instance().input.Now();
+    particles.seed = App::Instance().GetSeed();
+
+    if (count > 0)
+        GetParticleBuffers(particles);
+
+    MarkDirty();
+}
+
+void Render::SetParticleEmitter(const ParticleEmitter &emitter)
+{
+    particles.emitter = emitter;
+}
+
+#pragma endregion
+
+#pragma region Sprites
+
+// Claims a slot with a single atomic, the vertices go straight to mapped memory
+bool Render::DrawSprite(const Sprite &sprite)
+{
+    auto slot = sprites.head.fetch_add(1, std::memory_order_relaxed);
+
+    if (slot >= SpriteRing::MaxSprites)
+        return false;
+
+    auto half = sprite.size * 0.5f;
+    auto cosine = std::cos(sprite.rotation);
+    auto sine = std::sin(sprite.rotation);
+    auto axisX = glm::vec2(cosine, sine) * half.x;
+    auto axisY = glm::vec2(-sine, cosine) * half.y;
+
+    // Counter clockwise from the bottom left corner
+    auto *vertices = sprites.Vertices(slot);
+    vertices[0] = {sprite.position - axisX - axisY, sprite.color, {sprite.uv.x, sprite.uv.w}};
+    vertices[1] = {sprite.position + axisX - axisY, sprite.color, {sprite.uv.z, sprite.uv.w}};
+    vertices[2] = {sprite.position + axisX + axisY, sprite.color, {sprite.uv.z, sprite.uv.y}};
+    vertices[3] = {sprite.position - axisX + axisY, sprite.color, {sprite.uv.x, sprite.uv.y}};
+
+    sprites.keys[slot] = (static_cast<u64>(sprite.layer) << 32) | sprite.material;
+
+    return true;
+}
+
+// Runs once the slot's previous frame completed, its indices and commands are
+// free. Sorting moves indices only, the vertices stay where they were written.
+// Every run of equal keys becomes one indexed draw with its material in
+// firstInstance, runs past MaxRuns are dropped along with their sprites.
+// Main thread only, every DrawSprite caller has returned by now so the head
+// can be reset without racing a writer.
+void Render::FlushSprites(u32 frame)
+{
+    auto start = clk::now();
+    auto submitted = sprites.head.load(std::memory_order_acquire);
+    auto count = std::min(submitted, SpriteRing::MaxSprites);
+    auto &threads = App::Instance().threads;
+
+    spriteQueue.Clear();
+
+    for (u32 i = 0; i < count; i++)
+        spriteQueue.Submit(sprites.keys[i], i);
+
+    spriteQueue.Sort(threads);
+
+    const auto &packets = spriteQueue.GetPackets();
+    auto *commands =
+        reinterpret_cast<VkDrawIndexedIndirectCommand *>(sprites.mapped + sprites.CommandOffset(frame));
+
+    VkDrawIndexedIndirectCommand run{};
+    run.instanceCount = 1;
+    run.vertexOffset = static_cast<i32>(sprites.region * SpriteRing::MaxSprites * 4);
+
+    u32 runs = 0;
+    u32 drawn = 0;
+
+    for (; drawn < count; drawn++)
+    {
+        auto key = packets[drawn].key;
+
+        if (run.indexCount > 0 && key == packets[drawn - 1].key)
+        {
+            run.indexCount += 6;
+            continue;
+        }
+
+        if (run.indexCount > 0)
+            commands[runs++] = run;
+
+        if (runs == SpriteRing::MaxRuns)
+        {
+            run.indexCount = 0;
+            break;
+        }
+
+        run.indexCount = 6;
+        run.firstIndex = drawn * 6;
+        run.firstInstance = static_cast<u32>(key);
+    }
+
+    if (run.indexCount > 0)
+        commands[runs++] = run;
+
+    // Indices are the bulk of the writes, each worker fills a contiguous range
+
+    auto *indices = sprites.Indices(frame);
+    auto workers = static_cast<u32>(std::max(1, threads.GetThreadNum()));
+    auto slice = (drawn + workers - 1) / workers;
+
+    if (drawn > 0)
+        threads.ParallelFor(workers, [&](u32 worker) {
+            auto first = std::min(drawn, worker * slice);
+            auto last = std::min(drawn, first + slice);
+
+            for (auto i = first; i < last; i++)
+            {
+                auto base = packets[i].draw * 4;
+                auto *quad = indices + i * 6;
+                quad[0] = base;
+                quad[1] = base + 1;
+                quad[2] = base + 2;
+                quad[3] = base + 2;
+                quad[4] = base + 3;
+                quad[5] = base;
+            }
+        });
+
+    *reinterpret_cast<u32 *>(sprites.mapped + sprites.CountOffset(frame)) = runs;
+
+    sprites.head.store(0, std::memory_order_relaxed);
+
+    // The sprite draw is only recorded while there are sprites, the command
+    // buffers are recorded again when that changes
+    if ((runs > 0) != sprites.recorded)
+    {
+        sprites.recorded = runs > 0;
+        MarkDirty();
+    }
+
+    stats.sprites = drawn;
+    stats.spriteDraws = runs;
+    stats.spritesDropped = submitted - drawn;
+    stats.spriteFlushMs = ElapsedMs(start);
+}
+
+#pragma endregion
+
+#pragma region Capture
 
-list<char> Render::GenerateShader(const str &path, shaderc_shader_kind kind)
+void Render::StartCapture(const del<void(const Image &image, u64 frame)> &sink, u32 interval)
 {
-#ifdef _DEBUG
+    if (!vkSwapChainReadable)
+        throw std::runtime_error("\nSwap chain images do not support capture!");
 
-    // Get the file text
+    StopCapture();
 
-    auto file = std::ifstream(path + ".spv", std::ios::ate | std::ios::binary);
-    auto fileSize = static_cast<i64>(file.tellg());
-    auto fileBuffer = list<char>(fileSize);
-    file.seekg(0);
-    file.read(fileBuffer.data(), fileSize);
-    file.close();
+    capture.sink = sink;
+    capture.interval = std::max(1u, interval);
 
-    // Return the compiled shader
+    GetCaptureRing(capture);
 
-    return fileBuffer;
+    capture.active = true;
+}
 
-#else
+// Stopping is rare, so it simply drains the frames in flight and the pending jobs
+void Render::StopCapture()
+{
+    if (!capture.active)
+        return;
 
-    // FIXME: doesn't compile correctly, must fix
+    FlushCaptures();
+    ReleaseCaptureRing(capture);
 
-    // Get the file text
+    capture.active = false;
+}
 
-    auto file = std::ifstream(path, std::ios::ate);
-    auto fileSize = (u64)file.tellg();
-    auto fileBuffer = str(fileSize, '\0');
-    file.seekg(0);
-    file.read(fileBuffer.data(), fileSize);
-    file.close();
+void Render::GetCaptureRing(CaptureRing &ring)
+{
+    VkDeviceSize size = static_cast<VkDeviceSize>(vkSwapChainExtent.width) * vkSwapChainExtent.height * 4;
 
-    // Compile shader
+    ring.buffers.resize(CaptureRing::Size);
+    ring.memories.resize(CaptureRing::Size);
+    ring.mapped.resize(CaptureRing::Size);
+    ring.sizes.resize(CaptureRing::Size);
+    ring.commands.resize(CaptureRing::Size);
 
-    auto compiler = shaderc::Compiler();
-    auto options = shaderc::CompileOptions();
-    options.SetOptimizationLevel(shaderc_optimization_level_size);
+    for (u32 slot = 0; slot < CaptureRing::Size; slot++)
+    {
+        GetCaptureSlot(ring, slot, size);
+        ring.states[slot] = CaptureState::Free;
+    }
 
-    auto result = compiler.CompileGlslToSpv(fileBuffer.data(), kind, path.data(), options);
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = vkCmdPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = CaptureRing::Size;
 
-    if (result.GetCompilationStatus() != shaderc_compilation_status_success)
-        throw std::runtime_error("\nFailed to compile shader!");
+    if (vkAllocateCommandBuffers(vkLogDevice, &allocInfo, ring.commands.data()) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate capture command buffers!");
+}
 
-    auto compiledShader = list<char>(result.cbegin(), result.cend());
+void Render::ReleaseCaptureRing(CaptureRing &ring)
+{
+    for (u32 slot = 0; slot < ring.buffers.size(); slot++)
+        ReleaseCaptureSlot(ring, slot);
 
-    // Write compiled shader to a file
+    if (!ring.commands.empty())
+        vkFreeCommandBuffers(vkLogDevice, vkCmdPool, static_cast<u32>(ring.commands.size()), ring.commands.data());
 
-    auto save = std::ofstream(path + ".spv", std::ios::out | std::ios::trunc | std::ios::binary);
-    save.write(compiledShader.data(), compiledShader.size());
-    save.close();
+    ring.buffers.clear();
+    ring.memories.clear();
+    ring.mapped.clear();
+    ring.sizes.clear();
+    ring.commands.clear();
+}
 
-    // Return the compiled shader
+void Render::GetCaptureSlot(CaptureRing &ring, u32 slot, VkDeviceSize size)
+{
+    CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, ring.buffers[slot],
+                 ring.memories[slot]);
 
-    return compiledShader;
+    void *data;
+    vkMapMemory(vkLogDevice, ring.memories[slot], 0, size, 0, &data);
+    ring.mapped[slot] = static_cast<u8 *>(data);
+    ring.sizes[slot] = size;
+}
 
-#endif
+void Render::ReleaseCaptureSlot(CaptureRing &ring, u32 slot)
+{
+    vkUnmapMemory(vkLogDevice, ring.memories[slot]);
+    vkDestroyBuffer(vkLogDevice, ring.buffers[slot], nullptr);
+    vkFreeMemory(vkLogDevice, ring.memories[slot], nullptr);
 }
 
-VkShaderModule Render::GetShaderModule(const list<char> &shader)
+// Copies the image about to be presented into a free slot. Returns the
+// command buffer to submit after the frame, or null when nothing is captured.
+VkCommandBuffer Render::RecordCapture(u32 idx)
 {
-    VkShaderModuleCreateInfo info;
+    if (!capture.active || frameNumber % capture.interval != 0)
+        return VK_NULL_HANDLE;
 
-    info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    info.codeSize = shader.size();
-    info.pCode = reinterpret_cast<const u32 *>(shader.data());
+    u32 slot = 0;
 
-    VkShaderModule module;
+    while (slot < CaptureRing::Size && capture.states[slot] != CaptureState::Free)
+        slot++;
 
-    if (vkCreateShaderModule(vkLogDevice, &info, nullptr, &module) != VK_SUCCESS)
-        throw std::runtime_error("\nFailed to create shader module!");
+    if (slot == CaptureRing::Size)
+    {
+        stats.capturesDropped = ++capture.dropped;
+        return VK_NULL_HANDLE;
+    }
 
-    return module;
-}
+    // A free slot's last copy has landed and been encoded, it can be replaced
+    // right away when the swapchain outgrew it
 
-#pragma endregion
+    VkDeviceSize size = static_cast<VkDeviceSize>(vkSwapChainExtent.width) * vkSwapChainExtent.height * 4;
 
-#pragma region Buffer
+    if (capture.sizes[slot] < size)
+    {
+        ReleaseCaptureSlot(capture, slot);
+        GetCaptureSlot(capture, slot, size);
+    }
+
+    auto buffer = capture.commands[slot];
+    auto image = vkSwapChainImages[idx];
+    auto layout = offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    vkResetCommandBuffer(buffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(buffer, &beginInfo) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to begin recording capture command buffer!");
+
+    VkImageMemoryBarrier imageBarrier{};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT; // the upscale blit
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.oldLayout = layout;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = image;
+    imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &imageBarrier);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {vkSwapChainExtent.width, vkSwapChainExtent.height, 1};
+
+    vkCmdCopyImageToBuffer(buffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, capture.buffers[slot], 1, &region);
+
+    // Back to what the presentation engine expects
+
+    imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.dstAccessMask = 0;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.newLayout = layout;
+
+    VkBufferMemoryBarrier bufferBarrier{};
+    bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.buffer = capture.buffers[slot];
+    bufferBarrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                         &bufferBarrier, 1, &imageBarrier);
+
+    if (vkEndCommandBuffer(buffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to record capture command buffer!");
+
+    capture.states[slot] = CaptureState::Copying;
+    capture.frameNumbers[slot] = frameNumber;
+    capture.extents[slot] = vkSwapChainExtent;
+
+    return buffer;
+}
 
-void Render::GetFramesBuffer(list<VkFramebuffer> &buffer)
+// Copies submitted with a completed frame have landed and can be converted
+// off the render thread
+void Render::CollectCaptures()
 {
-    buffer.resize(vkImageViews.size());
+    if (!capture.active)
+        return;
+
+    auto bgra = vkSwapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB || vkSwapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM;
 
-    for (size_t i = 0; i < vkImageViews.size(); i++)
+    for (u32 slot = 0; slot < CaptureRing::Size; slot++)
     {
-        VkImageView attachments[] = {vkImageViews[i]};
+        // The copy went out with the frame numbered one past its capture number
+        if (capture.states[slot] != CaptureState::Copying || !IsFrameComplete(capture.frameNumbers[slot] + 1))
+            continue;
+
+        capture.states[slot] = CaptureState::Encoding;
+
+        App::Instance().threads.AddJob([this, slot, bgra]() {
+            const auto &extent = capture.extents[slot];
+            auto image = Image(extent.width, extent.height);
 
-        VkFramebufferCreateInfo frameBufferInfo;
-        frameBufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        frameBufferInfo.renderPass = vkRenderPass;
-        frameBufferInfo.attachmentCount = 1;
-        frameBufferInfo.pAttachments = attachments;
-        frameBufferInfo.width = vkSwapChainExtent.width;
-        frameBufferInfo.height = vkSwapChainExtent.height;
-        frameBufferInfo.layers = 1;
+            memcpy(image.pixels.data(), capture.mapped[slot], image.pixels.size());
 
-        if (vkCreateFramebuffer(vkLogDevice, &frameBufferInfo, nullptr, &buffer[i]) != VK_SUCCESS)
-            throw std::runtime_error("\nFailed to create frameBuffer!");
+            if (bgra)
+                for (size_t i = 0; i < image.pixels.size(); i += 4)
+                    std::swap(image.pixels[i], image.pixels[i + 2]);
+
+            capture.sink(image, capture.frameNumbers[slot]);
+            capture.written++;
+            capture.states[slot] = CaptureState::Free;
+        });
     }
+
+    stats.capturesWritten = capture.written;
 }
 
-void Render::GetVertexBuffer(VkBuffer &buffer, VkDeviceMemory &memory)
+// Waits for the frames in flight, hands over every pending copy and waits for the jobs
+void Render::FlushCaptures()
 {
-    VkBufferCreateInfo bufferInfo;
-    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-    bufferInfo.size = sizeof(vertices[0]) * vertices.size();
-    bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    WaitForFrame(frameNumber);
+    CollectCaptures();
 
-    if (vkCreateBuffer(vkLogDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
-        throw std::runtime_error("\nFailed to create vertex buffer!");
+    for (const auto &state : capture.states)
+        while (state == CaptureState::Encoding)
+            std::this_thread::yield();
 
-    VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(vkLogDevice, buffer, &memRequirements);
+    stats.capturesWritten = capture.written;
+}
 
-    VkMemoryAllocateInfo allocInfo;
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = FindMemoryType(
-        memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+#pragma endregion
 
-    if (vkAllocateMemory(vkLogDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS)
-        throw std::runtime_error("\nFailed to allocate vertex buffer memory!");
+#pragma region Profiling
 
-    vkBindBufferMemory(vkLogDevice, buffer, memory, 0);
+void Render::GetGpuProfiler(GpuProfiler &gpuProfiler)
+{
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(vkPhyDevice, &deviceProperties);
 
-    void *data;
-    vkMapMemory(vkLogDevice, memory, 0, bufferInfo.size, 0, &data);
-    memcpy(data, vertices.data(), (size_t)bufferInfo.size);
-    vkUnmapMemory(vkLogDevice, memory);
-}
+    u32 queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(vkPhyDevice, &queueFamilyCount, nullptr);
+    list<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(vkPhyDevice, &queueFamilyCount, queueFamilies.data());
 
-#pragma endregion
+    auto validBits = queueFamilies[vkPhyDeviceIndices.graphicsFamily.value()].timestampValidBits;
 
-#pragma region Commands
+    gpuProfiler.pools.assign(frames.size, VK_NULL_HANDLE);
+    gpuProfiler.scopes.assign(frames.size, {});
+    gpuProfiler.submitted.assign(frames.size, false);
+    gpuProfiler.period = deviceProperties.limits.timestampPeriod;
+    gpuProfiler.validMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+    gpuProfiler.enabled = validBits > 0;
 
-void Render::GetCommandPool(VkCommandPool &pool)
+    // The statistics query spans the whole primary, secondaries included
+
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(vkPhyDevice, &features);
+
+    gpuProfiler.statistics = features.pipelineStatisticsQuery && features.inheritedQueries;
+
+    if (gpuProfiler.statistics)
+    {
+        VkQueryPoolCreateInfo statisticsInfo{};
+        statisticsInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        statisticsInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        statisticsInfo.queryCount = 1;
+        statisticsInfo.pipelineStatistics = GpuProfiler::Statistics;
+
+        gpuProfiler.statisticsPools.assign(frames.size, VK_NULL_HANDLE);
+
+        for (auto &pool : gpuProfiler.statisticsPools)
+            if (vkCreateQueryPool(vkLogDevice, &statisticsInfo, nullptr, &pool) != VK_SUCCESS)
+                throw std::runtime_error("\nFailed to create pipeline statistics query pool!");
+    }
+
+    if (!gpuProfiler.enabled)
+    {
+        std::cout << "Graphics queue has no timestamp support, GPU timings are disabled" << std::endl;
+        return;
+    }
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = GpuProfiler::MaxScopes * 2;
+
+    for (auto &pool : gpuProfiler.pools)
+        if (vkCreateQueryPool(vkLogDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+            throw std::runtime_error("\nFailed to create timestamp query pool!");
+}
+
+// Recorded at the start of every primary, cached primaries reset their own
+// queries each time they are submitted again
+void Render::ResetGpuScopes(const VkCommandBuffer &buffer, u32 frame)
 {
-    VkCommandPoolCreateInfo poolInfo;
-    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    poolInfo.queueFamilyIndex =
-        vkPhyDeviceIndices.graphicsFamily.has_value() ? vkPhyDeviceIndices.graphicsFamily.value() : 0;
+    profiler.scopes[frame].clear();
 
-    if (vkCreateCommandPool(vkLogDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS)
-        throw std::runtime_error("\nFailed to create command pool!");
+    if (profiler.enabled)
+        vkCmdResetQueryPool(buffer, profiler.pools[frame], 0, GpuProfiler::MaxScopes * 2);
+
+    if (profiler.statistics)
+        vkCmdResetQueryPool(buffer, profiler.statisticsPools[frame], 0, 1);
 }
 
-void Render::PopulateFrames(FramesInFlight &framesInFlight)
+u32 Render::BeginGpuScope(const VkCommandBuffer &buffer, u32 frame, const str &name)
 {
-    VkCommandBufferAllocateInfo allocInfo;
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = vkCmdPool;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = framesInFlight.size;
+    auto &scopes = profiler.scopes[frame];
 
-    if (vkAllocateCommandBuffers(vkLogDevice, &allocInfo, framesInFlight.cmdBuffers.data()) != VK_SUCCESS)
-        throw std::runtime_error("\nFailed to allocate command buffers!");
+    if (!profiler.enabled || scopes.size() >= GpuProfiler::MaxScopes)
+        return GpuProfiler::MaxScopes;
 
-    VkSemaphoreCreateInfo semaphoreInfo;
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    auto scope = static_cast<u32>(scopes.size());
+    scopes.push_back(name);
 
-    VkFenceCreateInfo fenceInfo;
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler.pools[frame], scope * 2);
 
-    for (size_t i = 0; i < framesInFlight.size; i++)
-        if (vkCreateSemaphore(vkLogDevice, &semaphoreInfo, nullptr, &framesInFlight.imgSemaphores[i]) != VK_SUCCESS ||
-            vkCreateSemaphore(vkLogDevice, &semaphoreInfo, nullptr, &framesInFlight.rndSemaphores[i]) != VK_SUCCESS ||
-            vkCreateFence(vkLogDevice, &fenceInfo, nullptr, &framesInFlight.fences[i]) != VK_SUCCESS)
-            throw std::runtime_error("\nFailed to create synchronization objects for a frame!");
+    return scope;
 }
 
-void Render::RecordCommandBuffer(const VkCommandBuffer &buffer, u32 idx)
+void Render::EndGpuScope(const VkCommandBuffer &buffer, u32 frame, u32 scope)
 {
-    VkCommandBufferBeginInfo beginInfo;
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = 0;                  // Optional
-    beginInfo.pInheritanceInfo = nullptr; // Optional
+    if (scope >= GpuProfiler::MaxScopes)
+        return;
 
-    if (vkBeginCommandBuffer(buffer, &beginInfo) != VK_SUCCESS)
-        throw std::runtime_error("\nFailed to begin recording command buffer!");
+    vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, profiler.pools[frame], scope * 2 + 1);
+}
 
-    VkRenderPassBeginInfo renderPassInfo;
-    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = vkRenderPass;
-    renderPassInfo.framebuffer = vkFramesBuffer[idx];
-    renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = vkSwapChainExtent;
+// Called once the frame fence is signaled, the queries are complete by then
+void Render::ReadGpuTimings(u32 frame)
+{
+    const auto &scopes = profiler.scopes[frame];
 
-    VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
+    if (profiler.statistics && profiler.submitted[frame])
+    {
+        // Results come in statistic bit order
+        arr<u64, 2> counters{};
 
-    vkCmdBeginRenderPass(buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        if (vkGetQueryPoolResults(vkLogDevice, profiler.statisticsPools[frame], 0, 1, sizeof(counters),
+                                  counters.data(), sizeof(counters), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+        {
+            stats.primitives = counters[0];
+            stats.fragmentInvocations = counters[1];
+        }
+    }
 
-    vkCmdBindPipeline(buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vkPipe);
+    if (!profiler.enabled || !profiler.submitted[frame] || scopes.empty())
+        return;
 
-    VkBuffer vertexBuffers[] = {vkVertexBuffer};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(buffer, 0, 1, vertexBuffers, offsets);
+    arr<u64, GpuProfiler::MaxScopes * 2> ticks{};
+    auto queryCount = static_cast<u32>(scopes.size() * 2);
 
-    VkViewport viewport;
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = static_cast<float>(vkSwapChainExtent.width);
-    viewport.height = static_cast<float>(vkSwapChainExtent.height);
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
-    vkCmdSetViewport(buffer, 0, 1, &viewport);
+    auto result = vkGetQueryPoolResults(vkLogDevice, profiler.pools[frame], 0, queryCount, sizeof(u64) * queryCount,
+                                        ticks.data(), sizeof(u64), VK_QUERY_RESULT_64_BIT);
 
-    VkRect2D scissor;
-    scissor.offset = {0, 0};
-    scissor.extent = vkSwapChainExtent;
-    vkCmdSetScissor(buffer, 0, 1, &scissor);
+    if (result != VK_SUCCESS)
+        return;
 
-    vkCmdDraw(buffer, static_cast<u32>(vertices.size()), 1, 0, 0);
-    vkCmdEndRenderPass(buffer);
+    auto toMs = [&](u64 begin, u64 end) {
+        return static_cast<double>((end - begin) & profiler.validMask) * profiler.period / 1e6;
+    };
 
-    if (vkEndCommandBuffer(buffer) != VK_SUCCESS)
-        throw std::runtime_error("\nFailed to record command buffer!");
+    stats.gpuScopes.resize(scopes.size());
+
+    for (size_t i = 0; i < scopes.size(); i++)
+    {
+        stats.gpuScopes[i].name = scopes[i];
+        stats.gpuScopes[i].ms = toMs(ticks[i * 2], ticks[i * 2 + 1]);
+    }
+
+    stats.gpuFrameMs = toMs(ticks[0], ticks[queryCount - 1]);
 }
 
 #pragma endregion
@@ -1141,6 +5508,76 @@ u32 Render::FindMemoryType(const u32 &typeFilter, const VkMemoryPropertyFlags &f
     throw std::runtime_error("\nFailed to find suitable memory type!");
 }
 
+void Render::CreateImage(u32 width, u32 height, VkFormat format, VkImageUsageFlags usage, VkImage &image,
+                         VkDeviceMemory &memory)
+{
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent = {width, height, 1};
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = usage;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateImage(vkLogDevice, &imageInfo, nullptr, &image) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create image!");
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(vkLogDevice, image, &memRequirements);
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memRequirements.size;
+    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+    if (vkAllocateMemory(vkLogDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate image memory!");
+
+    vkBindImageMemory(vkLogDevice, image, memory, 0);
+}
+
+// Shared buffers are read or written by the compute queue as well, concurrent
+// sharing saves ownership transfers on data touched every frame
+void Render::CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags flags, VkBuffer &buffer,
+                          VkDeviceMemory &memory, bool shared)
+{
+    u32 families[] = {vkPhyDeviceIndices.graphicsFamily.value_or(0), vkPhyDeviceIndices.computeFamily.value_or(0)};
+
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (shared && vkPhyDeviceIndices.computeFamily.has_value())
+    {
+        bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        bufferInfo.queueFamilyIndexCount = 2;
+        bufferInfo.pQueueFamilyIndices = families;
+    }
+
+    if (vkCreateBuffer(vkLogDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to create buffer!");
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(vkLogDevice, buffer, &memRequirements);
+
+    VkMemoryAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = memRequirements.size;
+    allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, flags);
+
+    if (vkAllocateMemory(vkLogDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+        throw std::runtime_error("\nFailed to allocate buffer memory!");
+
+    vkBindBufferMemory(vkLogDevice, buffer, memory, 0);
+}
+
 #pragma endregion
 
 void Render::OnWindowResize(GLFWwindow *window, int width, int height)
@@ -1159,3 +5596,171 @@ GLFWwindow *Render::GetWindow()
 {
     return window;
 }
+
+const RenderStats &Render::GetStats()
+{
+    return stats;
+}
+
+u64 Render::GetFrameNumber() const
+{
+    return frameNumber;
+}
+
+void Render::SetOffscreen(bool enabled)
+{
+    offscreen = enabled;
+}
+
+// One frame in flight serializes CPU and GPU, more hide latency spikes at
+// the cost of input latency and memory
+void Render::SetFramesInFlight(u32 count)
+{
+    frames = FramesInFlight(std::clamp(count, 1u, FramesInFlight::MaxSize));
+}
+
+// Frames in flight keep the old pipelines and vertices until they complete,
+// draws of the mesh buffer move over to the new ones
+void Render::SetVertexPacking(VertexPacking packing)
+{
+    if (packing == vertexPacking)
+        return;
+
+    vertexPacking = packing;
+
+    if (!vkLogDevice)
+        return;
+
+    // The pipelines of the old packing stay cached for switching back
+
+    Retire([this, buffer = vkVertexBuffer, memory = vkVertexMemory]() {
+        vkDestroyBuffer(vkLogDevice, buffer, nullptr);
+        vkFreeMemory(vkLogDevice, memory, nullptr);
+    });
+
+    auto oldPipe = vkPipe;
+    auto oldBuffer = vkVertexBuffer;
+
+    GetPipeline(vkPipe, vkPipeEqual, vkPrepassPipe, vkSpritePipe);
+    GetVertexBuffer(vkVertexBuffer, vkVertexMemory);
+
+    for (auto &draw : drawList)
+    {
+        if (draw.pipelineEntry == NoPipelineEntry && draw.pipeline == oldPipe)
+            draw.pipeline = vkPipe;
+
+        if (draw.vertexBuffer != oldBuffer)
+            continue;
+
+        draw.vertexBuffer = vkVertexBuffer;
+
+        // Variants reading the pool follow its packing
+        if (draw.pipelineEntry != NoPipelineEntry)
+        {
+            auto key = pipelineCache.entries[draw.pipelineEntry].key;
+            key.vertexLayout = packing;
+            SetDrawPipeline(draw, key);
+        }
+    }
+}
+
+bool Render::IsOffscreen() const
+{
+    return offscreen;
+}
+
+// Meant for checks rather than frames, copies the last rendered frame back
+// and waits for the copy
+Image Render::CaptureOffscreen()
+{
+    if (!offscreen)
+        throw std::runtime_error("\nCapture requires the offscreen target!");
+
+    // Ordered after the last frame on the queue, the barrier covers its writes
+
+    auto width = vkSwapChainExtent.width;
+    auto height = vkSwapChainExtent.height;
+    auto buffer = BeginSingleTimeCommands();
+
+    VkImageMemoryBarrier imageBarrier{};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = offscreenTarget.image;
+    imageBarrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &imageBarrier);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {width, height, 1};
+
+    vkCmdCopyImageToBuffer(buffer, offscreenTarget.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           offscreenTarget.readback, 1, &region);
+
+    VkBufferMemoryBarrier bufferBarrier{};
+    bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferBarrier.buffer = offscreenTarget.readback;
+    bufferBarrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                         &bufferBarrier, 0, nullptr);
+
+    EndSingleTimeCommands(buffer, true);
+
+    auto image = Image(width, height);
+
+    void *data;
+    vkMapMemory(vkLogDevice, offscreenTarget.readbackMemory, 0, VK_WHOLE_SIZE, 0, &data);
+    memcpy(image.pixels.data(), data, image.pixels.size());
+    vkUnmapMemory(vkLogDevice, offscreenTarget.readbackMemory);
+
+    return image;
+}
+
+void Render::MarkDirty()
+{
+    stateVersion++;
+}
+
+void Render::SetDepthPrepass(bool enabled)
+{
+    depthPrepass = enabled;
+    MarkDirty();
+}
+
+void Render::SetLodThreshold(float pixels)
+{
+    lodThreshold = std::max(pixels, 0.f);
+}
+
+void Render::SetDepthSorting(bool enabled)
+{
+    depthSorting = enabled;
+    MarkDirty();
+}
+
+// Bounds are kept within (0, 1], the scene target is only as large as the swapchain
+void Render::SetDynamicResolution(double budgetMs, float minScale, float maxScale)
+{
+    scene.maxScale = std::clamp(maxScale, 0.1f, 1.f);
+    scene.minScale = std::clamp(minScale, 0.1f, scene.maxScale);
+    scene.budgetMs = std::max(0., budgetMs);
+    scene.cooldown = 0;
+
+    SetRenderScale(scene.maxScale);
+}
+
+void Render::SetCamera(const glm::mat4 &viewProj)
+{
+    cameraViewProj = viewProj;
+}
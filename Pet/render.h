@@ -1,47 +1,148 @@
 #pragma once
 
+#include "bvh.h"
 #include "core.h"
+#include "image.h"
+#include "rendergraph.h"
+#include "renderqueue.h"
+#include "taskgraph.h"
+#include "vertexlayout.h"
 
 #include "shaderc/shaderc.hpp"
 
-
 struct Vertex
 {
 	glm::vec2 pos;
 	glm::vec3 color;
+	glm::vec2 uv;
 
-    static VkVertexInputBindingDescription GetBindingDescription()
-    {
-        VkVertexInputBindingDescription desc;
-        desc.binding = 0;
-        desc.stride = sizeof(Vertex);
-        desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-        return desc;
-    }
+    using Layout = VertexLayouts::Float; // as laid out in memory, sprites use it directly
+};
 
-    static arr<VkVertexInputAttributeDescription, 2> GetAttributeDescriptions()
-    {
-        arr<VkVertexInputAttributeDescription, 2> desc{};
-        desc[0].binding = 0;
-        desc[0].location = 0;
-        desc[0].format = VK_FORMAT_R32G32_SFLOAT;
-        desc[0].offset = offsetof(Vertex, pos);
-        desc[1].binding = 0;
-        desc[1].location = 1;
-        desc[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-        desc[1].offset = offsetof(Vertex, color);
-        return desc;
-    }
+static_assert(sizeof(Vertex) == Vertex::Layout::stride, "Vertex must match its layout");
+
+// Layout the mesh vertices are stored with on the GPU
+enum class VertexPacking
+{
+    Float, // VertexLayouts::Float
+    Half,  // VertexLayouts::Half
+    Snorm, // VertexLayouts::Snorm, positions in [-1, 1] and uvs in [0, 1] only
+};
+
+// Pipeline input of a packing plus the function converting vertices to it
+struct VertexInput
+{
+    VkVertexInputBindingDescription binding{};
+    list<VkVertexInputAttributeDescription> attributes;
+    bool (*pack)(const Vertex &vertex, u8 *out) = nullptr; // false when a value was clamped
+
+    static VertexInput Of(VertexPacking packing);
+};
+
+enum class PipelineBlend : u8
+{
+    Opaque,
+    Alpha, // straight alpha over what is already there
+};
+
+// Material features a pipeline variant is specialized for, bit i feeds the
+// boolean specialization constant with constant_id i. Branches on them
+// compile out instead of running per fragment.
+namespace ShaderFeature
+{
+
+constexpr u32 Texture = 1 << 0;     // sample the material texture
+constexpr u32 VertexColor = 1 << 1; // multiply by the vertex color and draw tint
+constexpr u32 AlphaTest = 1 << 2;   // discard fragments under half alpha
+constexpr u32 Count = 3;
+constexpr u32 Default = Texture | VertexColor;
+
+} // namespace ShaderFeature
+
+// Everything a graphics pipeline is built from, viewport and scissor are
+// dynamic. Pipelines are cached by it.
+struct PipelineKey
+{
+    str vertexShader = "shaders/shader.vert";
+    str fragmentShader = "shaders/shader.frag"; // empty for depth only passes
+    VkPipelineLayout layout{};                  // null for the shared draw layout
+    bool vertexBuffer = true;                   // false when the shader builds its own vertices
+    VertexPacking vertexLayout = VertexPacking::Float;
+    PipelineBlend blend = PipelineBlend::Opaque;
+    VkCompareOp depthCompare = VK_COMPARE_OP_LESS_OR_EQUAL;
+    bool depthWrite = true;
+    VkCullModeFlags cullMode = VK_CULL_MODE_BACK_BIT;
+    VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    VkRenderPass renderPass{};
+    u32 features = ShaderFeature::Default;
+
+    bool operator==(const PipelineKey &other) const;
+};
+
+struct PipelineKeyHash
+{
+    size_t operator()(const PipelineKey &key) const;
+};
+
+struct PipelineEntry
+{
+    PipelineKey key;
+    VkPipeline pipe{};     // null while a pool job compiles it
+    VkPipeline fallback{}; // drawn with until then
+    double buildMs = 0.;
+};
+
+constexpr u32 NoPipelineEntry = 0xFFFFFFFF;
+
+// A variant waiting for the compile thread, its modules looked up already
+struct PipelineJob
+{
+    u32 id = 0; // entry index
+    PipelineKey key;
+    VkShaderModule vertModule{};
+    VkShaderModule fragModule{};
+};
+
+// Every pipeline ever built, kept until exit so switching back to a state
+// costs nothing. Entries never move their index, draws refer to them by it.
+// Variants compile one at a time on a thread of their own, so the pool's
+// per-frame jobs never queue behind them. The thread only appends to
+// finished, Run moves those into the entries.
+struct PipelineCache
+{
+    VkPipelineCache vkCache{}; // driver side, safe to share between threads
+    list<PipelineEntry> entries;
+    dic<PipelineKey, u32, PipelineKeyHash> lookup;
+    std::thread compiler;
+    std::mutex mutex;
+    std::condition_variable cond;                 // jobs queued or shutdown
+    std::condition_variable built;                // a job finished
+    std::queue<PipelineJob> jobs;                 // guarded by mutex
+    list<std::pair<u32, PipelineEntry>> finished; // guarded by mutex, entry index and what the job built
+    std::exception_ptr error;                     // guarded by mutex, first failed build, rethrown on collect
+    bool shutdown = false;                        // guarded by mutex, set once the jobs are done
+    std::atomic<u32> compiling{0};
 };
 
 struct QueueFamilyIndices
 {
     opt<uint32_t> graphicsFamily;
     opt<uint32_t> presentFamily;
+    opt<uint32_t> transferFamily; // dedicated only, uploads use graphics otherwise
+    opt<uint32_t> computeFamily;  // dedicated only, culling uses graphics otherwise
+    u32 transferQueue = 0;        // 1 when transfer shares the compute family
 
     bool IsComplete() const;
 };
 
+// Submissions to a queue other than graphics, the n-th one signals n and the
+// frame consuming its results waits for that value
+struct QueueTimeline
+{
+    VkSemaphore semaphore{};
+    u64 value = 0;
+};
+
 struct SwapChainSupportDetails
 {
     VkSurfaceCapabilitiesKHR capabilities{};
@@ -49,22 +150,444 @@ struct SwapChainSupportDetails
     list<VkPresentModeKHR> presentModes;
 };
 
+struct DrawCall
+{
+    VkPipeline pipeline{};
+    VkBuffer vertexBuffer{};
+    VkBuffer indexBuffer{};
+    u32 indexCount = 0;
+    u32 firstIndex = 0;
+    i32 vertexOffset = 0;
+    glm::mat4 model = glm::mat4(1.f);  // per draw, goes through the uniform ring
+    glm::vec4 tint = glm::vec4(1.f);   // per draw, goes through push constants
+    u32 objectIndex = 0;               // slot of the model in this frame's ring region
+    u32 material = 0;                  // slot in the bindless material buffer
+    u32 mesh = 0;                      // slot in the mesh table, its sphere bounds the draw
+    u32 pass = 0;                      // coarse ordering, lower passes are recorded first
+    u32 lod = 0;                       // level drawn last frame, mesh pool draws only
+    u32 pipelineEntry = NoPipelineEntry; // cached variant drawn once compiled, pipeline until then
+};
+
+struct CameraData
+{
+    glm::mat4 viewProj = glm::mat4(1.f);
+    arr<glm::vec4, 6> frustum{}; // xyz normal, w distance, pointing inwards
+    glm::vec4 lod = glm::vec4(0.f); // x pixels per unit at w = 1, y threshold in pixels, z hysteresis
+};
+
+struct ObjectData
+{
+    glm::mat4 model = glm::mat4(1.f);
+};
+
+constexpr u32 MaxMeshLods = 4;
+
+// Range of the shared index buffer drawn at one level of detail, std430
+struct MeshLod
+{
+    u32 indexCount = 0;
+    u32 firstIndex = 0;
+    float error = 0.f; // farthest a vertex moved from full detail, in mesh units
+    u32 padding = 0;
+};
+
+// Vertex range plus its local bounding sphere and LOD chain, std430. Level 0
+// is full detail, every level indexes the same vertices.
+struct MeshData
+{
+    i32 vertexOffset = 0;
+    u32 lodCount = 1;
+    u32 padding[2] = {};
+    glm::vec4 sphere = glm::vec4(0.f); // xyz center, w radius
+    arr<MeshLod, MaxMeshLods> lods{};
+};
+
+// GPU driven instance, culled and drawn without CPU involvement, std430
+struct InstanceData
+{
+    glm::mat4 model = glm::mat4(1.f);
+    u32 mesh = 0;
+    u32 material = 0;
+    u32 padding[2] = {};
+};
+
+// Per frame outputs of the culling dispatch, consumed by the indirect draw
+struct GpuCulling
+{
+    VkDescriptorSetLayout layout{};
+    VkPipelineLayout pipeLayout{};
+    VkPipeline pipe{};
+    VkDescriptorPool pool{};
+    list<VkDescriptorSet> sets;
+    list<VkBuffer> commandBuffers; // VkDrawIndexedIndirectCommand per visible instance
+    list<VkDeviceMemory> commandMemories;
+    list<VkBuffer> countBuffers; // visible instance count
+    list<VkDeviceMemory> countMemories;
+    VkBuffer lodBuffer{}; // level each instance was drawn with last, kept across frames
+    VkDeviceMemory lodMemory{};
+    bool async = false;                  // dispatched on the compute queue
+    list<VkCommandBuffer> asyncCommands; // per frame, compute queue only
+};
+
+// Where and how the GPU particles spawn, world units and seconds
+struct ParticleEmitter
+{
+    glm::vec3 position = glm::vec3(0.f);
+    float radius = 0.05f; // particles spawn anywhere inside this sphere
+    glm::vec3 velocity = glm::vec3(0.f, -0.5f, 0.f);
+    float spread = 0.25f; // random speed added in any direction
+    glm::vec3 gravity = glm::vec3(0.f, 0.5f, 0.f);
+    float lifetime = 2.f; // particles live between half and all of it
+    glm::vec4 color = glm::vec4(1.f, 0.6f, 0.2f, 1.f); // fades out over the lifetime
+    float rate = 0.f;     // per second, 0 stops emitting
+    float size = 0.005f;  // half extent of the quads
+};
+
+// Per frame inputs of the particle passes, pushed to the uniform ring after
+// the camera, std140 mirrored in particle.comp and particle.vert
+struct ParticleParams
+{
+    glm::vec4 position = glm::vec4(0.f); // xyz emitter, w spawn radius
+    glm::vec4 velocity = glm::vec4(0.f); // xyz base velocity, w spread
+    glm::vec4 gravity = glm::vec4(0.f);  // xyz acceleration, w lifetime
+    glm::vec4 color = glm::vec4(1.f);
+    float dt = 0.f;
+    u32 emitCount = 0; // requested, the GPU clamps it to the dead particles
+    u32 seed = 0;
+    float size = 0.f;
+};
+
+// GPU side counters, std430. Also the indirect argument buffer of the emit
+// and simulate dispatches and of the draw, which is why the CPU never reads it.
+struct ParticleState
+{
+    u32 current = 0;   // alive list the draw reads, the simulation writes the other
+    u32 emitCount = 0; // clamped this frame
+    u32 deadCount = 0;
+    u32 padding = 0;
+    arr<u32, 2> aliveCounts{};
+    u32 padding1[2] = {};
+    VkDispatchIndirectCommand emitArgs{};
+    u32 padding2 = 0;
+    VkDispatchIndirectCommand simulateArgs{};
+    u32 padding3 = 0;
+    VkDrawIndirectCommand drawArgs{};
+};
+
+// Passes of particle.comp, picked by its STAGE specialization constant
+namespace ParticleStage
+{
+
+constexpr u32 Reset = 0;    // every particle dead, once per capacity change
+constexpr u32 Prepare = 1;  // clamps the emission and writes the dispatch sizes
+constexpr u32 Emit = 2;     // pops dead particles onto the current alive list
+constexpr u32 Simulate = 3; // moves survivors to the other list, the rest back to the dead list
+constexpr u32 Finish = 4;   // flips the lists and writes the draw instance count
+constexpr u32 Count = 5;
+
+constexpr u32 GroupSize = 64; // local_size_x, one particle per invocation
+
+} // namespace ParticleStage
+
+// Emission, simulation and compaction all run on the GPU against a dead list
+// of free particle slots and two alive lists that swap every frame. Nothing
+// is read back, the counters drive indirect dispatches and one instanced draw.
+// Shared by every frame in flight, frames run the passes in submission order.
+struct ParticleSystem
+{
+    u32 capacity = 0; // nothing is recorded while 0
+    VkDescriptorSetLayout layout{};
+    VkPipelineLayout pipeLayout{}; // compute passes and the draw
+    arr<VkPipeline, ParticleStage::Count> stages{};
+    VkPipeline drawPipe{}; // owned by the pipeline cache
+    VkDescriptorPool pool{};
+    VkDescriptorSet set{};
+    VkBuffer particleBuffer{}; // position and age, velocity and lifetime, color
+    VkDeviceMemory particleMemory{};
+    VkBuffer stateBuffer{}; // ParticleState
+    VkDeviceMemory stateMemory{};
+    VkBuffer deadBuffer{}; // free slots, a stack of deadCount entries
+    VkDeviceMemory deadMemory{};
+    VkBuffer aliveBuffer{}; // two lists of capacity entries
+    VkDeviceMemory aliveMemory{};
+    VkDeviceSize paramsOffset = 0;
+    ParticleEmitter emitter;
+    float emitCarry = 0.f; // fraction of a particle left over from the last frame
+    u64 lastUpdate = 0; // Input::Now of the last update
+    u32 seed = 0;       // App::GetSeed when the capacity was set, then one per frame
+};
+
+// Rendered into instead of the swapchain, with a host visible buffer the
+// finished frame is copied into for inspection
+struct OffscreenTarget
+{
+    VkImage image{};
+    VkDeviceMemory memory{};
+    VkBuffer readback{};
+    VkDeviceMemory readbackMemory{};
+};
+
+enum class CaptureState : u8
+{
+    Free,
+    Copying,  // copy submitted with a frame, waiting for that frame to complete
+    Encoding, // handed to a pool job, freed by the job
+};
+
+// Host visible copies of rendered frames. A slot is filled by a copy submitted
+// with its frame and collected once the GPU has completed that frame,
+// then a pool job converts the pixels and hands them to the sink. Frames that
+// find every slot busy are dropped rather than waited for. A slot smaller than
+// the swapchain grows the next time it is claimed, it holds nothing by then.
+struct CaptureRing
+{
+    static constexpr u32 Size = 4;
+
+    list<VkBuffer> buffers;
+    list<VkDeviceMemory> memories;
+    list<u8 *> mapped;
+    list<VkDeviceSize> sizes;
+    list<VkCommandBuffer> commands;
+    arr<std::atomic<CaptureState>, Size> states{};
+    arr<u64, Size> frameNumbers{}; // frame the copy was submitted with
+    arr<VkExtent2D, Size> extents{};
+    del<void(const Image &image, u64 frame)> sink;
+    u32 interval = 1;
+    bool active = false;
+    std::atomic<u32> written{0};
+    u32 dropped = 0;
+};
+
+// Depth attachment sized with the swapchain, the prepass renders into it
+// through its own framebuffer
+struct DepthTarget
+{
+    VkFormat format = VK_FORMAT_UNDEFINED;
+    VkImageAspectFlags aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+    VkImage image{};
+    VkDeviceMemory memory{};
+    VkImageView view{};
+    VkFramebuffer prepassFramebuffer{};
+};
+
+// Scene color the passes render into, upscaled to the swapchain image at the
+// end of the frame. Allocated for the largest scale, lower scales only shrink
+// the render area, so changing the resolution never reallocates.
+struct SceneTarget
+{
+    VkImage image{};
+    VkDeviceMemory memory{};
+    VkImageView view{};
+    VkFramebuffer framebuffer{};
+    VkExtent2D extent{}; // render area at the current scale
+    VkFilter filter = VK_FILTER_LINEAR;
+    float scale = 1.f;
+    float minScale = 0.5f;
+    float maxScale = 1.f;
+    double budgetMs = 0.; // GPU frame time aimed for, 0 keeps the scale fixed
+    u32 cooldown = 0;     // frames before the scale may change again
+};
+
+// Begin and end timestamps per scope, one query pool per frame in flight. A
+// slot is read right after its fence is waited on, so reading never stalls.
+struct GpuProfiler
+{
+    static constexpr u32 MaxScopes = 16;
+    static constexpr VkQueryPipelineStatisticFlags Statistics =
+        VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+    list<VkQueryPool> pools;
+    list<VkQueryPool> statisticsPools; // primitives and fragment shader invocations of the whole frame
+    bool statistics = false;           // pipeline statistics and inherited queries supported
+    list<list<str>> scopes; // names per frame slot, in record order
+    list<bool> submitted;   // slot holds queries of a submitted frame
+    double period = 0.;     // nanoseconds per tick
+    u64 validMask = 0;
+    bool enabled = false;
+};
+
+// objectIndex value telling the vertex shader to read InstanceData instead
+constexpr u32 GpuInstanced = 0xFFFFFFFF;
+
+// objectIndex value for batched sprites, already in world space with the
+// material in firstInstance
+constexpr u32 SpriteBatched = 0xFFFFFFFE;
+
+// Must stay within the 128 bytes every implementation guarantees
+struct DrawConstants
+{
+    glm::vec4 tint = glm::vec4(1.f);
+    u32 objectIndex = 0;
+    u32 materialIndex = 0;
+};
+
+// std430 layout, mirrored in shader.frag
+struct MaterialData
+{
+    glm::vec4 color = glm::vec4(1.f);
+    u32 textureIndex = 0;
+    u32 padding[3] = {};
+};
+
+struct Texture
+{
+    VkImage image{};
+    VkDeviceMemory memory{};
+    VkImageView view{};
+};
+
+// Host visible buffer split in one region per frame in flight. Each frame
+// bump allocates its constants from its own region, the region base is the
+// dynamic offset the descriptor set is bound with.
+struct UniformRing
+{
+    VkBuffer buffer{};
+    VkDeviceMemory memory{};
+    u8 *mapped = nullptr;
+    VkDeviceSize alignment = 0;  // dynamic offset alignment
+    VkDeviceSize regionSize = 0; // bytes owned by each frame in flight
+    VkDeviceSize base = 0;       // start of the current frame region
+    std::atomic<VkDeviceSize> head{0}; // bump offset inside the current region
+
+    void Begin(u32 frame);
+    VkDeviceSize Allocate(VkDeviceSize size, VkDeviceSize align);
+
+    // Returns the offset relative to the current region base
+    template <typename T> VkDeviceSize Push(const T &data, VkDeviceSize align = 16)
+    {
+        auto offset = Allocate(sizeof(T), align);
+        memcpy(mapped + base + offset, &data, sizeof(T));
+        return offset;
+    }
+};
+
+// Quad rotated about its center, in world units
+struct Sprite
+{
+    glm::vec2 position = glm::vec2(0.f); // center
+    glm::vec2 size = glm::vec2(1.f);
+    float rotation = 0.f;                          // radians
+    glm::vec4 uv = glm::vec4(0.f, 0.f, 1.f, 1.f); // min in xy, max in zw
+    glm::vec3 color = glm::vec3(1.f);
+    u32 material = 0;
+    u16 layer = 0; // layers draw in increasing order, inside a layer draws are grouped by material
+};
+
+// Host visible and persistently mapped. Sprites are appended from any thread
+// as four vertices in the current vertex region, the flush sorts them by
+// layer and material and writes their indices in that order plus one indirect
+// draw per material run, so the recorded commands never change. Vertices are
+// written before the frame slot is waited on, hence the extra vertex region:
+// the one being filled is never read by a frame in flight.
+struct SpriteRing
+{
+    static constexpr u32 MaxSprites = 1 << 18; // per frame
+    static constexpr u32 MaxRuns = 1 << 12;    // indirect draws per frame
+    static constexpr VkDeviceSize VertexRegionSize = MaxSprites * 4 * sizeof(Vertex);
+    static constexpr VkDeviceSize IndexRegionSize = MaxSprites * 6 * sizeof(u32);
+    static constexpr VkDeviceSize CommandRegionSize = MaxRuns * sizeof(VkDrawIndexedIndirectCommand) + 16;
+
+    VkBuffer buffer{};
+    VkDeviceMemory memory{};
+    u8 *mapped = nullptr;
+    u32 vertexRegions = 0;        // one more than the frames in flight
+    u32 region = 0;               // vertex region sprites are appended to
+    VkDeviceSize indexBase = 0;   // index region per frame in flight
+    VkDeviceSize commandBase = 0; // draw commands and draw count per frame in flight
+    std::atomic<u32> head{0};     // sprites appended since the last flush
+    list<u64> keys;               // sort key per appended sprite
+    bool recorded = false;        // the main pass holds the sprite draw
+
+    Vertex *Vertices(u32 sprite) const;
+    u32 *Indices(u32 frame) const;
+    VkDeviceSize CommandOffset(u32 frame) const;
+    VkDeviceSize CountOffset(u32 frame) const;
+};
+
+struct BindCounts
+{
+    u32 pipelines = 0;
+    u32 vertexBuffers = 0;
+    u32 indexBuffers = 0;
+    u32 draws = 0;
+
+    BindCounts &operator+=(const BindCounts &other)
+    {
+        pipelines += other.pipelines;
+        vertexBuffers += other.vertexBuffers;
+        indexBuffers += other.indexBuffers;
+        draws += other.draws;
+        return *this;
+    }
+};
+
+// Destroyed once every frame submitted before the retirement has completed
+struct RetiredObject
+{
+    u64 frame = 0; // frames submitted when the object was retired
+    del<void()> destroy;
+};
+
+struct GpuTiming
+{
+    str name;
+    double ms = 0.;
+};
+
+struct RenderStats
+{
+    u32 recordWorkers = 0;   // slices recorded in parallel last frame
+    double cpuRecordMs = 0.; // time spent recording last frame
+    bool reusedCommands = false; // last frame submitted cached command buffers
+    BindCounts binds;            // state changes in the submitted commands
+    list<GpuTiming> gpuScopes;   // GPU time per scope of the last completed frame
+    double gpuFrameMs = 0.;      // first to last timestamp of the last completed frame
+    u32 capturesWritten = 0;     // frames handed to the capture sink so far
+    u32 capturesDropped = 0;     // frames skipped because every capture slot was busy
+    RgStats graph;               // passes and barriers of the last recording
+    u32 swapChainRecreations = 0;
+    double recreateMs = 0.;      // cpu time of the last swapchain recreation
+    u32 retiredObjects = 0;      // objects waiting for the GPU to let go of them
+    double frameWaitMs = 0.;     // blocked on the GPU before the last frame could start
+    u64 fragmentInvocations = 0; // fragment shader invocations of the last completed frame
+    u64 primitives = 0;          // input assembly primitives of the last completed frame
+    float renderScale = 1.f;     // scene resolution relative to the swapchain
+    u32 scaleChanges = 0;        // resolution changes made by the frame time budget
+    u32 sprites = 0;             // sprites drawn last frame
+    u32 spriteDraws = 0;         // indirect draws they were batched into
+    u32 spritesDropped = 0;      // sprites past the ring capacity last frame
+    double spriteFlushMs = 0.;   // sorting and index writes of the last flush
+    u32 pipelines = 0;           // built and cached so far
+    u32 pipelinesCompiling = 0;  // variants still compiling on the compile thread
+};
+
 struct FramesInFlight
 {
-    list<VkCommandBuffer> cmdBuffers; // draw commands containers
-    list<VkSemaphore> imgSemaphores;  // image available
-    list<VkSemaphore> rndSemaphores;  // render finished
-    list<VkFence> fences;             // sync with cpu
+    list<list<VkCommandBuffer>> cmdBuffers;    // per swapchain image draw commands containers
+    list<list<u64>> cmdVersions;               // render state each primary was recorded against
+    list<list<VkCommandPool>> workerPools;     // per worker, reset when the slices are re-recorded
+    list<list<VkCommandBuffer>> workerBuffers; // per worker secondary draw commands
+    list<u64> workerVersions;                  // render state the secondaries were recorded against
+    list<u32> workerCounts;                    // secondaries the primaries must execute
+    list<VkSemaphore> imgSemaphores;           // image available, binary for the swapchain
+    list<VkSemaphore> rndSemaphores;           // render finished, binary for the swapchain
+    VkSemaphore timeline{};                    // sync with cpu, the n-th submitted frame signals n
     u32 current = 0;
     u32 size = 0;
 
+    static constexpr u32 MaxSize = 4;
+
     FramesInFlight() = default;
     FramesInFlight(const u32 &maxFramesInFlight = 2)
     {
         cmdBuffers.resize(maxFramesInFlight);
+        cmdVersions.resize(maxFramesInFlight);
+        workerPools.resize(maxFramesInFlight);
+        workerBuffers.resize(maxFramesInFlight);
+        workerVersions.resize(maxFramesInFlight);
+        workerCounts.resize(maxFramesInFlight);
         imgSemaphores.resize(maxFramesInFlight);
         rndSemaphores.resize(maxFramesInFlight);
-        fences.resize(maxFramesInFlight);
         size = maxFramesInFlight;
     }
 };
@@ -72,12 +595,73 @@ struct FramesInFlight
 class Render
 {
   public:
-    void Init();
+    // Adds the renderer startup to the graph, returns the task after which it
+    // is ready to run frames
+    u32 Init(TaskGraph &startup);
     void Run();
     void Exit();
 
     glm::i32vec2 GetWindowSize();
     GLFWwindow *GetWindow();
+    const RenderStats &GetStats();
+    u64 GetFrameNumber() const; // frames submitted so far
+
+    void MarkDirty();
+
+    void SetOffscreen(bool enabled); // before Init, no window, surface nor swapchain
+    void SetFramesInFlight(u32 count); // before Init, 1 to FramesInFlight::MaxSize
+
+    // Between frames, repacks the mesh vertices and rebuilds the pipelines
+    void SetVertexPacking(VertexPacking packing);
+
+    // Frames are numbered from 1 in submission order, 0 is always complete
+    u64 GetSubmittedFrame() const;
+    u64 GetCompletedFrame();
+    bool IsFrameComplete(u64 frame);
+    void WaitForFrame(u64 frame);
+    bool IsOffscreen() const;
+    Image CaptureOffscreen();
+
+    // The sink runs on pool threads, one call per captured frame
+    void StartCapture(const del<void(const Image &image, u64 frame)> &sink, u32 interval = 1);
+    void StopCapture();
+    void SetCamera(const glm::mat4 &viewProj);
+
+    u32 LoadTexture(const Image &image);
+    u32 LoadTexture(const str &path);
+    u32 CreateMaterial(const glm::vec4 &color, u32 texture = 0);
+    u32 AddInstance(u32 mesh, u32 material, const glm::mat4 &model);
+
+    // Appends the mesh to the pool with a generated LOD chain, between frames
+    u32 CreateMesh(const list<Vertex> &vertexData, const list<u32> &indexData);
+
+    // Largest simplification error in pixels a LOD may show, 0 keeps full detail
+    void SetLodThreshold(float pixels);
+
+    // Between frames, every particle starts dead. 0 turns the system off.
+    void SetParticleCapacity(u32 count);
+    void SetParticleEmitter(const ParticleEmitter &emitter);
+
+    // Any thread may append, but every call must have returned before Run
+    // starts on the main thread, e.g. by waiting for the jobs that draw.
+    // Returns false when the frame already holds SpriteRing::MaxSprites.
+    bool DrawSprite(const Sprite &sprite);
+
+    void BenchmarkRecording(u32 drawCount = 100000, u32 iterations = 20);
+    void BenchmarkResize(u32 frameCount = 300);
+    void BenchmarkOverdraw(u32 layers = 64, u32 frameCount = 30);
+    void BenchmarkSprites(u32 spriteCount = 200000, u32 frameCount = 120);
+    void BenchmarkVertexPacking(u32 gridSize = 1024, u32 frameCount = 60);
+    void BenchmarkLod(u32 count = 20000, u32 frameCount = 30);
+    void BenchmarkPipelineVariants(u32 frameCount = 120);
+    void BenchmarkParticles(u32 count = 1 << 20, u32 frameCount = 120);
+
+    void SetDepthPrepass(bool enabled);
+    void SetDepthSorting(bool enabled); // front to back, submission order otherwise
+
+    // Scales the scene resolution within the bounds so the GPU frame time
+    // stays under the budget, a budget of 0 renders at maxScale
+    void SetDynamicResolution(double budgetMs, float minScale = 0.5f, float maxScale = 1.f);
 
   private:
     GLFWwindow *window = nullptr;
@@ -96,6 +680,8 @@ class Render
     QueueFamilyIndices vkPhyDeviceIndices;
     VkDevice vkLogDevice{};
     VkQueue vkGraphicsQueue{};
+    VkQueue vkTransferQueue{}; // the graphics queue when there is no dedicated family
+    VkQueue vkComputeQueue{};  // the graphics queue when there is no dedicated family
     VkSurfaceKHR vkSurface{};
     VkSwapchainKHR vkCurSwapChain{};
     VkSwapchainKHR vkOldSwapChain{};
@@ -103,20 +689,97 @@ class Render
     VkFormat vkSwapChainImageFormat{};
     VkExtent2D vkSwapChainExtent{};
     list<VkImageView> vkImageViews;
-    list<VkFramebuffer> vkFramesBuffer;
+    DepthTarget depth;
+    SceneTarget scene;
     bool frameBufferResized = false;
+    bool swapChainStale = false; // recreation postponed while the window has no extent
+    list<RetiredObject> retired;
+    u64 completedFrames = 0; // last frame the GPU is known to have finished
     VkBuffer vkVertexBuffer{};
     VkDeviceMemory vkVertexMemory{};
+    VkBuffer vkIndexBuffer{};
+    VkDeviceMemory vkIndexMemory{};
+    VkBuffer vkMeshBuffer{};
+    VkDeviceMemory vkMeshMemory{};
+    list<MeshData> meshes;
+    MeshData *meshTable = nullptr; // mapped, append only like the instances
+    u32 maxMeshes = 1024;
+    list<Vertex> meshVertices; // pool contents, repacked whenever the buffers are rebuilt
+    list<u32> meshIndices;
+    float lodThreshold = 1.f;
+    static constexpr float LodHysteresis = 0.25f; // coarser levels must stay this far under the threshold
+    VkBuffer vkInstanceBuffer{};
+    VkDeviceMemory vkInstanceMemory{};
+    InstanceData *instances = nullptr;
+    u32 instanceCount = 0;
+    u32 maxInstances = 1 << 18;
+    GpuCulling culling;
+    ParticleSystem particles;
+    GpuProfiler profiler;
+    RenderGraph renderGraph;
+    bool offscreen = false;
+    OffscreenTarget offscreenTarget;
+    bool vkSwapChainReadable = false; // swapchain images allow transfer reads
+    CaptureRing capture;
+    u64 frameNumber = 0;
     VkRenderPass vkRenderPass{};
+    VkRenderPass vkRenderPassAfterPrepass{}; // loads the prepass depth instead of clearing it
+    VkRenderPass vkPrepassRenderPass{};
+    bool depthPrepass = false;
+    bool depthSorting = true;
+    VkDescriptorSetLayout vkDescriptorLayout{};
+    VkDescriptorPool vkDescriptorPool{};
+    VkDescriptorSet vkDescriptorSet{};
+    UniformRing uniforms;
+    VkDeviceSize uniformRegionSize = 4 * 1024 * 1024;
+    VkDeviceSize cameraOffset = 0;
+    glm::mat4 cameraViewProj = glm::mat4(1.f);
+    VkDescriptorSetLayout vkBindlessLayout{};
+    VkDescriptorPool vkBindlessPool{};
+    VkDescriptorSet vkBindlessSet{};
+    VkSampler vkSampler{};
+    list<Texture> textures;
+    u32 maxTextures = 4096;
+    VkBuffer vkMaterialBuffer{};
+    VkDeviceMemory vkMaterialMemory{};
+    MaterialData *materials = nullptr;
+    u32 materialCount = 0;
+    u32 maxMaterials = 4096;
     VkPipelineLayout vkPipeLayout{};
     VkPipeline vkPipe{};
+    VkPipeline vkPipeEqual{};   // vkPipe shading only what the prepass left visible
+    VkPipeline vkPrepassPipe{}; // depth only
+    VkPipeline vkSpritePipe{};  // alpha blended, no culling, no depth writes
+    PipelineCache pipelineCache;
+    SpriteRing sprites;
+    RenderQueue spriteQueue;
+    VertexPacking vertexPacking = VertexPacking::Float;
     VkCommandPool vkCmdPool{};
+    VkCommandPool vkTransferPool{};
+    VkCommandPool vkComputePool{};
+    QueueTimeline uploadTimeline;
+    QueueTimeline computeTimeline;
+    QueueTimeline readbackTimeline; // single time graphics work the host waits for
+    list<VkImageMemoryBarrier> uploadAcquires; // released by the transfer queue, acquired by the next frame
     FramesInFlight frames = FramesInFlight(2);
+    u32 recordWorkers = 1;
+    list<DrawCall> drawList;
+    list<Aabb> drawBounds;
+    Bvh drawBvh;
+    list<u32> visibleDraws; // draw list indices inside the camera frustum, in queue order
+    RenderQueue renderQueue;
+    dic<VkPipeline, u32> pipelineIds; // small ids for the sort keys
+    u64 stateVersion = 1; // bumped whenever recorded commands go stale
+    dic<str, list<char>> shaderCode; // SPIR-V by source path, loaded once
+    dic<str, VkShaderModule> shaderModules; // by SPIR-V bytes, identical code shares one module
+    RenderStats stats;
 
     const list<Vertex> vertices = {          //
-        {{0.0f, -0.5f}, {1.0f, 1.0f, 1.0f}},  //
-        {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},   //
-        {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}}}; //
+        {{0.0f, -0.5f}, {1.0f, 1.0f, 1.0f}, {0.5f, 0.0f}},  //
+        {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}, {1.0f, 1.0f}},   //
+        {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}}}; //
+
+    const list<u32> indices = {0, 1, 2};
 
     GLFWwindow *InitializeGLFW();
 
@@ -143,10 +806,11 @@ class Render
     void GetSurface(VkSurfaceKHR &surface);
 
     void GetMostSuitableDevice(VkPhysicalDevice &device);
-    u32 RateDevice(const VkPhysicalDevice &device);
+    u32 RateDevice(const VkPhysicalDevice &device, str &rejection);
     bool RateAvailableQueueFamilies(const VkPhysicalDevice &device);
     bool RateExtensionSupport(const VkPhysicalDevice &device);
     bool RateSwapChainDetails(const VkPhysicalDevice &device);
+    bool RateFeatureSupport(const VkPhysicalDevice &device);
 
     void GetAvailableQueuesFamilies(QueueFamilyIndices &indices, const VkPhysicalDevice &device);
 
@@ -154,9 +818,13 @@ class Render
 
     void GetLogicalDevice(VkDevice &device);
     void GetGraphicsQueue(VkQueue &queue);
+    void GetFamilyQueue(const opt<u32> &family, u32 index, VkQueue &queue);
 
     void GetSwapChain(VkSwapchainKHR *cur, VkSwapchainKHR *old = nullptr);
     void RecreateSwapChain();
+    void Retire(const del<void()> &destroy);
+    void RetireAfter(u64 frame, const del<void()> &destroy);
+    void DestroyRetired();
 
     SwapChainSupportDetails GetSwapChainSupportDetails(const VkPhysicalDevice &device);
     VkSurfaceFormatKHR ChooseSwapSurfaceFormat(const list<VkSurfaceFormatKHR> &availableFormats);
@@ -164,20 +832,113 @@ class Render
     VkExtent2D ChooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities);
 
     void GetImageViews(list<VkImageView> &views);
-
-    void GetRenderPass(VkRenderPass &pass);
-    void GetPipeline(VkPipeline &pipe, VkPipelineLayout &layout);
+    VkImageView CreateImageView(VkImage image, VkFormat format, VkImageAspectFlags aspect);
+    VkFormat FindDepthFormat();
+    void GetDepthTarget(DepthTarget &target);
+    void ReleaseDepthTarget(DepthTarget &target);
+
+    void GetRenderPass(VkRenderPass &pass, VkAttachmentLoadOp depthLoadOp);
+    void GetPrepassRenderPass(VkRenderPass &pass);
+    void GetDescriptorSetLayout(VkDescriptorSetLayout &layout);
+    void GetBindlessSetLayout(VkDescriptorSetLayout &layout);
+    void GetPipelineLayout(VkPipelineLayout &layout);
+    void GetPipelineCache(PipelineCache &cache);
+    void ReleasePipelineCache(PipelineCache &cache);
+    void GetPipeline(VkPipeline &pipe, VkPipeline &equalPipe, VkPipeline &prepassPipe, VkPipeline &spritePipe);
+    PipelineKey GetPipelineKey() const;
+    VkPipeline GetCachedPipeline(const PipelineKey &key);
+    u32 RequestPipeline(const PipelineKey &key, VkPipeline fallback);
+    void SetDrawPipeline(DrawCall &draw, const PipelineKey &key);
+    bool IsBlendedDraw(const DrawCall &draw) const;
+    bool IsPrepassDraw(const DrawCall &draw) const;
+    VkPipeline BuildPipeline(const PipelineKey &key, VkShaderModule vertModule, VkShaderModule fragModule);
+    void CompilePipelines();
+    void WaitForPipeline(u32 id);
+    void CollectPipelines();
 
     list<char> GenerateShader(const str& path, shaderc_shader_kind kind);
+    const list<char> &GetShaderCode(const str &path, shaderc_shader_kind kind);
     VkShaderModule GetShaderModule(const list<char> &shader);
+    VkShaderModule GetCachedShaderModule(const str &path, shaderc_shader_kind kind);
 
-    void GetFramesBuffer(list<VkFramebuffer> &buffer);
+    void GetSceneTarget(SceneTarget &target);
+    void ReleaseSceneTarget(SceneTarget &target);
+    void SetRenderScale(float scale);
+    void UpdateRenderScale();
+    list<u8> PackVertices(const list<Vertex> &source) const;
     void GetVertexBuffer(VkBuffer &buffer, VkDeviceMemory &memory);
+    void GetIndexBuffer(VkBuffer &buffer, VkDeviceMemory &memory);
+    void GetMeshBuffer(VkBuffer &buffer, VkDeviceMemory &memory);
+    u32 AddMesh(const list<Vertex> &vertexData, const list<u32> &indexData);
+    void GetInstanceBuffer(VkBuffer &buffer, VkDeviceMemory &memory);
+    void GetUniformRing(UniformRing &ring);
+    void GetSpriteRing(SpriteRing &ring);
+    void FlushSprites(u32 frame);
+    void RecordSprites(const VkCommandBuffer &buffer, u32 frame);
+    void GetDescriptorSet(VkDescriptorPool &pool, VkDescriptorSet &set);
+    void UpdateUniforms(u32 frame);
+
+    void GetTextureSampler(VkSampler &sampler);
+    void GetMaterialBuffer(VkBuffer &buffer, VkDeviceMemory &memory);
+    void GetBindlessSet(VkDescriptorPool &pool, VkDescriptorSet &set);
+
+    void GetCullingPipeline(GpuCulling &cull);
+    void GetCullingBuffers(GpuCulling &cull);
+    void GetAsyncCulling(GpuCulling &cull);
+    bool SubmitAsyncCulling(u32 frame);
+    void GetCullingSets(GpuCulling &cull);
+    void RecordCulling(const VkCommandBuffer &buffer, u32 frame);
+    void RecordIndirectDraws(const VkCommandBuffer &buffer, u32 frame, VkPipeline pipe);
+    void RecordDepthPrepass(const VkCommandBuffer &buffer, u32 frame);
+
+    void GetParticlePipelines(ParticleSystem &system);
+    void GetParticleBuffers(ParticleSystem &system);
+    void ReleaseParticleBuffers(ParticleSystem &system);
+    void UpdateParticles();
+    void RecordParticles(const VkCommandBuffer &buffer, u32 frame);
+    void RecordParticleDraw(const VkCommandBuffer &buffer, u32 frame);
+    void BuildRenderGraph(u32 idx, u32 workers);
+
+    void GetOffscreenTarget(OffscreenTarget &target);
+    list<const char *> GetDeviceExtensions() const;
+
+    void GetCaptureRing(CaptureRing &ring);
+    void ReleaseCaptureRing(CaptureRing &ring);
+    void GetCaptureSlot(CaptureRing &ring, u32 slot, VkDeviceSize size);
+    void ReleaseCaptureSlot(CaptureRing &ring, u32 slot);
+    VkCommandBuffer RecordCapture(u32 idx);
+    void CollectCaptures();
+    void FlushCaptures();
+
+    void GetGpuProfiler(GpuProfiler &profiler);
+    u32 BeginGpuScope(const VkCommandBuffer &buffer, u32 frame, const str &name);
+    void EndGpuScope(const VkCommandBuffer &buffer, u32 frame, u32 scope);
+    void ResetGpuScopes(const VkCommandBuffer &buffer, u32 frame);
+    void ReadGpuTimings(u32 frame);
 
     void GetCommandPool(VkCommandPool &pool);
+    void GetFamilyPool(const opt<u32> &family, VkCommandPool &pool);
+    void GetTimeline(VkSemaphore &semaphore);
+    VkCommandBuffer BeginSingleTimeCommands();
+    void EndSingleTimeCommands(VkCommandBuffer buffer, bool wait = false);
+    VkCommandBuffer BeginTransferCommands();
+    void EndTransferCommands(VkCommandBuffer buffer);
+    VkCommandBuffer RecordUploadAcquires();
+    void TransitionImageLayout(VkCommandBuffer buffer, VkImage image, VkImageLayout from, VkImageLayout to);
     void PopulateFrames(FramesInFlight &framesInFlight);
+    void GetFrameCommandBuffers(FramesInFlight &framesInFlight);
+
+    void GetWorkerPools(FramesInFlight &framesInFlight);
+    void PopulateDrawList(list<DrawCall> &draws);
+    void CullDrawList();
+    void SelectDrawLods();
+    u32 SelectLod(const MeshData &mesh, u32 current, float pixelsPerUnit) const;
+    float GetLodScale() const;
+    u32 GetPipelineId(VkPipeline pipeline);
 
     void RecordCommandBuffer(const VkCommandBuffer &buffer, u32 idx);
+    u32 RecordDrawSlices(u32 frame, u32 workers);
+    BindCounts RecordDrawSlice(u32 frame, u32 worker, size_t first, size_t count, bool last);
 
     //
 
@@ -189,6 +950,10 @@ class Render
                                                         void *pUserData);
 
     u32 FindMemoryType(const u32 &typeFilter, const VkMemoryPropertyFlags &flags);
+    void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags flags, VkBuffer &buffer,
+                      VkDeviceMemory &memory, bool shared = false);
+    void CreateImage(u32 width, u32 height, VkFormat format, VkImageUsageFlags usage, VkImage &image,
+                     VkDeviceMemory &memory);
 
     void VkCleanup();
     void VkCleanupSwapChain();
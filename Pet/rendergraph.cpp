@@ -0,0 +1,281 @@
+#include "rendergraph.h"
+
+constexpr VkAccessFlags WriteAccess = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                                      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT |
+                                      VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+RgPass &RgPass::Use(RgResource resource, const RgAccess &access)
+{
+    uses.push_back({resource, access});
+    return *this;
+}
+
+RgPass &RgPass::Execute(const del<void(VkCommandBuffer buffer)> &fn)
+{
+    execute = fn;
+    return *this;
+}
+
+RgPass &RgPass::KeepAlive()
+{
+    sideEffects = true;
+    return *this;
+}
+
+#pragma region Build
+
+void RenderGraph::Reset()
+{
+    resources.clear();
+    passes.clear();
+    alive.clear();
+    passBarriers.clear();
+    finalBarriers = {};
+}
+
+RgResource RenderGraph::ImportImage(const str &name, VkImage image, VkImageAspectFlags aspect, const RgAccess &initial,
+                                    const opt<RgAccess> &final)
+{
+    Resource resource;
+    resource.name = name;
+    resource.image = image;
+    resource.aspect = aspect;
+    resource.final = final;
+
+    // Whatever happened before the graph counts as the last write
+    resource.state.writeStages = initial.stages;
+    resource.state.writeAccess = initial.access;
+    resource.state.layout = initial.layout;
+
+    resources.push_back(resource);
+
+    return static_cast<RgResource>(resources.size() - 1);
+}
+
+RgResource RenderGraph::ImportBuffer(const str &name, VkBuffer buffer)
+{
+    Resource resource;
+    resource.name = name;
+    resource.buffer = buffer;
+
+    resources.push_back(resource);
+
+    return static_cast<RgResource>(resources.size() - 1);
+}
+
+RgPass &RenderGraph::AddPass(const str &name)
+{
+    passes.push_back({});
+    passes.back().name = name;
+
+    return passes.back();
+}
+
+#pragma endregion
+
+#pragma region Compile
+
+void RenderGraph::Compile()
+{
+    CullPasses();
+
+    // Lifetimes over the surviving passes
+
+    for (auto &resource : resources)
+    {
+        resource.firstPass = None;
+        resource.lastPass = 0;
+    }
+
+    for (u32 pass = 0; pass < passes.size(); pass++)
+    {
+        if (!alive[pass])
+            continue;
+
+        for (const auto &[id, access] : passes[pass].uses)
+        {
+            resources[id].firstPass = std::min(resources[id].firstPass, pass);
+            resources[id].lastPass = std::max(resources[id].lastPass, pass);
+        }
+    }
+
+    // Barriers, batched into one call before each pass
+
+    stats = {};
+    stats.passes = static_cast<u32>(passes.size());
+    passBarriers.assign(passes.size(), {});
+
+    for (u32 pass = 0; pass < passes.size(); pass++)
+    {
+        if (!alive[pass])
+        {
+            stats.culledPasses++;
+            continue;
+        }
+
+        for (const auto &[id, access] : passes[pass].uses)
+            AddBarrier(passBarriers[pass], resources[id], access);
+    }
+
+    finalBarriers = {};
+
+    for (auto &resource : resources)
+        if (resource.final && resource.firstPass != None)
+            AddBarrier(finalBarriers, resource, *resource.final);
+
+    for (const auto &barriers : passBarriers)
+        stats.barriers += static_cast<u32>(barriers.images.size() + barriers.buffers.size());
+
+    stats.barriers += static_cast<u32>(finalBarriers.images.size() + finalBarriers.buffers.size());
+}
+
+// Walks back from the outputs, a pass survives when it writes something that
+// is presented, read by a surviving pass, or when it is marked as kept
+void RenderGraph::CullPasses()
+{
+    alive.assign(passes.size(), false);
+
+    auto needed = list<bool>(resources.size(), false);
+
+    for (u32 id = 0; id < resources.size(); id++)
+        needed[id] = resources[id].final.has_value();
+
+    for (auto pass = static_cast<i64>(passes.size()) - 1; pass >= 0; pass--)
+    {
+        auto keep = passes[pass].sideEffects;
+
+        for (const auto &[id, access] : passes[pass].uses)
+            keep |= (access.access & WriteAccess) && needed[id];
+
+        if (!keep)
+            continue;
+
+        alive[pass] = true;
+
+        for (const auto &[id, access] : passes[pass].uses)
+            if (access.access & ~WriteAccess)
+                needed[id] = true;
+    }
+}
+
+// Reads after reads in the same layout need nothing. Reads wait on the last
+// write once per stage, writes wait on every earlier access, layout changes
+// always transition.
+void RenderGraph::AddBarrier(Barriers &barriers, Resource &resource, const RgAccess &access)
+{
+    auto &state = resource.state;
+    auto isImage = resource.buffer == VK_NULL_HANDLE;
+    auto isWrite = (access.access & WriteAccess) != 0;
+    auto transition = isImage && access.layout != state.layout;
+
+    VkPipelineStageFlags srcStages = 0;
+    VkAccessFlags srcAccess = 0;
+    auto needed = false;
+
+    if (isWrite || transition)
+    {
+        srcStages = state.writeStages | state.readStages;
+        srcAccess = state.writeAccess;
+        needed = transition || srcStages != 0;
+    }
+    else if (state.writeAccess != 0 &&
+             ((access.stages & ~state.visibleStages) != 0 || (access.access & ~state.visibleAccess) != 0))
+    {
+        srcStages = state.writeStages;
+        srcAccess = state.writeAccess;
+        needed = true;
+    }
+
+    if (needed)
+    {
+        barriers.srcStages |= srcStages != 0 ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        barriers.dstStages |= access.stages;
+
+        if (isImage)
+        {
+            VkImageMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            barrier.srcAccessMask = srcAccess;
+            barrier.dstAccessMask = access.access;
+            barrier.oldLayout = state.layout;
+            barrier.newLayout = access.layout;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = resource.image;
+            barrier.subresourceRange = {resource.aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS};
+            barriers.images.push_back(barrier);
+        }
+        else
+        {
+            VkBufferMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcAccessMask = srcAccess;
+            barrier.dstAccessMask = access.access;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.buffer = resource.buffer;
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+            barriers.buffers.push_back(barrier);
+        }
+    }
+
+    if (isWrite)
+    {
+        state.writeStages = access.stages;
+        state.writeAccess = access.access & WriteAccess;
+        state.readStages = 0;
+        state.visibleStages = 0;
+        state.visibleAccess = 0;
+    }
+    else
+    {
+        state.readStages |= access.stages;
+
+        if (needed)
+        {
+            state.visibleStages |= access.stages;
+            state.visibleAccess |= access.access;
+        }
+    }
+
+    if (isImage)
+        state.layout = access.layout;
+}
+
+#pragma endregion
+
+#pragma region Execute
+
+void RenderGraph::Execute(VkCommandBuffer buffer)
+{
+    for (size_t pass = 0; pass < passes.size(); pass++)
+    {
+        if (!alive[pass])
+            continue;
+
+        Submit(buffer, passBarriers[pass]);
+
+        if (passes[pass].execute)
+            passes[pass].execute(buffer);
+    }
+
+    Submit(buffer, finalBarriers);
+}
+
+void RenderGraph::Submit(VkCommandBuffer buffer, const Barriers &barriers)
+{
+    if (barriers.images.empty() && barriers.buffers.empty())
+        return;
+
+    vkCmdPipelineBarrier(buffer, barriers.srcStages, barriers.dstStages, 0, 0, nullptr,
+                         static_cast<u32>(barriers.buffers.size()), barriers.buffers.data(),
+                         static_cast<u32>(barriers.images.size()), barriers.images.data());
+}
+
+const RgStats &RenderGraph::GetStats() const
+{
+    return stats;
+}
+
+#pragma endregion
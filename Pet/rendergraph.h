@@ -0,0 +1,127 @@
+#pragma once
+
+#include "core.h"
+
+using RgResource = u32;
+
+// How a pass touches a resource. Whether it is a read or a write follows from
+// the access flags, layout is ignored for buffers.
+struct RgAccess
+{
+    VkPipelineStageFlags stages = 0;
+    VkAccessFlags access = 0;
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+namespace RgUsage
+{
+
+constexpr RgAccess ColorAttachment = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                                      VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+constexpr RgAccess DepthAttachment = {
+    VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL};
+constexpr RgAccess FragmentRead = {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+constexpr RgAccess ComputeRead = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                  VK_IMAGE_LAYOUT_GENERAL};
+constexpr RgAccess ComputeWrite = {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                   VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL};
+constexpr RgAccess TransferRead = {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL};
+constexpr RgAccess TransferWrite = {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL};
+constexpr RgAccess IndirectRead = {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                                   VK_IMAGE_LAYOUT_UNDEFINED};
+
+} // namespace RgUsage
+
+struct RgPass
+{
+    str name;
+    list<std::pair<RgResource, RgAccess>> uses;
+    del<void(VkCommandBuffer buffer)> execute;
+    bool sideEffects = false; // kept even if nothing reads its outputs
+
+    RgPass &Use(RgResource resource, const RgAccess &access);
+    RgPass &Execute(const del<void(VkCommandBuffer buffer)> &fn);
+    RgPass &KeepAlive();
+};
+
+struct RgStats
+{
+    u32 passes = 0;
+    u32 culledPasses = 0;
+    u32 barriers = 0; // image and buffer barriers per execution
+};
+
+// Frame graph rebuilt whenever commands are recorded. Passes declare what they
+// use, the graph drops passes whose results are never consumed and derives the
+// barriers and layout transitions between the remaining ones. Every resource
+// is imported, the renderer owns their memory. Passes run in declaration
+// order, which is a valid order since a pass can only consume earlier results.
+class RenderGraph
+{
+  public:
+    // Drops passes and resources
+    void Reset();
+
+    // Without a final state the image stays as its last pass left it
+    RgResource ImportImage(const str &name, VkImage image, VkImageAspectFlags aspect, const RgAccess &initial,
+                           const opt<RgAccess> &final = std::nullopt);
+    RgResource ImportBuffer(const str &name, VkBuffer buffer);
+
+    // The reference is valid until the next AddPass
+    RgPass &AddPass(const str &name);
+
+    void Compile();
+    void Execute(VkCommandBuffer buffer);
+
+    const RgStats &GetStats() const;
+
+  private:
+    struct State
+    {
+        VkPipelineStageFlags writeStages = 0;
+        VkAccessFlags writeAccess = 0;
+        VkPipelineStageFlags readStages = 0;
+        VkPipelineStageFlags visibleStages = 0; // stages the last write was made visible to
+        VkAccessFlags visibleAccess = 0;
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    };
+
+    struct Resource
+    {
+        str name;
+        VkImage image{};
+        VkBuffer buffer{};
+        VkImageAspectFlags aspect = 0;
+        opt<RgAccess> final; // images only
+        State state;
+        u32 firstPass = 0;
+        u32 lastPass = 0;
+    };
+
+    struct Barriers
+    {
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+        list<VkImageMemoryBarrier> images;
+        list<VkBufferMemoryBarrier> buffers;
+    };
+
+    list<Resource> resources;
+    list<RgPass> passes;
+    list<bool> alive;
+    list<Barriers> passBarriers;
+    Barriers finalBarriers;
+    RgStats stats;
+
+    static constexpr u32 None = 0xFFFFFFFF;
+
+    void CullPasses();
+    void AddBarrier(Barriers &barriers, Resource &resource, const RgAccess &access);
+    void Submit(VkCommandBuffer buffer, const Barriers &barriers);
+};
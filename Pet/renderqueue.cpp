@@ -0,0 +1,132 @@
+#include "renderqueue.h"
+
+#include "threads.h"
+
+#include <cstring>
+
+u64 RenderQueue::MakeKey(u32 pass, u32 pipeline, u32 material, u32 mesh, float depth)
+{
+    // Positive floats keep their order when compared as integers
+    depth = std::max(depth, 0.f);
+
+    u32 depthBits;
+    std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+    return (static_cast<u64>(pass & 0xF) << 60) |        //
+           (static_cast<u64>(pipeline & 0xFFF) << 47) |  //
+           (static_cast<u64>(material & 0xFFFF) << 31) | //
+           (static_cast<u64>(mesh & 0x7FF) << 20) |      //
+           static_cast<u64>(depthBits >> 11);
+}
+
+u64 RenderQueue::MakeDepthKey(u32 pass, u32 pipeline, u32 material, u32 mesh, float depth)
+{
+    depth = std::max(depth, 0.f);
+
+    u32 depthBits;
+    std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+    return (static_cast<u64>(pass & 0xF) << 60) |        //
+           (static_cast<u64>(pipeline & 0xFFF) << 47) |  //
+           (static_cast<u64>(depthBits >> 11) << 27) |   //
+           (static_cast<u64>(material & 0xFFFF) << 11) | //
+           static_cast<u64>(mesh & 0x7FF);
+}
+
+u64 RenderQueue::MakeBlendKey(u32 pass, u32 pipeline, u32 material, u32 mesh, float depth)
+{
+    depth = std::max(depth, 0.f);
+
+    u32 depthBits;
+    std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+    // Inverted so the farthest draw sorts first
+    auto farBits = 0xFFFFF - (depthBits >> 11);
+
+    return (static_cast<u64>(pass & 0xF) << 60) |        //
+           (static_cast<u64>(1) << 59) |                 //
+           (static_cast<u64>(farBits & 0xFFFFF) << 39) | //
+           (static_cast<u64>(pipeline & 0xFFF) << 27) |  //
+           (static_cast<u64>(material & 0xFFFF) << 11) | //
+           static_cast<u64>(mesh & 0x7FF);
+}
+
+void RenderQueue::Clear()
+{
+    packets.clear();
+}
+
+void RenderQueue::Submit(u64 key, u32 draw)
+{
+    packets.push_back({key, draw});
+}
+
+// Stable LSD radix sort, one byte per pass. Every worker counts digits in its
+// own chunk, offsets are laid out bucket by bucket then worker by worker so
+// each worker scatters its chunk without contention. Passes where all keys
+// share the same digit are skipped, which is most of them for small scenes.
+void RenderQueue::Sort(Threads &threads)
+{
+    auto count = packets.size();
+
+    if (count < 2)
+        return;
+
+    auto workers = count < ParallelThreshold ? 1u : static_cast<u32>(std::max(1, threads.GetThreadNum()));
+    auto chunk = (count + workers - 1) / workers;
+
+    scratch.resize(count);
+    histograms.resize(workers);
+
+    for (u32 shift = 0; shift < 64; shift += RadixBits)
+    {
+        threads.ParallelFor(workers, [&](u32 worker) {
+            auto &histogram = histograms[worker];
+            histogram.fill(0);
+
+            auto first = std::min(count, worker * chunk);
+            auto last = std::min(count, first + chunk);
+
+            for (auto i = first; i < last; i++)
+                histogram[(packets[i].key >> shift) & (Buckets - 1)]++;
+        });
+
+        auto digit = (packets[0].key >> shift) & (Buckets - 1);
+        size_t sameDigit = 0;
+
+        for (const auto &histogram : histograms)
+            sameDigit += histogram[digit];
+
+        if (sameDigit == count)
+            continue;
+
+        u32 offset = 0;
+
+        for (u32 bucket = 0; bucket < Buckets; bucket++)
+        {
+            for (auto &histogram : histograms)
+            {
+                auto bucketCount = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += bucketCount;
+            }
+        }
+
+        threads.ParallelFor(workers, [&](u32 worker) {
+            auto &histogram = histograms[worker];
+
+            auto first = std::min(count, worker * chunk);
+            auto last = std::min(count, first + chunk);
+
+            for (auto i = first; i < last; i++)
+                scratch[histogram[(packets[i].key >> shift) & (Buckets - 1)]++] = packets[i];
+        });
+
+        packets.swap(scratch);
+    }
+}
+
+const list<RenderPacket> &RenderQueue::GetPackets() const
+{
+    return packets;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "core.h"
+
+class Threads;
+
+struct RenderPacket
+{
+    u64 key = 0;
+    u32 draw = 0; // index in the draw list
+};
+
+// Packets are ordered by key, most significant field first:
+// | pass 4 | blend 1 | pipeline 12 | material 16 | mesh 11 | depth 20 |
+// so draws sharing a pipeline and then a material end up next to each other
+// and recording can skip the binds that would not change anything.
+// Depth keys move the depth ahead of material and mesh:
+// | pass 4 | blend 1 | pipeline 12 | depth 20 | material 16 | mesh 11 |
+// trading binds for front to back order inside each pipeline.
+// Blend keys set the blend bit, so blended draws follow the opaque ones of
+// their pass, and order them back to front ahead of any state:
+// | pass 4 | blend 1 | far depth 20 | pipeline 12 | material 16 | mesh 11 |
+class RenderQueue
+{
+  public:
+    static u64 MakeKey(u32 pass, u32 pipeline, u32 material, u32 mesh, float depth);
+    static u64 MakeDepthKey(u32 pass, u32 pipeline, u32 material, u32 mesh, float depth);
+    static u64 MakeBlendKey(u32 pass, u32 pipeline, u32 material, u32 mesh, float depth);
+
+    void Clear();
+    void Submit(u64 key, u32 draw);
+    void Sort(Threads &threads);
+
+    const list<RenderPacket> &GetPackets() const;
+
+  private:
+    static constexpr u32 RadixBits = 8;
+    static constexpr u32 Buckets = 1 << RadixBits;
+    static constexpr u32 ParallelThreshold = 16384;
+
+    list<RenderPacket> packets;
+    list<RenderPacket> scratch;
+    list<arr<u32, Buckets>> histograms; // one per worker
+};
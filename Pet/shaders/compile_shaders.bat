@@ -1,3 +1,7 @@
 C:/VulkanSDK/1.3.224.1/Bin/glslc.exe shader.vert -o shader.vert.spv
 C:/VulkanSDK/1.3.224.1/Bin/glslc.exe shader.frag -o shader.frag.spv
+C:/VulkanSDK/1.3.224.1/Bin/glslc.exe cull.comp -o cull.comp.spv
+C:/VulkanSDK/1.3.224.1/Bin/glslc.exe particle.comp -o particle.comp.spv
+C:/VulkanSDK/1.3.224.1/Bin/glslc.exe particle.vert -o particle.vert.spv
+C:/VulkanSDK/1.3.224.1/Bin/glslc.exe particle.frag -o particle.frag.spv
 pause
\ No newline at end of file
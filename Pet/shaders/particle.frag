@@ -0,0 +1,16 @@
+#version 450
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragCorner;
+
+layout(location = 0) out vec4 outColor;
+
+// Round and soft edged out of the quad
+void main() {
+    float falloff = 1.0 - dot(fragCorner, fragCorner);
+
+    if (falloff <= 0.0)
+        discard;
+
+    outColor = vec4(fragColor.rgb, fragColor.a * falloff);
+}
@@ -0,0 +1,61 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform Camera {
+    mat4 viewProj;
+} camera;
+
+layout(set = 0, binding = 1) uniform Params {
+    vec4 position;
+    vec4 velocity;
+    vec4 gravity;
+    vec4 color;
+    float dt;
+    uint emitCount;
+    uint seed;
+    float size;
+} params;
+
+struct Particle {
+    vec4 position; // xyz, w age
+    vec4 velocity; // xyz, w lifetime
+    vec4 color;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer Particles {
+    Particle particles[];
+};
+
+layout(std430, set = 0, binding = 3) readonly buffer State {
+    uint current;
+} state;
+
+layout(std430, set = 0, binding = 5) readonly buffer Alive {
+    uint alive[];
+};
+
+layout(push_constant) uniform Constants {
+    uint capacity;
+} constants;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragCorner;
+
+// Two triangles per instance, no vertex buffer
+const vec2 CORNERS[6] = vec2[](vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+                               vec2(1.0, 1.0), vec2(-1.0, 1.0), vec2(-1.0, -1.0));
+
+void main() {
+    uint index = alive[state.current * constants.capacity + gl_InstanceIndex];
+    Particle particle = particles[index];
+    vec2 corner = CORNERS[gl_VertexIndex];
+
+    // Camera right and up in world space are the first two rows of the view,
+    // which the projection only scales, so the quad always faces the camera
+    vec3 right = normalize(vec3(camera.viewProj[0][0], camera.viewProj[1][0], camera.viewProj[2][0]));
+    vec3 up = normalize(vec3(camera.viewProj[0][1], camera.viewProj[1][1], camera.viewProj[2][1]));
+    vec3 offset = (right * corner.x + up * corner.y) * params.size;
+
+    gl_Position = camera.viewProj * vec4(particle.position.xyz + offset, 1.0);
+    fragColor = vec4(particle.color.rgb, particle.color.a * (1.0 - particle.position.w / particle.velocity.w));
+    fragCorner = corner;
+}
@@ -1,9 +1,49 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(set = 1, binding = 0) uniform texture2D textures[];
+layout(set = 1, binding = 1) uniform sampler textureSampler;
+
+struct Material {
+    vec4 color;
+    uint textureIndex;
+};
+
+layout(std430, set = 1, binding = 2) readonly buffer Materials {
+    Material materials[];
+};
+
+layout(push_constant) uniform Constants {
+    vec4 tint;
+    uint objectIndex;
+    uint materialIndex;
+} constants;
+
+// Material features, see ShaderFeature. Specialized per pipeline variant so
+// the branches on them compile out.
+layout(constant_id = 0) const bool TEXTURE = true;
+layout(constant_id = 1) const bool VERTEX_COLOR = true;
+layout(constant_id = 2) const bool ALPHA_TEST = false;
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUV;
+layout(location = 2) flat in uint fragMaterial;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    // Instanced draws fetch the material per instance
+    Material material = materials[fragMaterial];
+    vec4 color = material.color;
+
+    if (VERTEX_COLOR)
+        color.rgb *= fragColor;
+
+    if (TEXTURE)
+        color *= texture(sampler2D(textures[nonuniformEXT(material.textureIndex)], textureSampler), fragUV);
+
+    if (ALPHA_TEST && color.a < 0.5)
+        discard;
+
+    outColor = color;
 }
\ No newline at end of file
@@ -1,11 +1,59 @@
 #version 450
 
+layout(set = 0, binding = 0) uniform Camera {
+    mat4 viewProj;
+} camera;
+
+struct Object {
+    mat4 model;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Objects {
+    Object objects[];
+};
+
+struct Instance {
+    mat4 model;
+    uint mesh;
+    uint material;
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer Instances {
+    Instance instances[];
+};
+
+layout(push_constant) uniform Constants {
+    vec4 tint;
+    uint objectIndex;
+    uint materialIndex;
+} constants;
+
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inUV;
 
 layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragUV;
+layout(location = 2) flat out uint fragMaterial;
+
+// objectIndex value for GPU culled instances, see GpuInstanced
+const uint INSTANCED = 0xFFFFFFFFu;
+// objectIndex value for batched sprites, see SpriteBatched
+const uint SPRITE = 0xFFFFFFFEu;
+
+// The depth prepass and the EQUAL tested main pass must agree bit for bit
+invariant gl_Position;
 
 void main() {
-    gl_Position = vec4(inPosition, 0.0, 1.0);
-    fragColor = inColor;
+    bool instanced = constants.objectIndex == INSTANCED;
+    bool sprite = constants.objectIndex == SPRITE;
+    mat4 model = sprite ? mat4(1.0) :
+                 instanced ? instances[gl_InstanceIndex].model : objects[constants.objectIndex].model;
+
+    gl_Position = camera.viewProj * model * vec4(inPosition, 0.0, 1.0);
+    fragColor = inColor * constants.tint.rgb;
+    fragUV = inUV;
+    // Sprite runs carry their material in firstInstance
+    fragMaterial = sprite ? uint(gl_InstanceIndex) :
+                   instanced ? instances[gl_InstanceIndex].material : constants.materialIndex;
 }
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "simplify.h"
+
+// 21 bits per axis, BuildChain never goes past 1024 cells per axis
+static u64 CellKey(const glm::vec3 &position, const glm::vec3 &origin, float cellSize)
+{
+    auto cell = glm::floor((position - origin) / cellSize);
+
+    return (static_cast<u64>(cell.x) & 0x1FFFFF) |         //
+           ((static_cast<u64>(cell.y) & 0x1FFFFF) << 21) | //
+           ((static_cast<u64>(cell.z) & 0x1FFFFF) << 42);
+}
+
+// Vertices of a cell collapse onto the one closest to their average, which
+// keeps them inside the cell. Triangles left with less than three distinct
+// corners disappear.
+LodLevel Simplify::Cluster(const list<glm::vec3> &positions, const list<u32> &indices, float cellSize)
+{
+    LodLevel level;
+
+    if (positions.empty() || cellSize <= 0.f)
+        return level;
+
+    auto origin = positions[0];
+
+    for (const auto &position : positions)
+        origin = glm::min(origin, position);
+
+    struct Cell
+    {
+        glm::vec3 sum = glm::vec3(0.f);
+        u32 count = 0;
+        u32 representative = 0;
+        float distance = limits<float>::max();
+    };
+
+    dic<u64, u32> cellIds;
+    list<Cell> cells;
+    list<u32> vertexCells(positions.size());
+
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        auto [it, inserted] = cellIds.try_emplace(CellKey(positions[i], origin, cellSize), static_cast<u32>(cells.size()));
+
+        if (inserted)
+            cells.emplace_back();
+
+        auto &cell = cells[it->second];
+        cell.sum += positions[i];
+        cell.count++;
+        vertexCells[i] = it->second;
+    }
+
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        auto &cell = cells[vertexCells[i]];
+        auto distance = glm::length(positions[i] - cell.sum / static_cast<float>(cell.count));
+
+        if (distance < cell.distance)
+        {
+            cell.distance = distance;
+            cell.representative = static_cast<u32>(i);
+        }
+    }
+
+    for (size_t i = 0; i < positions.size(); i++)
+    {
+        auto representative = cells[vertexCells[i]].representative;
+        level.error = std::max(level.error, glm::length(positions[i] - positions[representative]));
+    }
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        auto a = cells[vertexCells[indices[i]]].representative;
+        auto b = cells[vertexCells[indices[i + 1]]].representative;
+        auto c = cells[vertexCells[indices[i + 2]]].representative;
+
+        if (a != b && b != c && c != a)
+            level.indices.insert(level.indices.end(), {a, b, c});
+    }
+
+    return level;
+}
+
+// Every level is clustered from the source so its error is measured against
+// full detail, the cell size grows until the triangle budget is met
+list<LodLevel> Simplify::BuildChain(const list<glm::vec3> &positions, const list<u32> &indices, u32 maxLevels,
+                                    float reduction)
+{
+    list<LodLevel> chain = {{indices, 0.f}};
+
+    if (positions.empty())
+        return chain;
+
+    auto min = positions[0];
+    auto max = positions[0];
+
+    for (const auto &position : positions)
+    {
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+    }
+
+    auto extent = std::max(max.x - min.x, std::max(max.y - min.y, max.z - min.z));
+    auto cellSize = extent / 1024.f;
+
+    while (chain.size() < maxLevels && extent > 0.f)
+    {
+        auto budget = static_cast<size_t>(static_cast<float>(chain.back().indices.size() / 3) * reduction) * 3;
+        LodLevel level;
+
+        do
+        {
+            level = Cluster(positions, indices, cellSize);
+            cellSize *= 1.25f;
+        } while (level.indices.size() > budget && cellSize < extent * 2.f);
+
+        if (level.indices.empty() || level.indices.size() >= chain.back().indices.size())
+            break;
+
+        level.error = std::max(level.error, chain.back().error);
+        chain.push_back(std::move(level));
+    }
+
+    return chain;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "core.h"
+
+// Triangle list over a subset of the source vertices, drawn in place of the
+// full mesh. The error is how far any vertex moved, in mesh units.
+struct LodLevel
+{
+    list<u32> indices;
+    float error = 0.f;
+};
+
+// Offline mesh simplification, meant to run once per mesh when it is loaded.
+// Every level only re-indexes the original vertices, so a whole LOD chain
+// shares one vertex range and only adds index ranges to the pool.
+namespace Simplify
+{
+
+// Vertex clustering on a uniform grid of the given cell size
+LodLevel Cluster(const list<glm::vec3> &positions, const list<u32> &indices, float cellSize);
+
+// Level 0 is the source mesh, each next level keeps at most reduction times
+// the triangles of the previous one. Stops early once nothing is left to drop.
+list<LodLevel> BuildChain(const list<glm::vec3> &positions, const list<u32> &indices, u32 maxLevels,
+                          float reduction = 0.5f);
+
+} // namespace Simplify
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "core.h"
+
+// Fixed size ring for exactly one producer thread and one consumer thread,
+// no locks. Each side only writes its own index, the other one is read with
+// acquire so the slot contents it guards are visible. One slot stays empty
+// to tell a full ring from an empty one.
+template <typename T, u32 Size> class SpscQueue
+{
+    static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "SpscQueue size must be a power of two");
+
+  public:
+    // Producer side, false when the ring is full and the item was not added
+    bool Push(const T &item)
+    {
+        auto tail = this->tail.load(std::memory_order_relaxed);
+        auto next = (tail + 1) & (Size - 1);
+
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+
+        items[tail] = item;
+        this->tail.store(next, std::memory_order_release);
+
+        return true;
+    }
+
+    // Consumer side, the oldest item or null when empty. Valid until Pop.
+    const T *Peek() const
+    {
+        auto head = this->head.load(std::memory_order_relaxed);
+
+        if (head == tail.load(std::memory_order_acquire))
+            return nullptr;
+
+        return &items[head];
+    }
+
+    // Consumer side, only after Peek returned an item
+    void Pop()
+    {
+        auto head = this->head.load(std::memory_order_relaxed);
+        this->head.store((head + 1) & (Size - 1), std::memory_order_release);
+    }
+
+    bool Empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+  private:
+    arr<T, Size> items{};
+
+    // Apart so the two threads do not share a cache line
+    alignas(64) std::atomic<u32> head{0}; // next to read, written by the consumer
+    alignas(64) std::atomic<u32> tail{0}; // next to write, written by the producer
+};
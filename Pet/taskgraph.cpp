@@ -0,0 +1,165 @@
+#include "taskgraph.h"
+
+#include "threads.h"
+
+u32 TaskGraph::Add(const str &name, del<void()> execute, const list<u32> &after, bool mainThread)
+{
+    auto id = static_cast<u32>(tasks.size());
+
+    for (auto dependency : after)
+        if (dependency >= id)
+            throw std::runtime_error("\nTask \"" + name + "\" depends on a task added after it!");
+
+    Task task;
+    task.name = name;
+    task.execute = std::move(execute);
+    task.after = after;
+    task.mainThread = mainThread;
+
+    tasks.push_back(std::move(task));
+
+    return id;
+}
+
+void TaskGraph::Run(Threads &threads)
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::exception_ptr error;
+    std::queue<u32> mainReady;
+    u32 running = 0; // scheduled and not done yet
+    dic<std::thread::id, u32> threadLanes = {{std::this_thread::get_id(), 0}};
+
+    list<u32> waiting(tasks.size());
+    list<list<u32>> dependents(tasks.size());
+
+    for (u32 id = 0; id < tasks.size(); id++)
+    {
+        waiting[id] = static_cast<u32>(tasks[id].after.size());
+
+        for (auto dependency : tasks[id].after)
+            dependents[dependency].push_back(id);
+    }
+
+    // Without a pool everything runs on the caller, in dependency order
+    auto pooled = threads.GetThreadNum() > 0;
+    auto start = clk::now();
+
+    del<void(u32)> execute;
+
+    // Called with the lock held
+    auto schedule = [&](u32 id) {
+        running++;
+
+        if (tasks[id].mainThread || !pooled)
+            mainReady.push(id);
+        else
+            threads.AddJob([&execute, id]() { execute(id); });
+    };
+
+    execute = [&](u32 id) {
+        auto &task = tasks[id];
+        std::exception_ptr taskError;
+
+        task.startMs = ElapsedMs(start);
+
+        try
+        {
+            task.execute();
+        }
+        catch (...)
+        {
+            taskError = std::current_exception();
+        }
+
+        task.endMs = ElapsedMs(start);
+
+        std::unique_lock<std::mutex> lock(mutex);
+
+        task.lane = threadLanes.try_emplace(std::this_thread::get_id(), static_cast<u32>(threadLanes.size())).first->second;
+
+        if (taskError && !error)
+            error = taskError;
+
+        if (!error)
+            for (auto dependent : dependents[id])
+                if (--waiting[dependent] == 0)
+                    schedule(dependent);
+
+        running--;
+        cond.notify_all();
+    };
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        for (u32 id = 0; id < tasks.size(); id++)
+            if (waiting[id] == 0)
+                schedule(id);
+
+        while (true)
+        {
+            cond.wait(lock, [&]() { return !mainReady.empty() || running == 0; });
+
+            if (mainReady.empty())
+                break;
+
+            auto id = mainReady.front();
+            mainReady.pop();
+
+            // Main thread tasks queued before a failure are dropped
+            if (error)
+            {
+                running--;
+                continue;
+            }
+
+            lock.unlock();
+            execute(id);
+            lock.lock();
+        }
+    }
+
+    elapsedMs = ElapsedMs(start);
+    lanes = static_cast<u32>(threadLanes.size());
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void TaskGraph::PrintTimeline(const str &title) const
+{
+    constexpr u32 Width = 40;
+
+    list<u32> order(tasks.size());
+
+    for (u32 i = 0; i < order.size(); i++)
+        order[i] = i;
+
+    std::stable_sort(order.begin(), order.end(), [&](u32 a, u32 b) { return tasks[a].startMs < tasks[b].startMs; });
+
+    std::cout << std::endl
+              << title << " [" << tasks.size() << " tasks on " << lanes << " threads, " << elapsedMs << " ms]"
+              << std::endl;
+
+    for (auto id : order)
+    {
+        const auto &task = tasks[id];
+        auto scale = elapsedMs > 0. ? Width / elapsedMs : 0.;
+        auto begin = std::min(Width - 1, static_cast<u32>(task.startMs * scale));
+        auto end = std::max(begin + 1, std::min(Width, static_cast<u32>(task.endMs * scale + 0.5)));
+
+        std::cout << "    |" << str(begin, ' ') << str(end - begin, '#') << str(Width - end, ' ') << "| " << task.name
+                  << ": " << task.startMs << " - " << task.endMs << " ms on thread " << task.lane << std::endl;
+    }
+}
+
+const list<Task> &TaskGraph::GetTasks() const
+{
+    return tasks;
+}
+
+double TaskGraph::GetElapsedMs() const
+{
+    return elapsedMs;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "core.h"
+
+class Threads;
+
+struct Task
+{
+    str name;
+    del<void()> execute;
+    list<u32> after;         // tasks that must be done first
+    bool mainThread = false; // GLFW window calls, anything that waits on the pool
+    double startMs = 0.;     // since the graph started running
+    double endMs = 0.;
+    u32 lane = 0; // thread it ran on, 0 is the one that called Run
+};
+
+// One shot dependency graph over the thread pool. A task is handed to the pool
+// as soon as every task it comes after is done, main thread tasks run on the
+// caller in between. Dependencies must be added before their dependents, which
+// keeps the graph free of cycles. The first exception stops scheduling, waits
+// for the running tasks and is rethrown from Run.
+class TaskGraph
+{
+  public:
+    u32 Add(const str &name, del<void()> execute, const list<u32> &after = {}, bool mainThread = false);
+    void Run(Threads &threads);
+
+    // One line per task in start order, with a bar across the whole run
+    void PrintTimeline(const str &title) const;
+
+    const list<Task> &GetTasks() const;
+    double GetElapsedMs() const;
+
+  private:
+    list<Task> tasks;
+    double elapsedMs = 0.;
+    u32 lanes = 0;
+};
@@ -2,6 +2,8 @@
 
 Threads *Threads::_instance;
 
+static thread_local bool poolThread = false; // set for the threads running Loop
+
 Threads *Threads::Instance()
 {
     return _instance;
@@ -50,6 +52,8 @@ void Threads::Exit()
 
 void Threads::Loop()
 {
+    poolThread = true;
+
     while (true)
     {
         job job;
@@ -71,6 +75,27 @@ void Threads::Loop()
 end:;
 }
 
+// Takes the oldest queued job and runs it on the calling thread, false when the
+// queue is empty
+bool Threads::RunQueuedJob()
+{
+    job job;
+
+    {
+        std::unique_lock<std::mutex> lock(_instance->_mutex);
+
+        if (_instance->_jobs.empty())
+            return false;
+
+        job = _instance->_jobs.front();
+        _instance->_jobs.pop();
+    }
+
+    job();
+
+    return true;
+}
+
 void Threads::AddJob(del<void()> job)
 {
     {
@@ -81,6 +106,83 @@ void Threads::AddJob(del<void()> job)
     _cond.notify_one();
 }
 
+// Runs fn(0..count-1) across the pool, the calling thread takes index 0, and
+// blocks until every index is done. Exceptions are rethrown on the caller.
+// Called from a pool job, the caller runs queued jobs while it waits rather
+// than blocking a worker the remaining indices may need.
+void Threads::ParallelFor(u32 count, const del<void(u32)> &fn)
+{
+    if (count == 0)
+        return;
+
+    if (_poolSize == 0 || count == 1)
+    {
+        for (u32 i = 0; i < count; i++)
+            fn(i);
+        return;
+    }
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::exception_ptr error;
+    u32 remaining = count - 1;
+
+    for (u32 i = 1; i < count; i++)
+        AddJob([&, i]() {
+            std::exception_ptr jobError;
+
+            try
+            {
+                fn(i);
+            }
+            catch (...)
+            {
+                jobError = std::current_exception();
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+
+            if (jobError && !error)
+                error = jobError;
+
+            remaining--;
+            cond.notify_one();
+        });
+
+    try
+    {
+        fn(0);
+    }
+    catch (...)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+
+        if (!error)
+            error = std::current_exception();
+    }
+
+    // Once the queue is empty every index left is running on another thread
+
+    if (poolThread)
+    {
+        auto done = [&]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            return remaining == 0;
+        };
+
+        while (!done() && RunQueuedJob())
+            ;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]() { return remaining == 0; });
+    }
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
 int Threads::GetThreadNum()
 {
     return _poolSize;
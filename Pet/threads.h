@@ -10,6 +10,7 @@ class Threads
     static Threads *_instance;
 
     static void Loop();
+    static bool RunQueuedJob();
 
   public:
     static Threads *Instance();
@@ -33,5 +34,6 @@ class Threads
     void Exit();
 
     void AddJob(del<void()> job);
+    void ParallelFor(u32 count, const del<void(u32)> &fn);
     int GetThreadNum();
 };
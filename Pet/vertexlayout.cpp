@@ -0,0 +1,71 @@
+#include "vertexlayout.h"
+
+#include <glm/gtc/packing.hpp>
+
+#include <cstring>
+
+template <typename T> static void Store(u8 *out, u32 index, T value)
+{
+    std::memcpy(out + index * sizeof(T), &value, sizeof(T));
+}
+
+static u32 Components(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R32G32_SFLOAT:
+    case VK_FORMAT_R16G16_SFLOAT:
+    case VK_FORMAT_R16G16_SNORM:
+    case VK_FORMAT_R16G16_UNORM:
+        return 2;
+    case VK_FORMAT_R32G32B32_SFLOAT:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+bool VertexFormat::Encode(VkFormat format, const glm::vec4 &value, u8 *out)
+{
+    auto fits = true;
+
+    for (u32 i = 0; i < Components(format); i++)
+    {
+        auto v = value[i];
+
+        switch (format)
+        {
+        case VK_FORMAT_R32G32B32A32_SFLOAT:
+        case VK_FORMAT_R32G32B32_SFLOAT:
+        case VK_FORMAT_R32G32_SFLOAT:
+            Store(out, i, v);
+            break;
+        case VK_FORMAT_R16G16B16A16_SFLOAT:
+        case VK_FORMAT_R16G16_SFLOAT:
+            Store(out, i, glm::packHalf1x16(v));
+            break;
+        case VK_FORMAT_R16G16B16A16_SNORM:
+        case VK_FORMAT_R16G16_SNORM:
+            fits &= v >= -1.f && v <= 1.f;
+            Store(out, i, glm::packSnorm1x16(v));
+            break;
+        case VK_FORMAT_R16G16B16A16_UNORM:
+        case VK_FORMAT_R16G16_UNORM:
+            fits &= v >= 0.f && v <= 1.f;
+            Store(out, i, glm::packUnorm1x16(v));
+            break;
+        case VK_FORMAT_R8G8B8A8_SNORM:
+            fits &= v >= -1.f && v <= 1.f;
+            Store(out, i, glm::packSnorm1x8(v));
+            break;
+        case VK_FORMAT_R8G8B8A8_UNORM:
+            fits &= v >= 0.f && v <= 1.f;
+            Store(out, i, glm::packUnorm1x8(v));
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return fits;
+}
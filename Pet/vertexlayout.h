@@ -0,0 +1,93 @@
+#pragma once
+
+#include "core.h"
+
+// Storage formats a vertex attribute can be packed with. Shaders read every one
+// of them as floats, normalized formats only cover [-1, 1] (snorm) or [0, 1]
+// (unorm) and half floats lose precision past a few thousand units.
+namespace VertexFormat
+{
+
+constexpr u32 Size(VkFormat format)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        return 16;
+    case VK_FORMAT_R32G32B32_SFLOAT:
+        return 12;
+    case VK_FORMAT_R32G32_SFLOAT:
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+    case VK_FORMAT_R16G16B16A16_SNORM:
+    case VK_FORMAT_R16G16B16A16_UNORM:
+        return 8;
+    case VK_FORMAT_R16G16_SFLOAT:
+    case VK_FORMAT_R16G16_SNORM:
+    case VK_FORMAT_R16G16_UNORM:
+    case VK_FORMAT_R8G8B8A8_SNORM:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+// Writes as many components of value as the format holds. Returns false when
+// one of them was clamped to the normalized range.
+bool Encode(VkFormat format, const glm::vec4 &value, u8 *out);
+
+} // namespace VertexFormat
+
+// Single interleaved binding, one attribute per format at locations 0, 1, ...
+// Offsets, stride and the pipeline descriptions are all resolved at compile
+// time, only packing the values runs.
+template <VkFormat... Formats> struct VertexLayout
+{
+    static constexpr u32 AttributeCount = sizeof...(Formats);
+    static constexpr arr<VkFormat, AttributeCount> formats = {Formats...};
+    static constexpr u32 stride = (VertexFormat::Size(Formats) + ...);
+
+    static_assert(((VertexFormat::Size(Formats) > 0) && ...), "Unsupported vertex format");
+    static_assert(stride % 4 == 0, "Vertex attributes must stay 4 byte aligned");
+
+    static constexpr VkVertexInputBindingDescription binding = {0, stride, VK_VERTEX_INPUT_RATE_VERTEX};
+
+    static constexpr arr<VkVertexInputAttributeDescription, AttributeCount> attributes = [] {
+        arr<VkVertexInputAttributeDescription, AttributeCount> desc{};
+        u32 offset = 0;
+
+        for (u32 i = 0; i < AttributeCount; i++)
+        {
+            desc[i] = {i, 0, formats[i], offset};
+            offset += VertexFormat::Size(formats[i]);
+        }
+
+        return desc;
+    }();
+
+    // One value per attribute, returns false when any of them was clamped
+    static bool Pack(const arr<glm::vec4, AttributeCount> &values, u8 *out)
+    {
+        auto fits = true;
+
+        for (u32 i = 0; i < AttributeCount; i++)
+            fits &= VertexFormat::Encode(formats[i], values[i], out + attributes[i].offset);
+
+        return fits;
+    }
+};
+
+// Layouts of the position, color and uv attributes the shaders expect
+namespace VertexLayouts
+{
+
+// 28 bytes, what Vertex holds
+using Float = VertexLayout<VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32_SFLOAT>;
+
+// 12 bytes, half float positions and uvs, 8 bit colors
+using Half = VertexLayout<VK_FORMAT_R16G16_SFLOAT, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R16G16_SFLOAT>;
+
+// 12 bytes, positions in [-1, 1] and uvs in [0, 1] with 16 bit precision
+using Snorm = VertexLayout<VK_FORMAT_R16G16_SNORM, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R16G16_UNORM>;
+
+} // namespace VertexLayouts